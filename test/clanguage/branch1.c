@@ -1,16 +1,72 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
+#include <elf.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 
-#define INITIAL_LBR_CAPACITY 10
-#define INITIAL_LINE_SIZE 1024
 #define INITIAL_EXTRA_FIELDS_SIZE 4
+#define SCAN_WINDOW_SIZE (64UL << 20)  // 每次mmap的窗口大小
+#define SCAN_READ_SIZE (1UL << 20)     // 无法mmap的输入（管道等）每次read的大小
+#define MAX_LBR_ENTRIES 32             // 硬件LBR最多32项
+#define MAX_BRSTACK_LINE 8192          // 向量化解码支持的最长行，更长的行交给parseBranchSample
+#define ARENA_BLOCK_SIZE (1UL << 20)   // arena每次向系统申请的块大小
+#define ARENA_BATCH_LINES 4096         // 每处理这么多行重置一次arena
+#define INITIAL_TRACE_TABLE_SIZE 4096  // 分支trace哈希表的初始槽数，必须是2的幂
+#define EMPTY_TRACE_KEY UINT64_MAX     // 空槽的key，From/To都是0xffffffff的trace不会出现
+#define TEMP_FUNC_FILE "perf_temp_func.log"  // 函数信息：函数名 地址 大小，按地址排序
+#define ADDRESS_CACHE_BITS 12          // 函数查找缓存的槽数为2^ADDRESS_CACHE_BITS
+#define MAX_PARSE_THREADS 256
+#define TEMP_FDATA_FILE "perf.fdata"
+#define TEMP_BFDATA_FILE "perf.bfdata"  // --compact时代替perf.fdata的二进制profile
+#define TEMP_DSO_FDATA_FORMAT "perf.%s.fdata"    // --all-dsos时每个DSO的profile，%s是文件名
+#define TEMP_DSO_BFDATA_FORMAT "perf.%s.bfdata"
+#define TEMP_AGGREGATED_FILE "perf_aggregated.log"  // --aggregate时输出的预聚合profile
+#define TEMP_MEM_PROFILE_FILE "perf_mem_profile.log"  // --mem时输出的访存profile
+#define MEM_BUCKET_BITS 6              // 数据地址按64字节（cache line）分桶
+#define EXTERNAL_BUCKET (1ULL << 63)   // 桶编号的最高位：数据地址不在可执行文件中（堆、栈、共享库）
+#define BINARY_PROFILE_MAGIC "BFDATA\0\0"
+#define BINARY_PROFILE_VERSION 1
+#define MAX_BUILD_ID_SIZE 32
+#define TEMP_READELF_FILE "perf_temp_readelf_temp.log"  // 布局信息：LOAD段、FirstAllocAddress和LayoutStartAddress
+#define MAX_LOAD_SEGMENTS 16
+#define LAYOUT_PAGE_SIZE 0x200000      // BOLT新段按2MB对齐
+#define LAYOUT_CACHE_LINE 64
+#define EXTRA_PHDRS 3                  // BOLT为新段预留的程序头个数
+#define DOWNSAMPLE_SEED 0x2545F4914F6CDD1DULL  // --sample-rate伪随机选择的种子，固定以保证结果可以重复
+#define BUDGET_CHECK_LINES 1024        // --time-budget时每处理这么多个sample检查一次时间
+#define TOP_EDGES_REPORTED 10          // 下采样时报告误差的最热跳转数
 
 const uint64_t KernelBaseAddr = 0xffff800000000000;
 bool IgnoreInterruptLBR = true;
 
+bool KeepExtraFields = false;  // 是否保留cycles等额外字段，只有调试时才需要
+__thread uint64_t NumTruncatedEntries = 0;  // 超过MAX_LBR_ENTRIES被丢弃的LBR项
+const char *BinaryPath = NULL;  // 可执行文件，给出时直接读取ELF生成函数表，不再依赖perf_temp_func.log
+bool CompactProfile = false;    // 输出二进制格式的perf.bfdata而不是文本的perf.fdata
+bool PreAggregated = false;     // 输入是预聚合的(from, to, count)列表而不是perf script的brstack输出
+bool WriteAggregated = false;   // 同时输出预聚合profile，可以代替原始perf.data传输
+bool MemProfile = false;        // 输入是perf_mem.log（pid event: addr ip），输出访存profile而不是perf.fdata
+const char *MMapPath = NULL;    // mmap信息，给出时按PID把运行时地址转换成可执行文件中的地址
+const char *ExecName = NULL;    // 没有--binary时，用来在mmap信息中识别可执行文件的文件名
+bool MultiDso = false;          // --all-dsos：按mmap信息为可执行文件和每个共享库分别输出profile
+double SampleRate = 1.0;        // --sample-rate：按行在输入中的偏移伪随机地只处理这个比例的sample，结果与线程数无关
+uint64_t SampleBudget = 0;      // --max-samples：最多处理的sample数，按输入大小分给各个线程，0表示不限
+double TimeBudget = 0;          // --time-budget：解析阶段的墙钟时间上限（秒），0表示不限
+bool Downsampling = false;      // 以上三项中任意一项生效时为true
+struct timespec ParseDeadline;  // --time-budget时解析必须结束的时刻
+
 int num_error = 0;
 FILE *logFile;  // 用于日志文件的句柄
 
@@ -22,383 +78,4837 @@ typedef struct {
     size_t extraFieldsCount;
 } LBREntry;
 
+/*
+ * 该结构体的功能：一个sample的LBR信息，按结构数组的方式内联存放，最多MAX_LBR_ENTRIES项
+ * From/To分开存放，mispred压缩成位图，构建trace和查找函数时顺序读取连续的cache line
+ * 额外字段（cycles等）放在可选的旁路数组里，只有KeepExtraFields时才会从arena中分配
+ * */
+typedef struct {
+    char **Fields;
+    size_t Count;
+} LBRExtraFields;
+
 typedef struct {
-    LBREntry *LBR;
-    size_t LBRCount;
-    size_t LBRCapacity;
-    uint64_t PC;
     uint64_t PID;
+    uint64_t PC;
+    uint32_t LBRCount;
+    uint32_t MispredMask;  // 第i位表示第i项是否预测失败
+    uint32_t SkipMask;     // 第i位表示第i项的from和to都不在可执行文件中，由filterLBREntries设置
+    uint64_t From[MAX_LBR_ENTRIES];
+    uint64_t To[MAX_LBR_ENTRIES];
+    LBRExtraFields *Extra;
 } PerfBranchSample;
 
+_Static_assert(MAX_LBR_ENTRIES <= 32, "MispredMask holds one bit per LBR entry");
+
+/*
+ * 该结构体的功能：按批次分配内存的arena，一批sample的LBR条目和额外字段都从这里分配
+ * 聚合完成后调用arenaReset一次性回收，块本身保留下来给下一批使用，循环中不再调用malloc/free
+ * */
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;
+    ArenaBlock *current;
+} Arena;
+
+/*
+ * 该结构体的功能：一个LOAD段，对应readelf -l输出中的一行
+ * */
+typedef struct {
+    uint64_t Offset;
+    uint64_t VirtAddr;
+    uint64_t PhysAddr;
+    uint64_t FileSize;
+    uint64_t MemSize;
+    uint32_t Flags;
+    uint64_t Align;
+} LoadSegment;
+
+/*
+ * 该结构体的功能：保存二进制文件相关信息
+ * */
+typedef struct {
+    uint64_t FirstAllocAddress;
+    uint64_t LayoutStartAddress;
+    size_t NumSegments;
+    LoadSegment Segments[MAX_LOAD_SEGMENTS];
+} BinaryLayout;
+
+BinaryLayout Layout;
+
+/*
+ * 该结构体的功能：可执行文件在某个进程中的一个可执行映射[Start, End)
+ * Base按shell脚本解析mmap事件时BasicAddress的公式计算，运行时地址减去Base就是可执行文件中的地址
+ * */
+typedef struct {
+    uint64_t Start;
+    uint64_t End;
+    uint64_t Base;
+    uint32_t Dso;  // --all-dsos时映射的文件在Dsos中的编号，否则为0
+} AddressRange;
+
+/*
+ * 该结构体的功能：一个进程的地址转换索引，保存可执行文件的全部可执行映射，按Start排序且互不重叠
+ * 映射完全相同的进程（fork出来、还没有exec的子进程）共用父进程的索引
+ * */
+typedef struct {
+    size_t NumRanges;
+    AddressRange *Ranges;
+    uint64_t Base;  // 地址最低的映射的基址，PIE的数据段（包括没有文件名的.bss）与代码段使用同一个基址
+    uint64_t Hash;
+    uint64_t Low;   // 全部映射覆盖的范围[Low, High)，范围之外的LBR项不用逐个查找
+    uint64_t High;
+} AddressIndex;
+
+typedef struct {
+    uint64_t PID;  // UINT64_MAX表示空槽
+    const AddressIndex *Index;
+} ProcessAddressSlot;
+
+/*
+ * 该结构体的功能：以PID为key的开放寻址哈希表，加载完成后只读，解析线程之间共享
+ * Capacity为0表示没有mmap信息，此时认为可执行文件是固定加载地址，不做调整
+ * */
+typedef struct {
+    ProcessAddressSlot *Slots;
+    size_t Capacity;
+    size_t Size;
+    AddressIndex **Indexes;  // 去重后的全部索引
+    size_t NumIndexes;
+} ProcessAddressTable;
+
+ProcessAddressTable ProcessAddresses;
+const AddressIndex EmptyAddressIndex = {0, NULL, 0, 0, 0, 0};  // 没有映射可执行文件的进程
+
+/*
+ * 该结构体的功能：聚合(from, to)分支trace的开放寻址哈希表，对应shell脚本中的BranchLBRs和FallthroughLBRs关联数组
+ * key是相对二进制文件的偏移，From放在高32位，To放在低32位；计数直接存放在槽里，冲突时线性探测
+ * */
+typedef struct {
+    uint64_t Key;
+    uint64_t TakenCount;
+    uint64_t MispredCount;
+} BranchTraceSlot;
+
+typedef struct {
+    BranchTraceSlot *Slots;
+    size_t Capacity;  // 槽数，总是2的幂
+    size_t Size;      // 已经使用的槽数
+    uint64_t NumOverflow;  // 偏移超过32位而无法记录的trace
+} BranchTraceTable;
+
+BranchTraceTable BranchLBRs;
+BranchTraceTable FallthroughLBRs;  // 复用BranchTraceTable，TakenCount为InternCount，MispredCount为ExternCount
+
+/*
+ * 该结构体的功能：--all-dsos时一个解析线程中某个DSO的trace表，第一次用到时才分配
+ * */
+typedef struct {
+    BranchTraceTable Traces;
+    BranchTraceTable Fallthroughs;
+} DsoTraceTables;
+
+/*
+ * 该结构体的功能：访存profile中的一项，按(代码地址, 数据地址桶)聚合
+ * */
+typedef struct {
+    uint64_t IP;      // 调整后的代码地址，不在任何函数中时为0，UINT64_MAX表示空槽
+    uint64_t Bucket;  // 数据地址 >> MEM_BUCKET_BITS，可执行文件中的数据使用调整后的地址，否则带EXTERNAL_BUCKET
+    uint64_t Loads;
+    uint64_t Stores;
+} MemAccessSlot;
+
+typedef struct {
+    MemAccessSlot *Slots;
+    size_t Capacity;
+    size_t Size;
+} MemAccessTable;
+
+/*
+ * 该结构体的功能：一个解析线程的状态，每个线程负责输入中按行对齐的一段字节区间，
+ * 使用自己的trace表、arena和计数，全部结束后再合并，线程之间不共享可写数据
+ * */
+typedef struct {
+    const char *Begin;
+    const char *End;
+    bool LogSamples;  // 只有单线程时才把每个sample写到日志里，否则日志顺序不确定
+    bool NeedsSkylakeFix;
+    BranchTraceTable Traces;
+    BranchTraceTable Fallthroughs;
+    Arena arena;
+    uint64_t NumTotalSamples;
+    uint64_t NumEntries;
+    uint64_t NumSamples;
+    uint64_t NumSamplesNoLBR;
+    uint64_t NumTraces;
+    uint64_t NumInvalidTraces;    // 起点和终点分别在两个不同的函数中
+    uint64_t NumLongRangeTraces;  // 起点或终点不在任何函数中
+    uint64_t NumFastPathSamples;
+    uint64_t NumTruncatedEntries;
+    uint64_t NumKernelEntries;    // from或to在内核中、被丢弃的LBR项
+    uint64_t NumOutsideEntries;   // from和to都不在可执行文件中、跳过函数查找的LBR项
+    uint64_t NumMalformedLines;   // 预聚合输入或perf_mem.log中无法解析的行
+    MemAccessTable MemAccesses;
+    uint64_t NumMemNoAddr;        // 没有数据地址（addr为0）的访存sample
+    uint64_t NumMemKernel;        // 内核代码中的访存sample
+    uint64_t CacheHits;
+    uint64_t CacheMisses;
+    uint64_t LastPID;                 // 相邻的sample大多来自同一个进程，缓存上一次查到的地址转换索引
+    const AddressIndex *LastIndex;
+    DsoTraceTables *DsoTraces;        // --all-dsos时按DSO编号分开的trace表
+    bool Failed;
+    uint64_t BeginOffset;             // Begin在输入文件中的偏移，用于--sample-rate的选择
+    uint64_t NumSampledOut;           // 没有被--sample-rate选中而跳过的sample
+    uint64_t SampleBudget;            // 本线程最多处理的sample数，0表示不限
+    uint64_t BytesTotal;              // 本线程负责的输入字节数，管道输入为0
+    uint64_t BytesDone;               // 预算用完时已经扫描的字节数
+    bool Stopped;                     // 因为sample或时间预算提前停止
+} BranchWorker;
+
+/*
+ * 该结构体的功能：保存一个函数的名称、起始地址和大小
+ * */
+typedef struct {
+    const char *Name;
+    uint64_t Address;
+    uint64_t Size;
+} BinaryFunction;
+
+/*
+ * 该结构体的功能：按地址排序、建好之后不再修改的函数索引
+ * 起始地址按Eytzinger（BFS）顺序存放，二分查找时访问的前几层都在同几个cache line里，
+ * 每次查找是O(log n)，函数数量达到几十万时也不需要线性扫描
+ * */
+typedef struct {
+    BinaryFunction *Functions;  // 按地址排序
+    size_t NumFunctions;
+    uint64_t *Eytz;             // Eytz[1..n]：Eytzinger顺序的起始地址，Eytz[0]不用
+    uint32_t *EytzToSorted;     // Eytz[k]对应的函数在Functions中的下标
+    Arena Names;                // 函数名的存储
+} FunctionIndex;
+
+FunctionIndex BinaryFunctions;
+FunctionIndex DataObjects;  // .data/.bss/.rodata等节中的OBJECT符号，按地址排序，用于访存profile的数据符号化
+
+/*
+ * 该结构体的功能：映射到内存中的ELF64可执行文件，取代objdump/readelf的文本输出
+ * */
+typedef struct {
+    const uint8_t *Data;
+    size_t Size;
+    const Elf64_Ehdr *Header;
+    const Elf64_Shdr *Sections;
+    size_t NumSections;
+    const char *SectionNames;
+} ElfFile;
+
+/*
+ * 该结构体的功能：生成函数表时的一个候选项，对应objdump -d输出中的一个标签或者readelf -s中的一个FUNC符号
+ * */
+typedef struct {
+    const char *Name;
+    uint64_t Address;
+    uint64_t Size;
+    size_t Section;
+    int Priority;  // 同一地址有多个标签时，数值小的优先
+    size_t Seq;
+} ElfLabel;
+
+typedef struct {
+    uint64_t Offset;  // GOT槽的地址
+    const char *Name;
+} ElfReloc;
+
+/*
+ * 该枚举的功能：指令长度解码器识别出的控制流指令类型，用于划分基本块
+ * call不结束基本块，与BOLT一致
+ * */
+typedef enum {
+    INSTR_OTHER,
+    INSTR_COND_BRANCH,    // jcc、loop、jrcxz
+    INSTR_JUMP,           // 直接jmp
+    INSTR_INDIRECT_JUMP,  // jmp *
+    INSTR_CALL,
+    INSTR_RETURN,
+    INSTR_TRAP            // ud2、int3、hlt
+} InstrKind;
+
+/*
+ * 该结构体的功能：一个函数的基本块划分，只记录fall-through所需的信息，第一次用到该函数时才反汇编
+ * */
+typedef struct {
+    uint32_t NumBlocks;      // 0表示还没有反汇编或者反汇编失败
+    bool Built;
+    uint32_t *BlockStart;    // 块的起始偏移，升序，BlockStart[0]为0
+    uint32_t *LastInstr;     // 块中最后一条指令的偏移
+    uint8_t *FallsThrough;   // 块的最后一条指令执行完后可以顺序进入下一个块
+} FunctionCFG;
+
+/*
+ * 该结构体的功能：二进制profile的头部，所有字段按小端存放，大小是8的倍数，后面紧跟字符串表
+ * */
+typedef struct {
+    char Magic[8];
+    uint32_t Version;
+    uint32_t BuildIdSize;              // 0表示不知道可执行文件的build-id
+    uint8_t BuildId[MAX_BUILD_ID_SIZE];
+    uint64_t NumFunctions;             // 字符串表中的函数个数，包括编号为0的[unknown]
+    uint64_t NumEdges;
+    uint64_t TotalCount;
+    uint64_t TotalMispred;
+    uint64_t StringTableOffset;
+    uint64_t StringTableSize;
+    uint64_t EdgesOffset;
+    uint64_t EdgesSize;
+} BinaryProfileHeader;
+
+_Static_assert(sizeof(BinaryProfileHeader) % 8 == 0, "string table offsets follow the header");
+
+/*
+ * 该结构体的功能：映射到内存中的二进制profile，函数名直接指向映射区域
+ * */
+typedef struct {
+    const uint8_t *Data;
+    size_t Size;
+    const BinaryProfileHeader *Header;
+    const uint32_t *NameOffsets;  // 第i个函数名为Names + NameOffsets[i]
+    const char *Names;
+} BinaryProfile;
+
+/*
+ * 该结构体的功能：依次读取二进制profile中的边
+ * */
+typedef struct {
+    const uint8_t *Ptr;
+    const uint8_t *End;
+    uint64_t FromId;
+    uint64_t FromOffset;
+    uint64_t NumEdges;
+} BinaryProfileCursor;
+
+/*
+ * 该结构体的功能：perf.fdata中的一行，函数名指向输入自己的存储
+ * */
+typedef struct {
+    const char *FromName;
+    const char *ToName;
+    uint64_t FromOffset;
+    uint64_t ToOffset;
+    uint64_t Mispred;
+    uint64_t Count;
+    bool FromKnown;
+    bool ToKnown;
+} ProfileEdge;
+
+/*
+ * 该结构体的功能：--merge的一个输入文件（文本perf.fdata或者perf.bfdata），由一个线程读取并排序
+ * */
+typedef struct {
+    const char *Filename;
+    double Weight;       // 计数乘以该权重后再合并，用于统一不同的采样周期
+    ProfileEdge *Edges;  // 按(FromName, FromOffset, ToName, ToOffset)排序
+    size_t NumEdges;
+    size_t Next;         // k路归并时的当前位置
+    Arena Names;
+    BinaryProfile Binary;
+    bool Failed;
+} ProfileInput;
+
+ElfFile BinaryElf;        // --binary给出的可执行文件，写perf.fdata时还要读取函数的指令
+FunctionCFG *BinaryCFGs;  // 下标与BinaryFunctions.Functions相同
+Arena CFGArena;
+
+/*
+ * 该结构体的功能：--all-dsos时mmap信息中出现的一个文件，按路径登记
+ * 登记时只读取程序头和build-id，用于计算映射的基址；符号表在第一次有sample落进来时才加载
+ * 不同路径的build-id相同时（软链接、容器中的另一个路径）指向最先登记的那个，共用一份符号表和profile
+ * */
+typedef struct {
+    char *Path;
+    uint64_t PathHash;
+    bool Usable;         // ELF打开成功并且有LOAD段
+    uint32_t Alias;      // build-id相同的最先登记的文件，没有别名时是自己
+    ElfFile Elf;
+    BinaryLayout Layout;
+    uint8_t BuildId[MAX_BUILD_ID_SIZE];
+    size_t BuildIdSize;
+    int Loaded;          // 0：符号表未加载，1：已加载，-1：加载失败；解析线程之间通过原子操作访问
+    FunctionIndex Functions;
+} DsoInfo;
+
+typedef struct {
+    DsoInfo *Dsos;
+    uint32_t NumDsos;
+    uint32_t Capacity;
+    uint32_t *Slots;     // 以路径哈希为key的开放寻址表，保存编号+1，0表示空槽
+    uint32_t SlotCapacity;
+    pthread_mutex_t Lock;  // 加载符号表时持有
+} DsoTable;
+
+DsoTable Dsos = {.Lock = PTHREAD_MUTEX_INITIALIZER};
+
+/*
+ * 该结构体的功能：DA_getBinaryFunctionContainingAddress前面的直接映射缓存
+ * 循环中同一个from/to会重复出现成千上万次，命中时不再查找函数索引
+ * */
+typedef struct {
+    uint64_t Address[1 << ADDRESS_CACHE_BITS];  // UINT64_MAX表示空槽
+    const BinaryFunction *Function[1 << ADDRESS_CACHE_BITS];
+    uint64_t Hits;
+    uint64_t Misses;
+} AddressCache;
+
+__thread AddressCache FunctionCache;
+
+/*
+ * 该结构体的功能：按行扫描输入文件，每一行以(指针, 长度)的形式指向映射区域，不做拷贝
+ * 普通文件以滑动窗口的方式mmap，可以处理比内存还大的文件；管道等无法mmap的输入退化为read到缓冲区
+ * */
+typedef struct {
+    int fd;
+    bool Mapped;
+    uint64_t FileSize;
+    uint64_t WindowOffset;   // 当前窗口在文件中的偏移，按页对齐
+    char *Window;
+    size_t WindowSize;       // 当前窗口中有效数据的长度
+    size_t WindowCapacity;   // mmap窗口的大小或者read缓冲区的容量
+    size_t Pos;              // 下一行在窗口中的起始位置
+    bool Eof;
+} LineScanner;
+
+typedef struct {
+    const char *Data;
+    size_t Len;
+} LineView;
+
+typedef enum {
+    DECODER_SCALAR,
+    DECODER_SSE42,
+    DECODER_AVX2
+} BrstackDecoderKind;
+
+BrstackDecoderKind BrstackDecoder = DECODER_SCALAR;
+
+
+/*
+ * 该函数的主要功能：判断地址信息是否在布局信息内
+ * */
+bool containsAddress(uint64_t Address) {
+    return Address >= Layout.FirstAllocAddress && Address < Layout.LayoutStartAddress;
+} 
+
+/*
+ * 该函数的主要功能：查找起始地址不大于Address的最后一个函数，并判断Address是否落在该函数内
+ * UseMaxSize时函数大小按16字节向上对齐，CheckPastEnd时函数末尾的下一个字节也算在函数内
+ * */
+const BinaryFunction *findFunctionInIndex(const FunctionIndex *Index, uint64_t Address, bool CheckPastEnd, bool UseMaxSize){
+    const size_t n = Index->NumFunctions;
+    if (n == 0) {
+        return NULL;
+    }
+
+    // 在Eytzinger数组中查找第一个起始地址大于Address的函数
+    size_t k = 1;
+    while (k <= n) {
+        __builtin_prefetch(Index->Eytz + 16 * k);
+        k = 2 * k + (Index->Eytz[k] <= Address);
+    }
+    k >>= __builtin_ffsll(~k);
+
+    size_t Prev;
+    if (k == 0) {
+        Prev = n - 1;  // 所有函数的起始地址都不大于Address
+    } else if (Index->EytzToSorted[k] == 0) {
+        return NULL;   // Address比第一个函数还小
+    } else {
+        Prev = Index->EytzToSorted[k] - 1;
+    }
+
+    const BinaryFunction *Function = &Index->Functions[Prev];
+    uint64_t UsedSize = UseMaxSize ? (Function->Size + 15) / 16 * 16 : Function->Size;
+    if (Address < Function->Address + UsedSize + (CheckPastEnd ? 1 : 0)) {
+        return Function;
+    }
+    return NULL;
+}
+
+const BinaryFunction *BC_getBinaryFunctionContainingAddress(uint64_t Address, bool CheckPastEnd, bool UseMaxSize){
+    return findFunctionInIndex(&BinaryFunctions, Address, CheckPastEnd, UseMaxSize);
+}
+
+
+/*
+ * 该函数的主要功能：获取二进制文件的地址信息
+ * */
+ const BinaryFunction *DA_getBinaryFunctionContainingAddress(uint64_t Address){
+    if(!containsAddress(Address)){
+        return NULL;
+    }
+    AddressCache *Cache = &FunctionCache;
+    size_t Slot = (size_t)((Address * 0x9E3779B97F4A7C15ULL) >> (64 - ADDRESS_CACHE_BITS));
+    if (Cache->Address[Slot] == Address) {
+        ++Cache->Hits;
+        return Cache->Function[Slot];
+    }
+    ++Cache->Misses;
+    const BinaryFunction *Function = BC_getBinaryFunctionContainingAddress(Address, false, true);
+    Cache->Address[Slot] = Address;
+    Cache->Function[Slot] = Function;
+    return Function;
+ }
+
+/*
+ * 该函数的主要功能：清空当前线程的函数查找缓存和命中计数，函数索引变化后必须调用
+ * */
+void resetAddressCache() {
+    AddressCache *Cache = &FunctionCache;
+    for (size_t i = 0; i < (1 << ADDRESS_CACHE_BITS); ++i) {
+        Cache->Address[i] = UINT64_MAX;
+        Cache->Function[i] = NULL;
+    }
+    Cache->Hits = 0;
+    Cache->Misses = 0;
+}
+
+/*
+ * 该函数的主要功能：从arena中分配16字节对齐的内存，当前块不够时使用下一个块或者申请新块
+ * */
+void *arenaAlloc(Arena *arena, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    ArenaBlock *block = arena->current;
+    while (block && block->used + size > block->size) {
+        block = block->next;
+        if (block) {
+            block->used = 0;
+        }
+    }
+    if (!block) {
+        size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = (ArenaBlock *)malloc(sizeof(ArenaBlock) + blockSize);
+        if (!block) {
+            return NULL;
+        }
+        block->size = blockSize;
+        block->used = 0;
+        block->next = NULL;
+        if (arena->current) {
+            // 插在当前块之后，后面已经存在的块继续保留
+            block->next = arena->current->next;
+            arena->current->next = block;
+        } else {
+            arena->head = block;
+        }
+    }
+    arena->current = block;
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+/*
+ * 该函数的主要功能：把一段内存扩大到newSize，旧的内容拷贝过去，旧空间等到reset时一起回收
+ * */
+void *arenaGrow(Arena *arena, void *ptr, size_t oldSize, size_t newSize) {
+    void *newPtr = arenaAlloc(arena, newSize);
+    if (newPtr && ptr) {
+        memcpy(newPtr, ptr, oldSize);
+    }
+    return newPtr;
+}
+
+char *arenaStrndup(Arena *arena, const char *str, size_t len) {
+    char *copy = (char *)arenaAlloc(arena, len + 1);
+    if (copy) {
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+/*
+ * 该函数的主要功能：一次性回收arena中的所有分配，块保留下来重复使用
+ * */
+void arenaReset(Arena *arena) {
+    if (arena->head) {
+        arena->head->used = 0;
+    }
+    arena->current = arena->head;
+}
+
+void arenaDestroy(Arena *arena) {
+    ArenaBlock *block = arena->head;
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->current = NULL;
+}
+
+/*
+ * 该函数的主要功能：打开按行扫描的输入，"-"表示标准输入
+ * */
+bool openLineScanner(LineScanner *scanner, const char *filename) {
+    memset(scanner, 0, sizeof(*scanner));
+    scanner->fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (scanner->fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(scanner->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        scanner->Mapped = true;
+        scanner->FileSize = st.st_size;
+        scanner->WindowCapacity = SCAN_WINDOW_SIZE;
+        return true;
+    }
+
+    scanner->WindowCapacity = SCAN_READ_SIZE;
+    scanner->Window = (char *)malloc(scanner->WindowCapacity);
+    if (!scanner->Window) {
+        if (scanner->fd != STDIN_FILENO) close(scanner->fd);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * 该函数的主要功能：从文件偏移LineStart开始重新映射窗口，保证窗口中至少有MinSize字节
+ * */
+bool remapLineScanner(LineScanner *scanner, uint64_t LineStart, size_t MinSize) {
+    uint64_t PageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t Offset = LineStart & ~(PageSize - 1);
+    size_t Size = scanner->WindowCapacity;
+    while (Size < LineStart - Offset + MinSize) {
+        Size *= 2;
+    }
+    if (Offset + Size > scanner->FileSize) {
+        Size = scanner->FileSize - Offset;
+    }
+
+    if (scanner->Window) {
+        munmap(scanner->Window, scanner->WindowSize);
+        scanner->Window = NULL;
+    }
+    void *Window = mmap(NULL, Size, PROT_READ, MAP_PRIVATE, scanner->fd, Offset);
+    if (Window == MAP_FAILED) {
+        scanner->WindowSize = 0;
+        return false;
+    }
+    madvise(Window, Size, MADV_SEQUENTIAL);
+    scanner->Window = (char *)Window;
+    scanner->WindowSize = Size;
+    scanner->WindowOffset = Offset;
+    scanner->Pos = LineStart - Offset;
+    return true;
+}
+
+/*
+ * 该函数的主要功能：返回下一行（不含换行符），返回的视图在下一次调用之前有效
+ * */
+bool nextLine(LineScanner *scanner, LineView *line) {
+    for (;;) {
+        size_t Remaining = scanner->WindowSize - scanner->Pos;
+        const char *Start = scanner->Window + scanner->Pos;
+        const char *NewLine = Remaining ? (const char *)memchr(Start, '\n', Remaining) : NULL;
+        if (NewLine) {
+            line->Data = Start;
+            line->Len = NewLine - Start;
+            scanner->Pos += line->Len + 1;
+            return true;
+        }
+
+        bool AtEnd = scanner->Mapped ? scanner->WindowOffset + scanner->WindowSize >= scanner->FileSize
+                                     : scanner->Eof;
+        if (AtEnd) {
+            // 最后一行没有换行符
+            if (Remaining == 0) {
+                return false;
+            }
+            line->Data = Start;
+            line->Len = Remaining;
+            scanner->Pos = scanner->WindowSize;
+            return true;
+        }
+
+        if (scanner->Mapped) {
+            // 当前行跨越了窗口边界，从行首开始重新映射
+            if (!remapLineScanner(scanner, scanner->WindowOffset + scanner->Pos, Remaining + 1)) {
+                return false;
+            }
+            continue;
+        }
+
+        // read模式：把未处理完的数据移到缓冲区开头，缓冲区满了就扩容
+        memmove(scanner->Window, Start, Remaining);
+        scanner->WindowSize = Remaining;
+        scanner->Pos = 0;
+        if (scanner->WindowSize == scanner->WindowCapacity) {
+            char *NewWindow = (char *)realloc(scanner->Window, scanner->WindowCapacity * 2);
+            if (!NewWindow) {
+                return false;
+            }
+            scanner->Window = NewWindow;
+            scanner->WindowCapacity *= 2;
+        }
+        ssize_t n = read(scanner->fd, scanner->Window + scanner->WindowSize,
+                         scanner->WindowCapacity - scanner->WindowSize);
+        if (n <= 0) {
+            scanner->Eof = true;
+        } else {
+            scanner->WindowSize += n;
+        }
+    }
+}
+
+void closeLineScanner(LineScanner *scanner) {
+    if (scanner->Mapped) {
+        if (scanner->Window) munmap(scanner->Window, scanner->WindowSize);
+    } else {
+        free(scanner->Window);
+    }
+    if (scanner->fd != STDIN_FILENO) {
+        close(scanner->fd);
+    }
+}
+
+/*
+ * 该函数的主要功能：解析[str, str + len)中的十六进制数（可以带0x前缀），整个区间都必须合法
+ * */
+bool parseHexView(const char *str, size_t len, uint64_t *value) {
+    if (len >= 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        str += 2;
+        len -= 2;
+    }
+    if (len == 0 || len > 16) {
+        return false;
+    }
+    uint64_t Result = 0;
+    for (size_t i = 0; i < len; ++i) {
+        char c = str[i];
+        uint64_t Digit;
+        if (c >= '0' && c <= '9') Digit = c - '0';
+        else if (c >= 'a' && c <= 'f') Digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') Digit = c - 'A' + 10;
+        else return false;
+        Result = (Result << 4) | Digit;
+    }
+    *value = Result;
+    return true;
+}
+
+/*
+ * 该函数的主要功能：解析[str, str + len)中的十进制数
+ * */
+bool parseDecView(const char *str, size_t len, uint64_t *value) {
+    if (len == 0 || len > 19) {
+        return false;
+    }
+    uint64_t Result = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (str[i] < '0' || str[i] > '9') {
+            return false;
+        }
+        Result = Result * 10 + (str[i] - '0');
+    }
+    *value = Result;
+    return true;
+}
+
+/*
+ * 该函数的主要功能：从[*ptr, end)中取出下一个以Delim分隔的字段，跳过连续的分隔符
+ * */
+bool nextField(const char **ptr, const char *end, char Delim, const char **field, size_t *len) {
+    const char *p = *ptr;
+    while (p < end && (*p == Delim || (Delim == ' ' && *p == '\t'))) {
+        ++p;
+    }
+    if (p >= end) {
+        *ptr = p;
+        return false;
+    }
+    const char *Start = p;
+    while (p < end && *p != Delim && !(Delim == ' ' && *p == '\t')) {
+        ++p;
+    }
+    *field = Start;
+    *len = p - Start;
+    *ptr = p;
+    return true;
+}
+
+/*
+ * 该函数的主要功能：按地址排序，地址相同的别名再按大小和名字排序，保证结果与输入顺序无关
+ * */
+int compareBinaryFunction(const void *a, const void *b) {
+    const BinaryFunction *A = (const BinaryFunction *)a;
+    const BinaryFunction *B = (const BinaryFunction *)b;
+    if (A->Address != B->Address) {
+        return A->Address < B->Address ? -1 : 1;
+    }
+    if (A->Size != B->Size) {
+        return A->Size < B->Size ? -1 : 1;
+    }
+    return strcmp(A->Name, B->Name);
+}
+
+/*
+ * 该函数的主要功能：中序遍历完全二叉树，把排好序的起始地址填到Eytzinger数组中
+ * */
+size_t fillEytzinger(FunctionIndex *Index, size_t i, size_t k) {
+    if (k <= Index->NumFunctions) {
+        i = fillEytzinger(Index, i, 2 * k);
+        Index->Eytz[k] = Index->Functions[i].Address;
+        Index->EytzToSorted[k] = (uint32_t)i;
+        ++i;
+        i = fillEytzinger(Index, i, 2 * k + 1);
+    }
+    return i;
+}
+
+/*
+ * 该函数的主要功能：建立函数索引，Functions中的函数可以是任意顺序
+ * */
+bool buildFunctionIndex(FunctionIndex *Index) {
+    qsort(Index->Functions, Index->NumFunctions, sizeof(BinaryFunction), compareBinaryFunction);
+    Index->Eytz = (uint64_t *)malloc((Index->NumFunctions + 1) * sizeof(uint64_t));
+    Index->EytzToSorted = (uint32_t *)malloc((Index->NumFunctions + 1) * sizeof(uint32_t));
+    if (!Index->Eytz || !Index->EytzToSorted) {
+        return false;
+    }
+    fillEytzinger(Index, 0, 1);
+    return true;
+}
+
+void freeFunctionIndex(FunctionIndex *Index) {
+    free(Index->Functions);
+    free(Index->Eytz);
+    free(Index->EytzToSorted);
+    arenaDestroy(&Index->Names);
+    memset(Index, 0, sizeof(*Index));
+}
+
+/*
+ * 该函数的主要功能：读取TEMP_FUNC_FILE中的函数信息（函数名 十进制地址 大小）并建立索引
+ * */
+bool loadFunctionIndex(FunctionIndex *Index, const char *filename) {
+    memset(Index, 0, sizeof(*Index));
+    LineScanner scanner;
+    if (!openLineScanner(&scanner, filename)) {
+        return false;
+    }
+
+    size_t Capacity = 1024;
+    Index->Functions = (BinaryFunction *)malloc(Capacity * sizeof(BinaryFunction));
+    if (!Index->Functions) {
+        closeLineScanner(&scanner);
+        return false;
+    }
+
+    LineView line;
+    while (nextLine(&scanner, &line)) {
+        const char *ptr = line.Data;
+        const char *end = line.Data + line.Len;
+        const char *Name, *Address, *Size;
+        size_t NameLen, AddressLen, SizeLen;
+        BinaryFunction Function;
+        if (!nextField(&ptr, end, ' ', &Name, &NameLen) ||
+            !nextField(&ptr, end, ' ', &Address, &AddressLen) ||
+            !nextField(&ptr, end, ' ', &Size, &SizeLen) ||
+            !parseDecView(Address, AddressLen, &Function.Address) ||
+            !parseDecView(Size, SizeLen, &Function.Size)) {
+            continue;
+        }
+        if (Index->NumFunctions == Capacity) {
+            Capacity *= 2;
+            BinaryFunction *NewFunctions = (BinaryFunction *)realloc(Index->Functions, Capacity * sizeof(BinaryFunction));
+            if (!NewFunctions) {
+                closeLineScanner(&scanner);
+                freeFunctionIndex(Index);
+                return false;
+            }
+            Index->Functions = NewFunctions;
+        }
+        Function.Name = arenaStrndup(&Index->Names, Name, NameLen);
+        Index->Functions[Index->NumFunctions++] = Function;
+    }
+    closeLineScanner(&scanner);
+    return buildFunctionIndex(Index);
+}
+
+void closeElfFile(ElfFile *elf) {
+    if (elf->Data) {
+        munmap((void *)elf->Data, elf->Size);
+    }
+    memset(elf, 0, sizeof(*elf));
+}
+
+/*
+ * 该函数的主要功能：返回节在文件中的内容，越界或者没有内容（NOBITS）时返回NULL
+ * */
+const void *getElfSectionData(const ElfFile *elf, const Elf64_Shdr *Section) {
+    if (Section->sh_type == SHT_NOBITS || Section->sh_offset + Section->sh_size > elf->Size) {
+        return NULL;
+    }
+    return elf->Data + Section->sh_offset;
+}
+
+/*
+ * 该函数的主要功能：把可执行文件映射到内存中并检查ELF64头和节头表
+ * */
+bool openElfFile(ElfFile *elf, const char *filename) {
+    memset(elf, 0, sizeof(*elf));
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Elf64_Ehdr)) {
+        if (fd != -1) close(fd);
+        return false;
+    }
+    void *Data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (Data == MAP_FAILED) {
+        return false;
+    }
+    elf->Data = (const uint8_t *)Data;
+    elf->Size = st.st_size;
+    elf->Header = (const Elf64_Ehdr *)Data;
+
+    const Elf64_Ehdr *Header = elf->Header;
+    if (memcmp(Header->e_ident, ELFMAG, SELFMAG) != 0 || Header->e_ident[EI_CLASS] != ELFCLASS64 ||
+        Header->e_ident[EI_DATA] != ELFDATA2LSB || Header->e_shentsize != sizeof(Elf64_Shdr) ||
+        Header->e_shoff + (uint64_t)Header->e_shnum * sizeof(Elf64_Shdr) > elf->Size) {
+        closeElfFile(elf);
+        return false;
+    }
+    elf->Sections = (const Elf64_Shdr *)(elf->Data + Header->e_shoff);
+    elf->NumSections = Header->e_shnum;
+    if (Header->e_shstrndx < elf->NumSections) {
+        elf->SectionNames = (const char *)getElfSectionData(elf, &elf->Sections[Header->e_shstrndx]);
+    }
+    return true;
+}
+
+const char *getElfSectionName(const ElfFile *elf, const Elf64_Shdr *Section) {
+    return elf->SectionNames ? elf->SectionNames + Section->sh_name : "";
+}
+
+/*
+ * 该函数的主要功能：读取符号表，SymbolTable为.symtab或.dynsym对应的节
+ * */
+const Elf64_Sym *getElfSymbols(const ElfFile *elf, const Elf64_Shdr *SymbolTable, size_t *Count, const char **Names) {
+    const Elf64_Sym *Symbols = (const Elf64_Sym *)getElfSectionData(elf, SymbolTable);
+    if (!Symbols || SymbolTable->sh_link >= elf->NumSections) {
+        *Count = 0;
+        return NULL;
+    }
+    *Names = (const char *)getElfSectionData(elf, &elf->Sections[SymbolTable->sh_link]);
+    *Count = *Names ? SymbolTable->sh_size / sizeof(Elf64_Sym) : 0;
+    return Symbols;
+}
+
+bool isExecutableSection(const Elf64_Shdr *Section) {
+    return Section->sh_type == SHT_PROGBITS && (Section->sh_flags & SHF_ALLOC) && (Section->sh_flags & SHF_EXECINSTR);
+}
+
+/*
+ * 该函数的主要功能：从.note.gnu.build-id中读取build-id，返回其字节数，没有时返回0
+ * */
+size_t getElfBuildId(const ElfFile *elf, uint8_t *BuildId, size_t MaxSize) {
+    for (size_t i = 0; i < elf->NumSections; ++i) {
+        const Elf64_Shdr *Section = &elf->Sections[i];
+        const uint8_t *Data = (const uint8_t *)getElfSectionData(elf, Section);
+        if (Section->sh_type != SHT_NOTE || !Data) {
+            continue;
+        }
+        for (uint64_t Offset = 0; Offset + sizeof(Elf64_Nhdr) <= Section->sh_size;) {
+            const Elf64_Nhdr *Note = (const Elf64_Nhdr *)(Data + Offset);
+            uint64_t NameSize = (Note->n_namesz + 3) & ~3UL;
+            uint64_t DescSize = (Note->n_descsz + 3) & ~3UL;
+            const uint8_t *Name = Data + Offset + sizeof(Elf64_Nhdr);
+            if (Offset + sizeof(Elf64_Nhdr) + NameSize + DescSize > Section->sh_size) {
+                break;
+            }
+            if (Note->n_type == NT_GNU_BUILD_ID && Note->n_namesz == 4 && memcmp(Name, "GNU", 4) == 0) {
+                size_t Size = Note->n_descsz < MaxSize ? Note->n_descsz : MaxSize;
+                memcpy(BuildId, Name + NameSize, Size);
+                return Size;
+            }
+            Offset += sizeof(Elf64_Nhdr) + NameSize + DescSize;
+        }
+    }
+    return 0;
+}
+
+int compareElfLabel(const void *a, const void *b) {
+    const ElfLabel *A = (const ElfLabel *)a;
+    const ElfLabel *B = (const ElfLabel *)b;
+    if (A->Section != B->Section) return A->Section < B->Section ? -1 : 1;
+    if (A->Address != B->Address) return A->Address < B->Address ? -1 : 1;
+    if (A->Priority != B->Priority) return A->Priority < B->Priority ? -1 : 1;
+    return A->Seq < B->Seq ? -1 : (A->Seq > B->Seq);
+}
+
+int compareElfLabelName(const void *a, const void *b) {
+    const ElfLabel *A = (const ElfLabel *)a;
+    const ElfLabel *B = (const ElfLabel *)b;
+    int Result = strcmp(A->Name, B->Name);
+    if (Result != 0) return Result;
+    return A->Seq < B->Seq ? -1 : (A->Seq > B->Seq);
+}
+
+int compareElfReloc(const void *a, const void *b) {
+    uint64_t A = ((const ElfReloc *)a)->Offset;
+    uint64_t B = ((const ElfReloc *)b)->Offset;
+    return A < B ? -1 : (A > B);
+}
+
+bool pushElfLabel(ElfLabel **Labels, size_t *Count, size_t *Capacity, ElfLabel Label) {
+    if (*Count == *Capacity) {
+        size_t NewCapacity = *Capacity ? *Capacity * 2 : 1024;
+        ElfLabel *NewLabels = (ElfLabel *)realloc(*Labels, NewCapacity * sizeof(ElfLabel));
+        if (!NewLabels) {
+            return false;
+        }
+        *Labels = NewLabels;
+        *Capacity = NewCapacity;
+    }
+    Label.Seq = *Count;
+    (*Labels)[(*Count)++] = Label;
+    return true;
+}
+
+/*
+ * 该函数的主要功能：收集动态重定位中JUMP_SLOT和GLOB_DAT指向的GOT槽，用于给PLT项命名
+ * */
+ElfReloc *collectPltRelocs(const ElfFile *elf, size_t *Count) {
+    size_t Capacity = 0;
+    ElfReloc *Relocs = NULL;
+    *Count = 0;
+    for (size_t i = 0; i < elf->NumSections; ++i) {
+        const Elf64_Shdr *Section = &elf->Sections[i];
+        if (Section->sh_type != SHT_RELA || !(Section->sh_flags & SHF_ALLOC) || Section->sh_link >= elf->NumSections) {
+            continue;
+        }
+        const Elf64_Rela *Relas = (const Elf64_Rela *)getElfSectionData(elf, Section);
+        size_t NumSymbols;
+        const char *Names;
+        const Elf64_Sym *Symbols = getElfSymbols(elf, &elf->Sections[Section->sh_link], &NumSymbols, &Names);
+        if (!Relas || !Symbols) {
+            continue;
+        }
+        for (size_t j = 0; j < Section->sh_size / sizeof(Elf64_Rela); ++j) {
+            uint32_t Type = ELF64_R_TYPE(Relas[j].r_info);
+            uint32_t Sym = ELF64_R_SYM(Relas[j].r_info);
+            if ((Type != R_X86_64_JUMP_SLOT && Type != R_X86_64_GLOB_DAT) || Sym == 0 || Sym >= NumSymbols) {
+                continue;
+            }
+            if (*Count == Capacity) {
+                Capacity = Capacity ? Capacity * 2 : 256;
+                ElfReloc *NewRelocs = (ElfReloc *)realloc(Relocs, Capacity * sizeof(ElfReloc));
+                if (!NewRelocs) {
+                    free(Relocs);
+                    *Count = 0;
+                    return NULL;
+                }
+                Relocs = NewRelocs;
+            }
+            Relocs[*Count].Offset = Relas[j].r_offset;
+            Relocs[*Count].Name = Names + Symbols[Sym].st_name;
+            ++*Count;
+        }
+    }
+    qsort(Relocs, *Count, sizeof(ElfReloc), compareElfReloc);
+    return Relocs;
+}
+
+/*
+ * 该函数的主要功能：识别PLT项中的jmp *GOT(%rip)，返回对应的GOT槽地址
+ * 允许前面有endbr64和bnd前缀，对应.plt、.plt.sec和.plt.got三种布局
+ * */
+bool decodePltJump(const uint8_t *Entry, size_t Size, uint64_t EntryAddress, uint64_t *GotSlot) {
+    static const uint8_t Endbr64[4] = {0xf3, 0x0f, 0x1e, 0xfa};
+    size_t Pos = 0;
+    if (Size >= 4 && memcmp(Entry, Endbr64, 4) == 0) {
+        Pos = 4;
+    }
+    if (Pos < Size && Entry[Pos] == 0xf2) {
+        ++Pos;
+    }
+    if (Pos + 6 > Size || Entry[Pos] != 0xff || Entry[Pos + 1] != 0x25) {
+        return false;
+    }
+    int32_t Disp;
+    memcpy(&Disp, Entry + Pos + 2, sizeof(Disp));
+    *GotSlot = EntryAddress + Pos + 6 + (int64_t)Disp;
+    return true;
+}
+
+/*
+ * 该函数的主要功能：不调用objdump和readelf，直接从ELF文件中生成与perf_temp_func.log相同的函数表
+ * 1. 与objdump -d的标签对应：可执行节中的符号、PLT项（name@plt）、没有符号的节起始处（节名），
+ *    大小为到同一节中下一个标签的距离，名字以.plt结尾的改为__BOLT_PSEUDO_.plt
+ * 2. 与readelf -s对应：.symtab（没有时用.dynsym）中大小不为0的FUNC符号，覆盖同名标签的地址和大小
+ * 同名的函数只保留最后一个，与shell脚本中按名字索引的关联数组一致
+ * */
+bool loadFunctionIndexFromElf(FunctionIndex *Index, const ElfFile *elf) {
+    memset(Index, 0, sizeof(*Index));
+    const Elf64_Shdr *SymbolTable = NULL;
+    for (size_t i = 0; i < elf->NumSections; ++i) {
+        if (elf->Sections[i].sh_type == SHT_SYMTAB) {
+            SymbolTable = &elf->Sections[i];
+            break;
+        }
+        if (elf->Sections[i].sh_type == SHT_DYNSYM) {
+            SymbolTable = &elf->Sections[i];
+        }
+    }
+    size_t NumSymbols = 0;
+    const char *SymbolNames = NULL;
+    const Elf64_Sym *Symbols = SymbolTable ? getElfSymbols(elf, SymbolTable, &NumSymbols, &SymbolNames) : NULL;
+
+    ElfLabel *Labels = NULL;
+    size_t NumLabels = 0, LabelCapacity = 0;
+    bool Ok = true;
+
+    // objdump的标签：普通符号
+    for (size_t i = 1; i < NumSymbols && Ok; ++i) {
+        const Elf64_Sym *Sym = &Symbols[i];
+        int Type = ELF64_ST_TYPE(Sym->st_info);
+        if (Sym->st_shndx == SHN_UNDEF || Sym->st_shndx >= elf->NumSections || Sym->st_name == 0 ||
+            (Type != STT_FUNC && Type != STT_NOTYPE && Type != STT_GNU_IFUNC) ||
+            !isExecutableSection(&elf->Sections[Sym->st_shndx])) {
+            continue;
+        }
+        ElfLabel Label = {SymbolNames + Sym->st_name, Sym->st_value, 0, Sym->st_shndx,
+                          (Type == STT_FUNC && Sym->st_size) ? 0 : 1, 0};
+        Ok = pushElfLabel(&Labels, &NumLabels, &LabelCapacity, Label);
+    }
+
+    // objdump的标签：PLT项和没有符号的节起始处
+    size_t NumRelocs = 0;
+    ElfReloc *Relocs = collectPltRelocs(elf, &NumRelocs);
+    for (size_t i = 1; i < elf->NumSections && Ok; ++i) {
+        const Elf64_Shdr *Section = &elf->Sections[i];
+        if (!isExecutableSection(Section)) {
+            continue;
+        }
+        const char *SectionName = getElfSectionName(elf, Section);
+        const uint8_t *Code = (const uint8_t *)getElfSectionData(elf, Section);
+        if (Code && strncmp(SectionName, ".plt", 4) == 0 && NumRelocs) {
+            uint64_t EntrySize = Section->sh_entsize ? Section->sh_entsize : 16;
+            for (uint64_t Offset = 0; Offset + EntrySize <= Section->sh_size && Ok; Offset += EntrySize) {
+                uint64_t GotSlot;
+                if (!decodePltJump(Code + Offset, EntrySize, Section->sh_addr + Offset, &GotSlot)) {
+                    continue;
+                }
+                ElfReloc Key = {GotSlot, NULL};
+                const ElfReloc *Reloc = (const ElfReloc *)bsearch(&Key, Relocs, NumRelocs, sizeof(ElfReloc), compareElfReloc);
+                if (!Reloc) {
+                    continue;
+                }
+                // 动态符号名可能带有版本（name@GLIBC_x），objdump只保留name@plt
+                size_t NameLen = strcspn(Reloc->Name, "@");
+                char *Name = (char *)arenaAlloc(&Index->Names, NameLen + sizeof("@plt"));
+                if (!Name) {
+                    Ok = false;
+                    break;
+                }
+                memcpy(Name, Reloc->Name, NameLen);
+                memcpy(Name + NameLen, "@plt", sizeof("@plt"));
+                ElfLabel Label = {Name, Section->sh_addr + Offset, 0, i, 2, 0};
+                Ok = pushElfLabel(&Labels, &NumLabels, &LabelCapacity, Label);
+            }
+        }
+        ElfLabel Label = {SectionName, Section->sh_addr, 0, i, 3, 0};
+        Ok = Ok && pushElfLabel(&Labels, &NumLabels, &LabelCapacity, Label);
+    }
+    free(Relocs);
+
+    // 同一地址只保留优先级最高的标签，大小为到下一个标签或者节末尾的距离
+    qsort(Labels, NumLabels, sizeof(ElfLabel), compareElfLabel);
+    size_t NumUnique = 0;
+    for (size_t i = 0; i < NumLabels; ++i) {
+        if (NumUnique > 0 && Labels[NumUnique - 1].Section == Labels[i].Section &&
+            Labels[NumUnique - 1].Address == Labels[i].Address) {
+            continue;
+        }
+        Labels[NumUnique++] = Labels[i];
+    }
+    NumLabels = NumUnique;
+    for (size_t i = 0; i < NumLabels; ++i) {
+        const Elf64_Shdr *Section = &elf->Sections[Labels[i].Section];
+        uint64_t End = (i + 1 < NumLabels && Labels[i + 1].Section == Labels[i].Section)
+                           ? Labels[i + 1].Address : Section->sh_addr + Section->sh_size;
+        Labels[i].Size = End - Labels[i].Address;
+        size_t NameLen = strlen(Labels[i].Name);
+        if (NameLen >= 4 && strcmp(Labels[i].Name + NameLen - 4, ".plt") == 0) {
+            char *Name = (char *)arenaAlloc(&Index->Names, NameLen + sizeof("__BOLT_PSEUDO_"));
+            if (!Name) {
+                Ok = false;
+                break;
+            }
+            memcpy(Name, "__BOLT_PSEUDO_", sizeof("__BOLT_PSEUDO_") - 1);
+            memcpy(Name + sizeof("__BOLT_PSEUDO_") - 1, Labels[i].Name, NameLen + 1);
+            Labels[i].Name = Name;
+        }
+        Labels[i].Seq = i;
+    }
+
+    // readelf -s的FUNC符号排在标签后面，按名字去重时覆盖同名标签
+    for (size_t i = 1; i < NumSymbols && Ok; ++i) {
+        const Elf64_Sym *Sym = &Symbols[i];
+        if (ELF64_ST_TYPE(Sym->st_info) != STT_FUNC || Sym->st_shndx == SHN_UNDEF || Sym->st_size == 0 ||
+            Sym->st_name == 0 || strchr(SymbolNames + Sym->st_name, '@')) {
+            continue;
+        }
+        ElfLabel Label = {SymbolNames + Sym->st_name, Sym->st_value, Sym->st_size, Sym->st_shndx, 0, 0};
+        Ok = pushElfLabel(&Labels, &NumLabels, &LabelCapacity, Label);
+    }
+
+    if (Ok) {
+        qsort(Labels, NumLabels, sizeof(ElfLabel), compareElfLabelName);
+        Index->Functions = (BinaryFunction *)malloc((NumLabels + 1) * sizeof(BinaryFunction));
+        Ok = Index->Functions != NULL;
+    }
+    for (size_t i = 0; i < NumLabels && Ok; ++i) {
+        if (i + 1 < NumLabels && strcmp(Labels[i].Name, Labels[i + 1].Name) == 0) {
+            continue;
+        }
+        // 函数名可能指向映射的字符串表，拷贝到arena中，ELF文件关闭后仍然可以使用
+        BinaryFunction Function = {arenaStrndup(&Index->Names, Labels[i].Name, strlen(Labels[i].Name)),
+                                   Labels[i].Address, Labels[i].Size};
+        if (!Function.Name) {
+            Ok = false;
+            break;
+        }
+        Index->Functions[Index->NumFunctions++] = Function;
+    }
+    free(Labels);
+    if (!Ok || !buildFunctionIndex(Index)) {
+        freeFunctionIndex(Index);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * 该函数的主要功能：读取ELF中有大小的OBJECT/TLS符号，作为访存profile中数据地址的符号
+ * */
+bool loadDataObjectsFromElf(FunctionIndex *Index, const ElfFile *elf) {
+    memset(Index, 0, sizeof(*Index));
+    const Elf64_Shdr *SymbolTable = NULL;
+    for (size_t i = 0; i < elf->NumSections; ++i) {
+        if (elf->Sections[i].sh_type == SHT_SYMTAB) {
+            SymbolTable = &elf->Sections[i];
+            break;
+        }
+        if (elf->Sections[i].sh_type == SHT_DYNSYM) {
+            SymbolTable = &elf->Sections[i];
+        }
+    }
+    size_t NumSymbols = 0;
+    const char *SymbolNames = NULL;
+    const Elf64_Sym *Symbols = SymbolTable ? getElfSymbols(elf, SymbolTable, &NumSymbols, &SymbolNames) : NULL;
+    size_t Capacity = 0;
+    for (size_t i = 1; i < NumSymbols; ++i) {
+        const Elf64_Sym *Sym = &Symbols[i];
+        if (ELF64_ST_TYPE(Sym->st_info) != STT_OBJECT || Sym->st_size == 0 || Sym->st_name == 0 ||
+            Sym->st_shndx == SHN_UNDEF || Sym->st_shndx >= elf->NumSections ||
+            !(elf->Sections[Sym->st_shndx].sh_flags & SHF_ALLOC)) {
+            continue;
+        }
+        if (Index->NumFunctions == Capacity) {
+            Capacity = Capacity ? Capacity * 2 : 1024;
+            BinaryFunction *NewObjects = (BinaryFunction *)realloc(Index->Functions, Capacity * sizeof(BinaryFunction));
+            if (!NewObjects) {
+                return false;
+            }
+            Index->Functions = NewObjects;
+        }
+        BinaryFunction Object = {arenaStrndup(&Index->Names, SymbolNames + Sym->st_name, strlen(SymbolNames + Sym->st_name)),
+                                 Sym->st_value, Sym->st_size};
+        if (!Object.Name) {
+            return false;
+        }
+        Index->Functions[Index->NumFunctions++] = Object;
+    }
+    qsort(Index->Functions, Index->NumFunctions, sizeof(BinaryFunction), compareBinaryFunction);
+    return true;
+}
+
+/*
+ * 该函数的主要功能：查找与[Address, Address + Size)重叠的数据对象，优先返回包含Address的
+ * 访存profile只在输出时查找，直接二分即可
+ * */
+const BinaryFunction *findDataObject(const FunctionIndex *Index, uint64_t Address, uint64_t Size) {
+    size_t Low = 0;
+    size_t High = Index->NumFunctions;
+    while (Low < High) {
+        size_t Mid = Low + (High - Low) / 2;
+        if (Index->Functions[Mid].Address <= Address) {
+            Low = Mid + 1;
+        } else {
+            High = Mid;
+        }
+    }
+    // 数据对象可能重叠（别名），从后往前找第一个包含Address的
+    for (size_t i = Low; i-- > 0;) {
+        const BinaryFunction *Object = &Index->Functions[i];
+        if (Address < Object->Address + Object->Size) {
+            return Object;
+        }
+        if (Address - Object->Address > (1UL << 20)) {
+            break;
+        }
+    }
+    // 没有包含Address的对象时，返回起始地址落在区间内的第一个对象
+    if (Low < Index->NumFunctions && Index->Functions[Low].Address - Address < Size) {
+        return &Index->Functions[Low];
+    }
+    return NULL;
+}
+
+/*
+ * 该函数的主要功能：返回包含Address的已分配节，找不到数据对象时用节名加偏移表示数据地址
+ * */
+const Elf64_Shdr *findElfSection(const ElfFile *elf, uint64_t Address) {
+    for (size_t i = 1; i < elf->NumSections; ++i) {
+        const Elf64_Shdr *Section = &elf->Sections[i];
+        if ((Section->sh_flags & SHF_ALLOC) && Address >= Section->sh_addr &&
+            Address < Section->sh_addr + Section->sh_size) {
+            return Section;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * 该函数的主要功能：按perf_temp_func.log的格式输出函数表（函数名 十进制地址 大小），按地址排序
+ * */
+bool writeFunctionTable(const FunctionIndex *Index, const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        return false;
+    }
+    for (size_t i = 0; i < Index->NumFunctions; ++i) {
+        fprintf(file, "%-40s %-20" PRIu64 " %" PRIu64 "\n", Index->Functions[i].Name,
+                Index->Functions[i].Address, Index->Functions[i].Size);
+    }
+    fclose(file);
+    return true;
+}
+
+/*
+ * 该函数的主要功能：直接读取程序头表计算布局信息，取代readelf -l加awk的处理
+ * FirstAllocAddress是LOAD段的最小虚拟地址；LayoutStartAddress是BOLT放置新代码的起始地址：
+ * LOAD段末尾按2MB对齐，再为原有的程序头加上3个新程序头预留空间，最后按cache line对齐
+ * */
+bool getBinaryLayout(const ElfFile *elf, BinaryLayout *layout) {
+    const Elf64_Ehdr *Header = elf->Header;
+    memset(layout, 0, sizeof(*layout));
+    if (Header->e_phentsize != sizeof(Elf64_Phdr) ||
+        Header->e_phoff + (uint64_t)Header->e_phnum * sizeof(Elf64_Phdr) > elf->Size) {
+        return false;
+    }
+    const Elf64_Phdr *Phdrs = (const Elf64_Phdr *)(elf->Data + Header->e_phoff);
+
+    uint64_t FirstAllocAddress = UINT64_MAX;
+    uint64_t NextAvailableAddress = 0;
+    uint64_t NextAvailableOffset = 0;
+    for (size_t i = 0; i < Header->e_phnum; ++i) {
+        const Elf64_Phdr *Phdr = &Phdrs[i];
+        if (Phdr->p_type != PT_LOAD) {
+            continue;
+        }
+        if (Phdr->p_vaddr < FirstAllocAddress) {
+            FirstAllocAddress = Phdr->p_vaddr;
+        }
+        if (Phdr->p_vaddr + Phdr->p_memsz > NextAvailableAddress) {
+            NextAvailableAddress = Phdr->p_vaddr + Phdr->p_memsz;
+        }
+        if (Phdr->p_offset + Phdr->p_filesz > NextAvailableOffset) {
+            NextAvailableOffset = Phdr->p_offset + Phdr->p_filesz;
+        }
+        if (layout->NumSegments < MAX_LOAD_SEGMENTS) {
+            LoadSegment *Segment = &layout->Segments[layout->NumSegments++];
+            Segment->Offset = Phdr->p_offset;
+            Segment->VirtAddr = Phdr->p_vaddr;
+            Segment->PhysAddr = Phdr->p_paddr;
+            Segment->FileSize = Phdr->p_filesz;
+            Segment->MemSize = Phdr->p_memsz;
+            Segment->Flags = Phdr->p_flags;
+            Segment->Align = Phdr->p_align;
+        }
+    }
+    if (FirstAllocAddress == UINT64_MAX) {
+        return false;
+    }
+
+    NextAvailableAddress = (NextAvailableAddress + LAYOUT_PAGE_SIZE - 1) / LAYOUT_PAGE_SIZE * LAYOUT_PAGE_SIZE;
+    NextAvailableOffset = (NextAvailableOffset + LAYOUT_PAGE_SIZE - 1) / LAYOUT_PAGE_SIZE * LAYOUT_PAGE_SIZE;
+
+    // 新的程序头表放在对齐后的位置，地址和偏移保持同余
+    if (NextAvailableOffset <= NextAvailableAddress - FirstAllocAddress) {
+        NextAvailableOffset = NextAvailableAddress - FirstAllocAddress;
+    } else {
+        NextAvailableAddress = NextAvailableOffset + FirstAllocAddress;
+    }
+    uint64_t PhdrTableSize = (uint64_t)(Header->e_phnum + EXTRA_PHDRS) * sizeof(Elf64_Phdr);
+    NextAvailableAddress += PhdrTableSize;
+
+    layout->FirstAllocAddress = FirstAllocAddress;
+    layout->LayoutStartAddress = (NextAvailableAddress + LAYOUT_CACHE_LINE - 1) / LAYOUT_CACHE_LINE * LAYOUT_CACHE_LINE;
+    return true;
+}
+
+/*
+ * 该函数的主要功能：按shell脚本中perf_temp_readelf_temp.log的格式写出LOAD段和布局信息
+ * */
+bool writeBinaryLayout(const BinaryLayout *layout, const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "  Type    Offset    VirtAddr    PhysAddr   FileSiz    MemSiz    Flags  Align\n");
+    fprintf(file, "---------------------------------------------------------------\n");
+    for (size_t i = 0; i < layout->NumSegments; ++i) {
+        const LoadSegment *Segment = &layout->Segments[i];
+        fprintf(file, " LOAD 0x%06" PRIx64 " 0x%016" PRIx64 " 0x%016" PRIx64 " 0x%06" PRIx64 " 0x%06" PRIx64 " %c%c%c 0x%" PRIx64 "\n",
+                Segment->Offset, Segment->VirtAddr, Segment->PhysAddr, Segment->FileSize, Segment->MemSize,
+                (Segment->Flags & PF_R) ? 'R' : ' ', (Segment->Flags & PF_W) ? 'W' : ' ',
+                (Segment->Flags & PF_X) ? 'E' : ' ', Segment->Align);
+    }
+    fprintf(file, "FirstAllocAddress %" PRIu64 "\n", layout->FirstAllocAddress);
+    fprintf(file, "LayoutStartAddress %" PRIu64 "\n", layout->LayoutStartAddress);
+    fclose(file);
+    return true;
+}
+
+/*
+ * 该函数的主要功能：没有给出可执行文件时，从shell脚本生成的perf_temp_readelf_temp.log中读取布局信息
+ * */
+bool loadBinaryLayout(BinaryLayout *layout, const char *filename) {
+    memset(layout, 0, sizeof(*layout));
+    LineScanner scanner;
+    if (!openLineScanner(&scanner, filename)) {
+        return false;
+    }
+    LineView line;
+    bool Found = false;
+    while (nextLine(&scanner, &line)) {
+        const char *ptr = line.Data;
+        const char *end = line.Data + line.Len;
+        const char *Key, *Value;
+        size_t KeyLen, ValueLen;
+        if (!nextField(&ptr, end, ' ', &Key, &KeyLen) || !nextField(&ptr, end, ' ', &Value, &ValueLen)) {
+            continue;
+        }
+        if (KeyLen == strlen("LOAD") && memcmp(Key, "LOAD", KeyLen) == 0 && layout->NumSegments < MAX_LOAD_SEGMENTS) {
+            // LOAD Offset VirtAddr PhysAddr FileSiz MemSiz Flags Align，Flags是R、W、E的组合，中间可能有空格
+            LoadSegment Segment = {0};
+            uint64_t *Values[] = {&Segment.VirtAddr, &Segment.PhysAddr, &Segment.FileSize, &Segment.MemSize};
+            bool Valid = parseHexView(Value, ValueLen, &Segment.Offset);
+            for (size_t i = 0; Valid && i < sizeof(Values) / sizeof(Values[0]); ++i) {
+                Valid = nextField(&ptr, end, ' ', &Value, &ValueLen) && parseHexView(Value, ValueLen, Values[i]);
+            }
+            while (Valid && nextField(&ptr, end, ' ', &Value, &ValueLen)) {
+                if (ValueLen > 2 && Value[1] == 'x') {
+                    Valid = parseHexView(Value, ValueLen, &Segment.Align);
+                    break;
+                }
+                for (size_t i = 0; i < ValueLen; ++i) {
+                    Segment.Flags |= Value[i] == 'R' ? PF_R : Value[i] == 'W' ? PF_W : Value[i] == 'E' ? PF_X : 0;
+                }
+            }
+            if (Valid) {
+                layout->Segments[layout->NumSegments++] = Segment;
+            }
+        } else if (KeyLen == strlen("FirstAllocAddress") && memcmp(Key, "FirstAllocAddress", KeyLen) == 0) {
+            Found = parseDecView(Value, ValueLen, &layout->FirstAllocAddress);
+        } else if (KeyLen == strlen("LayoutStartAddress") && memcmp(Key, "LayoutStartAddress", KeyLen) == 0) {
+            parseDecView(Value, ValueLen, &layout->LayoutStartAddress);
+        }
+    }
+    closeLineScanner(&scanner);
+    return Found;
+}
+
+/*
+ * 该函数的主要功能：计算ModRM（以及SIB和位移）占用的字节数，Code指向ModRM字节
+ * */
+static size_t modrmLength(const uint8_t *Code, size_t Avail) {
+    if (Avail < 1) {
+        return 0;
+    }
+    uint8_t Mod = Code[0] >> 6;
+    uint8_t Rm = Code[0] & 7;
+    size_t Length = 1;
+    if (Mod == 3) {
+        return Length;
+    }
+    if (Rm == 4) {
+        if (Avail < 2) {
+            return 0;
+        }
+        if (Mod == 0 && (Code[1] & 7) == 5) {
+            Length += 4;
+        }
+        ++Length;
+    } else if (Mod == 0 && Rm == 5) {
+        Length += 4;  // RIP相对寻址
+    }
+    if (Mod == 1) {
+        Length += 1;
+    } else if (Mod == 2) {
+        Length += 4;
+    }
+    return Length <= Avail ? Length : 0;
+}
+
+/*
+ * 该函数的主要功能：0F xx双字节操作码是否带ModRM以及立即数的字节数
+ * */
+static bool twoByteHasModrm(uint8_t Op) {
+    switch (Op) {
+        case 0x04: case 0x05: case 0x06: case 0x07: case 0x08: case 0x09: case 0x0a: case 0x0b:
+        case 0x0c: case 0x0e: case 0x30: case 0x31: case 0x32: case 0x33: case 0x34: case 0x35:
+        case 0x36: case 0x37: case 0x77: case 0xa0: case 0xa1: case 0xa2: case 0xa8: case 0xa9:
+        case 0xaa:
+            return false;
+        default:
+            return !(Op >= 0x80 && Op <= 0x8f) && !(Op >= 0xc8 && Op <= 0xcf);
+    }
+}
+
+static bool twoByteHasImm8(uint8_t Op) {
+    return (Op >= 0x70 && Op <= 0x73) || Op == 0xa4 || Op == 0xac || Op == 0xba || Op == 0xc2 ||
+           (Op >= 0xc4 && Op <= 0xc6) || Op == 0x0f;
+}
+
+/*
+ * 该函数的主要功能：x86-64指令长度解码，只区分生成基本块所需的控制流指令
+ * 返回指令长度，无法解码时返回0；直接跳转时Target为相对下一条指令的偏移
+ * */
+size_t decodeInstrLength(const uint8_t *Code, size_t Avail, InstrKind *Kind, int64_t *Target) {
+    size_t Pos = 0;
+    bool OpSize16 = false;
+    bool AddrSize32 = false;
+    bool RexW = false;
+    *Kind = INSTR_OTHER;
+    *Target = 0;
+
+    // 传统前缀
+    for (; Pos < Avail && Pos < 14; ++Pos) {
+        uint8_t Byte = Code[Pos];
+        if (Byte == 0x66) OpSize16 = true;
+        else if (Byte == 0x67) AddrSize32 = true;
+        else if (Byte != 0xf0 && Byte != 0xf2 && Byte != 0xf3 && Byte != 0x2e && Byte != 0x36 &&
+                 Byte != 0x3e && Byte != 0x26 && Byte != 0x64 && Byte != 0x65) break;
+    }
+    if (Pos < Avail && (Code[Pos] & 0xf0) == 0x40) {
+        RexW = (Code[Pos] & 8) != 0;
+        ++Pos;
+    }
+    if (Pos >= Avail) {
+        return 0;
+    }
+
+    size_t ImmZ = (OpSize16 && !RexW) ? 2 : 4;
+    uint8_t Op = Code[Pos++];
+    size_t Imm = 0;
+    bool HasModrm = false;
+
+    // VEX（C4/C5）和EVEX（62）编码的SIMD指令
+    if (Op == 0xc4 || Op == 0xc5 || Op == 0x62) {
+        size_t PayloadSize = Op == 0xc5 ? 1 : (Op == 0xc4 ? 2 : 3);
+        if (Pos + PayloadSize + 1 > Avail) {
+            return 0;
+        }
+        uint8_t Map = Op == 0xc5 ? 1 : (Op == 0xc4 ? (Code[Pos] & 0x1f) : (Code[Pos] & 0x7));
+        Pos += PayloadSize;
+        uint8_t VexOp = Code[Pos++];
+        HasModrm = !(Map == 1 && VexOp == 0x77 && Op != 0x62);
+        if (Map == 3 || (Map == 1 && twoByteHasImm8(VexOp) && VexOp != 0x0f)) {
+            Imm = 1;
+        }
+    } else if (Op == 0x0f) {
+        if (Pos >= Avail) {
+            return 0;
+        }
+        uint8_t Op2 = Code[Pos++];
+        if (Op2 == 0x38 || Op2 == 0x3a) {
+            if (Pos >= Avail) {
+                return 0;
+            }
+            ++Pos;
+            HasModrm = true;
+            Imm = Op2 == 0x3a ? 1 : 0;
+        } else if (Op2 >= 0x80 && Op2 <= 0x8f) {
+            *Kind = INSTR_COND_BRANCH;
+            Imm = 4;
+        } else {
+            HasModrm = twoByteHasModrm(Op2);
+            Imm = twoByteHasImm8(Op2) ? 1 : 0;
+            if (Op2 == 0x0b) {
+                *Kind = INSTR_TRAP;  // ud2
+            }
+        }
+    } else {
+        switch (Op) {
+            case 0x00: case 0x01: case 0x02: case 0x03: case 0x08: case 0x09: case 0x0a: case 0x0b:
+            case 0x10: case 0x11: case 0x12: case 0x13: case 0x18: case 0x19: case 0x1a: case 0x1b:
+            case 0x20: case 0x21: case 0x22: case 0x23: case 0x28: case 0x29: case 0x2a: case 0x2b:
+            case 0x30: case 0x31: case 0x32: case 0x33: case 0x38: case 0x39: case 0x3a: case 0x3b:
+            case 0x63: case 0x84: case 0x85: case 0x86: case 0x87: case 0x88: case 0x89: case 0x8a:
+            case 0x8b: case 0x8c: case 0x8d: case 0x8e: case 0x8f: case 0xd0: case 0xd1: case 0xd2:
+            case 0xd3: case 0xd8: case 0xd9: case 0xda: case 0xdb: case 0xdc: case 0xdd: case 0xde:
+            case 0xdf: case 0xfe:
+                HasModrm = true;
+                break;
+            case 0x04: case 0x0c: case 0x14: case 0x1c: case 0x24: case 0x2c: case 0x34: case 0x3c:
+            case 0x6a: case 0xa8: case 0xcd: case 0xd4: case 0xd5: case 0xe4: case 0xe5: case 0xe6:
+            case 0xe7:
+                Imm = 1;
+                break;
+            case 0x05: case 0x0d: case 0x15: case 0x1d: case 0x25: case 0x2d: case 0x35: case 0x3d:
+            case 0x68: case 0xa9:
+                Imm = ImmZ;
+                break;
+            case 0x69: case 0x81: case 0xc7:
+                HasModrm = true;
+                Imm = ImmZ;
+                break;
+            case 0x6b: case 0x80: case 0x82: case 0x83: case 0xc0: case 0xc1: case 0xc6:
+                HasModrm = true;
+                Imm = 1;
+                break;
+            case 0xa0: case 0xa1: case 0xa2: case 0xa3:
+                Imm = AddrSize32 ? 4 : 8;
+                break;
+            case 0xc2: case 0xca:
+                *Kind = INSTR_RETURN;
+                Imm = 2;
+                break;
+            case 0xc3: case 0xcb: case 0xcf:
+                *Kind = INSTR_RETURN;
+                break;
+            case 0xc8:
+                Imm = 3;
+                break;
+            case 0xcc: case 0xf4:
+                *Kind = INSTR_TRAP;  // int3、hlt
+                break;
+            case 0xe0: case 0xe1: case 0xe2: case 0xe3:
+                *Kind = INSTR_COND_BRANCH;
+                Imm = 1;
+                break;
+            case 0xe8:
+                *Kind = INSTR_CALL;
+                Imm = 4;
+                break;
+            case 0xe9:
+                *Kind = INSTR_JUMP;
+                Imm = 4;
+                break;
+            case 0xeb:
+                *Kind = INSTR_JUMP;
+                Imm = 1;
+                break;
+            case 0xf6: case 0xf7:
+                HasModrm = true;
+                if (Pos < Avail && ((Code[Pos] >> 3) & 7) < 2) {
+                    Imm = Op == 0xf6 ? 1 : ImmZ;
+                }
+                break;
+            case 0xff:
+                HasModrm = true;
+                if (Pos < Avail) {
+                    uint8_t Reg = (Code[Pos] >> 3) & 7;
+                    if (Reg == 2 || Reg == 3) *Kind = INSTR_CALL;
+                    else if (Reg == 4 || Reg == 5) *Kind = INSTR_INDIRECT_JUMP;
+                }
+                break;
+            default:
+                if (Op >= 0x70 && Op <= 0x7f) {
+                    *Kind = INSTR_COND_BRANCH;
+                    Imm = 1;
+                } else if (Op >= 0xb0 && Op <= 0xb7) {
+                    Imm = 1;
+                } else if (Op >= 0xb8 && Op <= 0xbf) {
+                    Imm = RexW ? 8 : ImmZ;
+                }
+                break;
+        }
+    }
+
+    if (HasModrm) {
+        size_t ModrmLen = modrmLength(Code + Pos, Avail - Pos);
+        if (ModrmLen == 0) {
+            return 0;
+        }
+        Pos += ModrmLen;
+    }
+    if (Pos + Imm > Avail || Pos + Imm > 15) {
+        return 0;
+    }
+    if (*Kind == INSTR_COND_BRANCH || *Kind == INSTR_JUMP || (*Kind == INSTR_CALL && Op == 0xe8)) {
+        *Target = Imm == 1 ? (int64_t)(int8_t)Code[Pos] : (int64_t)(int32_t)(Code[Pos] | Code[Pos + 1] << 8 |
+                                                                           Code[Pos + 2] << 16 | (uint32_t)Code[Pos + 3] << 24);
+    }
+    return Pos + Imm;
+}
+
+/*
+ * 该函数的主要功能：返回函数在ELF文件中的指令，函数不完整地落在某个可执行节中时返回NULL
+ * */
+const uint8_t *getFunctionCode(const ElfFile *elf, const BinaryFunction *Function) {
+    for (size_t i = 0; i < elf->NumSections; ++i) {
+        const Elf64_Shdr *Section = &elf->Sections[i];
+        if (!isExecutableSection(Section) || Function->Address < Section->sh_addr ||
+            Function->Address + Function->Size > Section->sh_addr + Section->sh_size) {
+            continue;
+        }
+        const uint8_t *Data = (const uint8_t *)getElfSectionData(elf, Section);
+        return Data ? Data + (Function->Address - Section->sh_addr) : NULL;
+    }
+    return NULL;
+}
+
+#define INSTR_START 0x80  // 反汇编时Flags[off]的标记位，低位保存InstrKind
+#define BLOCK_LEADER 0x40
+
+/*
+ * 该函数的主要功能：顺序反汇编整个函数，以函数入口、函数内的直接跳转目标以及跳转/返回之后的指令为块的起点划分基本块
+ * 间接跳转的目标（跳转表）无法得到，跳转表的目标块会并入前一个块，fall-through经过它们时仍然有效
+ * */
+bool buildFunctionCFG(const ElfFile *elf, const BinaryFunction *Function, FunctionCFG *cfg, Arena *arena) {
+    cfg->Built = true;
+    const uint8_t *Code = getFunctionCode(elf, Function);
+    if (!Code || Function->Size == 0 || Function->Size >= UINT32_MAX) {
+        return false;
+    }
+    size_t Size = Function->Size;
+    uint8_t *Flags = (uint8_t *)calloc(Size, 1);
+    if (!Flags) {
+        return false;
+    }
+    size_t NumBlocks = 1;
+    Flags[0] = BLOCK_LEADER;
+    for (size_t Offset = 0; Offset < Size;) {
+        InstrKind Kind;
+        int64_t Target;
+        size_t Length = decodeInstrLength(Code + Offset, Size - Offset, &Kind, &Target);
+        if (Length == 0) {
+            free(Flags);
+            return false;
+        }
+        Flags[Offset] |= INSTR_START | Kind;
+        if (Kind == INSTR_COND_BRANCH || Kind == INSTR_JUMP) {
+            int64_t Dest = (int64_t)(Offset + Length) + Target;
+            if (Dest >= 0 && (uint64_t)Dest < Size) {
+                Flags[Dest] |= BLOCK_LEADER;
+            }
+        }
+        Offset += Length;
+        if (Kind != INSTR_OTHER && Kind != INSTR_CALL && Offset < Size) {
+            Flags[Offset] |= BLOCK_LEADER;
+        }
+    }
+    for (size_t Offset = 1; Offset < Size; ++Offset) {
+        // 跳到指令中间的目标说明反汇编与实际执行不一致，这样的起点忽略
+        NumBlocks += (Flags[Offset] & (INSTR_START | BLOCK_LEADER)) == (INSTR_START | BLOCK_LEADER);
+    }
+
+    cfg->BlockStart = (uint32_t *)arenaAlloc(arena, NumBlocks * sizeof(uint32_t));
+    cfg->LastInstr = (uint32_t *)arenaAlloc(arena, NumBlocks * sizeof(uint32_t));
+    cfg->FallsThrough = (uint8_t *)arenaAlloc(arena, NumBlocks);
+    if (!cfg->BlockStart || !cfg->LastInstr || !cfg->FallsThrough) {
+        free(Flags);
+        return false;
+    }
+    uint32_t Block = 0;
+    uint32_t LastInstr = 0;
+    cfg->BlockStart[0] = 0;
+    for (size_t Offset = 0; Offset < Size; ++Offset) {
+        if (!(Flags[Offset] & INSTR_START)) {
+            continue;
+        }
+        if (Offset > 0 && (Flags[Offset] & BLOCK_LEADER)) {
+            InstrKind Kind = (InstrKind)(Flags[LastInstr] & 0x3f);
+            cfg->LastInstr[Block] = LastInstr;
+            cfg->FallsThrough[Block] = Kind != INSTR_JUMP && Kind != INSTR_INDIRECT_JUMP &&
+                                       Kind != INSTR_RETURN && Kind != INSTR_TRAP;
+            cfg->BlockStart[++Block] = Offset;
+        }
+        LastInstr = Offset;
+    }
+    cfg->LastInstr[Block] = LastInstr;
+    cfg->FallsThrough[Block] = false;
+    cfg->NumBlocks = NumBlocks;
+    free(Flags);
+    return true;
+}
+
+/*
+ * 该函数的主要功能：返回包含Offset的基本块的下标
+ * */
+uint32_t findBlockContainingOffset(const FunctionCFG *cfg, uint32_t Offset) {
+    uint32_t Low = 0;
+    uint32_t High = cfg->NumBlocks;
+    while (High - Low > 1) {
+        uint32_t Mid = Low + (High - Low) / 2;
+        if (cfg->BlockStart[Mid] <= Offset) {
+            Low = Mid;
+        } else {
+            High = Mid;
+        }
+    }
+    return Low;
+}
+
+/*
+ * 该函数的主要功能：解析LBR的控制函数，只有KeepExtraFields时才保留额外字段，从arena中分配
+ * */
+bool parseLBREntry(const char *str, size_t len, LBREntry *entry, Arena *arena) {
+    const char *ptr = str;
+    const char *end = str + len;
+    const char *token;
+    size_t tokenLen;
+    size_t extraFieldsCapacity = INITIAL_EXTRA_FIELDS_SIZE;
+    entry->extraFields = NULL;
+    entry->extraFieldsCount = 0;
+
+    if (!nextField(&ptr, end, '/', &token, &tokenLen)) {
+        fprintf(logFile, "Error: expected hexadecimal number for From address\n");
+        return false;
+    }
+    if (!parseHexView(token, tokenLen, &entry->from)) {
+        fprintf(logFile, "Error: invalid hexadecimal number for From address\n");
+        return false;
+    }
+
+    if (!nextField(&ptr, end, '/', &token, &tokenLen)) {
+        fprintf(logFile, "Error: expected hexadecimal number for To address\n");
+        return false;
+    }
+    if (!parseHexView(token, tokenLen, &entry->to)) {
+        fprintf(logFile, "Error: invalid hexadecimal number for To address\n");
+        return false;
+    }
+
+    if (!nextField(&ptr, end, '/', &token, &tokenLen)) {
+        token = "(null)";
+        tokenLen = strlen(token);
+    }
+    if (token[0] != 'P' && token[0] != 'M' && token[0] != '-') {
+        fprintf(logFile, "Error: expected single char for mispred bit, found: %.*s\n", (int)tokenLen, token);
+        return false;
+    }
+    entry->mispred = (token[0] == 'M');
+
+    // 处理额外字段
+    while (KeepExtraFields && nextField(&ptr, end, '/', &token, &tokenLen)) {
+        if (!entry->extraFields || entry->extraFieldsCount == extraFieldsCapacity) {
+            size_t oldCapacity = entry->extraFields ? extraFieldsCapacity : 0;
+            if (entry->extraFields) {
+                extraFieldsCapacity *= 2;
+            }
+            char **newExtraFields = (char **)arenaGrow(arena, entry->extraFields, oldCapacity * sizeof(char *),
+                                                       extraFieldsCapacity * sizeof(char *));
+            if (newExtraFields == NULL) {
+                fprintf(logFile, "Error allocating memory for extraFields\n");
+                return false;
+            }
+            entry->extraFields = newExtraFields;
+        }
+        entry->extraFields[entry->extraFieldsCount] = arenaStrndup(arena, token, tokenLen);
+        if (entry->extraFields[entry->extraFieldsCount] == NULL) {
+            fprintf(logFile, "Error duplicating string for extraField\n");
+            return false;
+        }
+        entry->extraFieldsCount++;
+    }
+
+    return true;
+}
+
+/*
+ * 该函数的主要功能：根据CPU支持的指令集选择brstack解码器
+ * */
+void initBrstackDecoder() {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        BrstackDecoder = DECODER_AVX2;
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        BrstackDecoder = DECODER_SSE42;
+    }
+#endif
+}
+
+const char *brstackDecoderName(BrstackDecoderKind kind) {
+    switch (kind) {
+        case DECODER_AVX2: return "avx2";
+        case DECODER_SSE42: return "sse4.2";
+        default: return "scalar";
+    }
+}
+
+/*
+ * 该函数的主要功能：标记[line + start, line + len)中所有'/'和' '的位置，第i位对应第i个字节
+ * */
+void buildDelimMaskScalar(const char *line, size_t start, size_t len, uint64_t *slashMask, uint64_t *spaceMask) {
+    for (size_t i = start; i < len; ++i) {
+        if (line[i] == '/') slashMask[i >> 6] |= 1ULL << (i & 63);
+        else if (line[i] == ' ' || line[i] == '\t') spaceMask[i >> 6] |= 1ULL << (i & 63);
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse4.2")))
+void buildDelimMaskSSE42(const char *line, size_t len, uint64_t *slashMask, uint64_t *spaceMask) {
+    const __m128i Slash = _mm_set1_epi8('/');
+    const __m128i Space = _mm_set1_epi8(' ');
+    const __m128i Tab = _mm_set1_epi8('\t');
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i Chunk = _mm_loadu_si128((const __m128i *)(line + i));
+        uint64_t Slashes = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(Chunk, Slash));
+        uint64_t Spaces = (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(Chunk, Space),
+                                                                   _mm_cmpeq_epi8(Chunk, Tab)));
+        slashMask[i >> 6] |= Slashes << (i & 63);
+        spaceMask[i >> 6] |= Spaces << (i & 63);
+    }
+    buildDelimMaskScalar(line, i, len, slashMask, spaceMask);
+}
+
+__attribute__((target("avx2")))
+void buildDelimMaskAVX2(const char *line, size_t len, uint64_t *slashMask, uint64_t *spaceMask) {
+    const __m256i Slash = _mm256_set1_epi8('/');
+    const __m256i Space = _mm256_set1_epi8(' ');
+    const __m256i Tab = _mm256_set1_epi8('\t');
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i Chunk = _mm256_loadu_si256((const __m256i *)(line + i));
+        uint64_t Slashes = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(Chunk, Slash));
+        uint64_t Spaces = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(Chunk, Space),
+                                                                         _mm256_cmpeq_epi8(Chunk, Tab)));
+        slashMask[i >> 6] |= Slashes << (i & 63);
+        spaceMask[i >> 6] |= Spaces << (i & 63);
+    }
+    buildDelimMaskScalar(line, i, len, slashMask, spaceMask);
+}
+
+/*
+ * 该函数的主要功能：用SSE把最多16个十六进制字符转换成64位整数
+ * 先把每个字符转换成4位数值，再用pshufb右对齐，最后用pmaddubsw两两合并成字节
+ * */
+__attribute__((target("sse4.2")))
+bool parseHexSSE42(const char *str, size_t len, const char *lineEnd, uint64_t *value) {
+    if (len >= 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        str += 2;
+        len -= 2;
+    }
+    if (len == 0 || len > 16) {
+        return false;
+    }
+
+    // pshufb的右对齐表：第i个字节取第i - (16 - len)个数字，前面补0
+    static __thread bool TableReady = false;
+    static __thread uint8_t AlignTable[17][16];
+    if (!TableReady) {
+        for (int n = 0; n <= 16; ++n) {
+            for (int i = 0; i < 16; ++i) {
+                AlignTable[n][i] = i >= 16 - n ? (uint8_t)(i - (16 - n)) : 0x80;
+            }
+        }
+        TableReady = true;
+    }
+
+    __m128i Chars;
+    if (str + 16 <= lineEnd) {
+        Chars = _mm_loadu_si128((const __m128i *)str);
+    } else {
+        // 靠近行尾时不能越界读取映射区域
+        char Buffer[16] = {0};
+        memcpy(Buffer, str, len);
+        Chars = _mm_loadu_si128((const __m128i *)Buffer);
+    }
+
+    // 数字和字母分别检查范围，与parseHexView一致：'@'、'`'这类紧挨着字母的字符不能当成合法数字
+    __m128i Digits = _mm_sub_epi8(Chars, _mm_set1_epi8('0'));
+    __m128i Letters = _mm_sub_epi8(_mm_or_si128(Chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i IsLetter = _mm_cmpgt_epi8(Chars, _mm_set1_epi8('9'));
+    __m128i DigitValid = _mm_cmpeq_epi8(_mm_min_epu8(Digits, _mm_set1_epi8(9)), Digits);
+    __m128i LetterValid = _mm_cmpeq_epi8(_mm_min_epu8(Letters, _mm_set1_epi8(5)), Letters);
+    __m128i Nibbles = _mm_blendv_epi8(Digits, _mm_add_epi8(Letters, _mm_set1_epi8(10)), IsLetter);
+    __m128i Valid = _mm_blendv_epi8(DigitValid, LetterValid, IsLetter);
+    uint32_t ValidMask = (uint32_t)_mm_movemask_epi8(Valid);
+    uint32_t Needed = (len == 16) ? 0xffffu : ((1u << len) - 1);
+    if ((ValidMask & Needed) != Needed) {
+        return false;
+    }
+
+    __m128i Aligned = _mm_shuffle_epi8(Nibbles, _mm_loadu_si128((const __m128i *)AlignTable[len]));
+    __m128i Pairs = _mm_maddubs_epi16(Aligned, _mm_set1_epi16(0x0110));
+    __m128i Bytes = _mm_packus_epi16(Pairs, Pairs);
+    *value = __builtin_bswap64((uint64_t)_mm_cvtsi128_si64(Bytes));
+    return true;
+}
+#endif
+
+/*
+ * 该函数的主要功能：从第pos个字节开始查找下一个被标记的位置，找不到时返回len
+ * */
+static inline size_t nextMarked(const uint64_t *mask, size_t pos, size_t len) {
+    if (pos >= len) {
+        return len;
+    }
+    size_t Word = pos >> 6;
+    uint64_t Bits = mask[Word] & (~0ULL << (pos & 63));
+    size_t Words = (len + 63) >> 6;
+    while (!Bits) {
+        if (++Word >= Words) {
+            return len;
+        }
+        Bits = mask[Word];
+    }
+    size_t Result = (Word << 6) + __builtin_ctzll(Bits);
+    return Result < len ? Result : len;
+}
+
+/*
+ * 该函数的主要功能：一次解码一整行"PID PC 0xFROM/0xTO/M/..."，只填充from/to/mispred数组
+ * 先用SIMD一次性找出整行所有'/'和' '的位置，再逐项做十六进制转换
+ * 返回-1表示这一行不是快速路径能处理的格式，调用者应该退回parseBranchSample
+ * */
+int decodeBrstackLineWith(BrstackDecoderKind kind, const char *line, size_t len, PerfBranchSample *out) {
+    const char *ptr = line;
+    const char *end = line + len;
+    const char *token;
+    size_t tokenLen;
+
+    out->LBRCount = 0;
+    out->MispredMask = 0;
+    out->SkipMask = 0;
+    out->Extra = NULL;
+    if (!nextField(&ptr, end, ' ', &token, &tokenLen) || !parseDecView(token, tokenLen, &out->PID)) {
+        return -1;
+    }
+    if (!nextField(&ptr, end, ' ', &token, &tokenLen) || !parseHexView(token, tokenLen, &out->PC)) {
+        return -1;
+    }
+
+    const char *rest = ptr;
+    size_t restLen = end - ptr;
+    if (restLen > MAX_BRSTACK_LINE) {
+        return -1;
+    }
+    uint64_t SlashMask[MAX_BRSTACK_LINE / 64 + 1];
+    uint64_t SpaceMask[MAX_BRSTACK_LINE / 64 + 1];
+    size_t Words = (restLen + 63) / 64;
+    memset(SlashMask, 0, Words * sizeof(uint64_t));
+    memset(SpaceMask, 0, Words * sizeof(uint64_t));
+#ifdef HAVE_X86_SIMD
+    if (kind == DECODER_AVX2) {
+        buildDelimMaskAVX2(rest, restLen, SlashMask, SpaceMask);
+    } else if (kind == DECODER_SSE42) {
+        buildDelimMaskSSE42(rest, restLen, SlashMask, SpaceMask);
+    } else
+#endif
+    {
+        buildDelimMaskScalar(rest, 0, restLen, SlashMask, SpaceMask);
+    }
+
+    size_t pos = 0;
+    for (;;) {
+        // 跳过连续的空格
+        while (pos < restLen && (rest[pos] == ' ' || rest[pos] == '\t')) {
+            ++pos;
+        }
+        if (pos >= restLen) {
+            break;
+        }
+        if (out->LBRCount == MAX_LBR_ENTRIES) {
+            return -1;
+        }
+        size_t TokenEnd = nextMarked(SpaceMask, pos, restLen);
+        size_t FromEnd = nextMarked(SlashMask, pos, restLen);
+        if (FromEnd >= TokenEnd) {
+            return -1;
+        }
+        size_t ToEnd = nextMarked(SlashMask, FromEnd + 1, restLen);
+        if (ToEnd + 1 >= TokenEnd) {
+            return -1;
+        }
+
+        uint64_t From, To;
+        bool Ok;
+#ifdef HAVE_X86_SIMD
+        if (kind != DECODER_SCALAR) {
+            Ok = parseHexSSE42(rest + pos, FromEnd - pos, end, &From) &&
+                 parseHexSSE42(rest + FromEnd + 1, ToEnd - FromEnd - 1, end, &To);
+        } else
+#endif
+        {
+            Ok = parseHexView(rest + pos, FromEnd - pos, &From) &&
+                 parseHexView(rest + FromEnd + 1, ToEnd - FromEnd - 1, &To);
+        }
+        char Mispred = rest[ToEnd + 1];
+        if (!Ok || (Mispred != 'P' && Mispred != 'M' && Mispred != '-')) {
+            return -1;
+        }
+
+        out->From[out->LBRCount] = From;
+        out->To[out->LBRCount] = To;
+        out->MispredMask |= (uint32_t)(Mispred == 'M') << out->LBRCount;
+        ++out->LBRCount;
+        pos = TokenEnd;
+    }
+    return (int)out->LBRCount;
+}
+
+int decodeBrstackLine(const char *line, size_t len, PerfBranchSample *out) {
+    return decodeBrstackLineWith(BrstackDecoder, line, len, out);
+}
+
+/*
+ * 该函数的主要功能：判断地址是否位于内存范围
+ * */
+bool ignoreKernelInterrupt(uint64_t From, uint64_t To) {
+    return IgnoreInterruptLBR &&
+           (From >= KernelBaseAddr || To >= KernelBaseAddr);
+}
+
+/*
+ * 该函数的主要功能：逐项检查sample中的LBR项，返回from或to在内核中的项的位图，
+ * OutsideMask中是from和to都不在[Low, High)中的项；Low/High的比较写成一次无符号减法
+ * */
+uint32_t classifyLBREntriesScalar(const PerfBranchSample *sample, uint64_t Low, uint64_t High, uint32_t *OutsideMask) {
+    uint64_t Span = High > Low ? High - Low : 0;
+    uint32_t KernelMask = 0;
+    *OutsideMask = 0;
+    for (uint32_t i = 0; i < sample->LBRCount; ++i) {
+        KernelMask |= (uint32_t)ignoreKernelInterrupt(sample->From[i], sample->To[i]) << i;
+        *OutsideMask |= (uint32_t)(sample->From[i] - Low >= Span && sample->To[i] - Low >= Span) << i;
+    }
+    return KernelMask;
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * 该函数的主要功能：与classifyLBREntriesScalar相同，用AVX2一次检查4项的from和to
+ * 没有64位无符号比较，两边都异或符号位后用有符号比较代替；From/To数组固定MAX_LBR_ENTRIES项，按4项读取不会越界
+ * */
+__attribute__((target("avx2")))
+uint32_t classifyLBREntriesAVX2(const PerfBranchSample *sample, uint64_t Low, uint64_t High, uint32_t *OutsideMask) {
+    const __m256i Sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i KernelLast = _mm256_set1_epi64x((int64_t)((KernelBaseAddr - 1) ^ (1ULL << 63)));
+    const __m256i LowV = _mm256_set1_epi64x((int64_t)Low);
+    const __m256i SpanV = _mm256_set1_epi64x((int64_t)((High > Low ? High - Low : 0) ^ (1ULL << 63)));
+    uint32_t KernelMask = 0;
+    uint32_t InsideMask = 0;
+    for (uint32_t i = 0; i < sample->LBRCount; i += 4) {
+        __m256i From = _mm256_loadu_si256((const __m256i *)&sample->From[i]);
+        __m256i To = _mm256_loadu_si256((const __m256i *)&sample->To[i]);
+        __m256i Kernel = _mm256_or_si256(_mm256_cmpgt_epi64(_mm256_xor_si256(From, Sign), KernelLast),
+                                         _mm256_cmpgt_epi64(_mm256_xor_si256(To, Sign), KernelLast));
+        __m256i FromOffset = _mm256_xor_si256(_mm256_sub_epi64(From, LowV), Sign);
+        __m256i ToOffset = _mm256_xor_si256(_mm256_sub_epi64(To, LowV), Sign);
+        __m256i Inside = _mm256_or_si256(_mm256_cmpgt_epi64(SpanV, FromOffset), _mm256_cmpgt_epi64(SpanV, ToOffset));
+        KernelMask |= (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(Kernel)) << i;
+        InsideMask |= (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(Inside)) << i;
+    }
+    uint32_t Valid = sample->LBRCount == 32 ? UINT32_MAX : (1u << sample->LBRCount) - 1;
+    *OutsideMask = ~InsideMask & Valid;
+    return KernelMask & Valid;
+}
+
+/*
+ * 该函数的主要功能：与classifyLBREntriesAVX2相同，SSE4.2的pcmpgtq一次检查2项
+ * */
+__attribute__((target("sse4.2")))
+uint32_t classifyLBREntriesSSE42(const PerfBranchSample *sample, uint64_t Low, uint64_t High, uint32_t *OutsideMask) {
+    const __m128i Sign = _mm_set1_epi64x(INT64_MIN);
+    const __m128i KernelLast = _mm_set1_epi64x((int64_t)((KernelBaseAddr - 1) ^ (1ULL << 63)));
+    const __m128i LowV = _mm_set1_epi64x((int64_t)Low);
+    const __m128i SpanV = _mm_set1_epi64x((int64_t)((High > Low ? High - Low : 0) ^ (1ULL << 63)));
+    uint32_t KernelMask = 0;
+    uint32_t InsideMask = 0;
+    for (uint32_t i = 0; i < sample->LBRCount; i += 2) {
+        __m128i From = _mm_loadu_si128((const __m128i *)&sample->From[i]);
+        __m128i To = _mm_loadu_si128((const __m128i *)&sample->To[i]);
+        __m128i Kernel = _mm_or_si128(_mm_cmpgt_epi64(_mm_xor_si128(From, Sign), KernelLast),
+                                      _mm_cmpgt_epi64(_mm_xor_si128(To, Sign), KernelLast));
+        __m128i FromOffset = _mm_xor_si128(_mm_sub_epi64(From, LowV), Sign);
+        __m128i ToOffset = _mm_xor_si128(_mm_sub_epi64(To, LowV), Sign);
+        __m128i Inside = _mm_or_si128(_mm_cmpgt_epi64(SpanV, FromOffset), _mm_cmpgt_epi64(SpanV, ToOffset));
+        KernelMask |= (uint32_t)_mm_movemask_pd(_mm_castsi128_pd(Kernel)) << i;
+        InsideMask |= (uint32_t)_mm_movemask_pd(_mm_castsi128_pd(Inside)) << i;
+    }
+    uint32_t Valid = sample->LBRCount == 32 ? UINT32_MAX : (1u << sample->LBRCount) - 1;
+    *OutsideMask = ~InsideMask & Valid;
+    return KernelMask & Valid;
+}
+#endif
+
+uint32_t classifyLBREntries(const PerfBranchSample *sample, uint64_t Low, uint64_t High, uint32_t *OutsideMask) {
+#ifdef HAVE_X86_SIMD
+    if (BrstackDecoder == DECODER_AVX2) {
+        return classifyLBREntriesAVX2(sample, Low, High, OutsideMask);
+    } else if (BrstackDecoder == DECODER_SSE42) {
+        return classifyLBREntriesSSE42(sample, Low, High, OutsideMask);
+    }
+#endif
+    return classifyLBREntriesScalar(sample, Low, High, OutsideMask);
+}
+
+/*
+ * 该函数的主要功能：在逐项转换地址、查找函数之前批量过滤sample中的LBR项：
+ * from或to在内核中的项直接去掉（保持其余项的顺序，与BOLT的ignoreKernelInterrupt一致）；
+ * from和to都不在可执行文件中的项不能去掉，否则前后两段fall-through会被错误地连起来，只在SkipMask中标记，
+ * parseLBRSample对它们不再转换地址和查找函数。Index为NULL时用布局信息的范围，否则用该进程全部映射的范围
+ * */
+void filterLBREntries(PerfBranchSample *sample, const AddressIndex *Index, BranchWorker *worker) {
+    uint64_t Low = Index ? Index->Low : Layout.FirstAllocAddress;
+    uint64_t High = Index ? Index->High : Layout.LayoutStartAddress;
+    uint32_t OutsideMask;
+    uint32_t KernelMask = classifyLBREntries(sample, Low, High, &OutsideMask);
+    if (!IgnoreInterruptLBR) {
+        KernelMask = 0;
+    }
+    OutsideMask &= ~KernelMask;
+    worker->NumKernelEntries += __builtin_popcount(KernelMask);
+    worker->NumOutsideEntries += __builtin_popcount(OutsideMask);
+    sample->SkipMask = OutsideMask;
+    if (!KernelMask) {
+        return;
+    }
+
+    uint32_t Count = 0;
+    uint32_t MispredMask = 0;
+    uint32_t SkipMask = 0;
+    for (uint32_t i = 0; i < sample->LBRCount; ++i) {
+        if ((KernelMask >> i) & 1) {
+            continue;
+        }
+        sample->From[Count] = sample->From[i];
+        sample->To[Count] = sample->To[i];
+        MispredMask |= ((sample->MispredMask >> i) & 1) << Count;
+        SkipMask |= ((OutsideMask >> i) & 1) << Count;
+        if (sample->Extra) {
+            sample->Extra[Count] = sample->Extra[i];
+        }
+        ++Count;
+    }
+    sample->LBRCount = Count;
+    sample->MispredMask = MispredMask;
+    sample->SkipMask = SkipMask;
+}
+
+/*
+ * 该函数的主要功能：把解析出来的sample写到日志文件中
+ * */
+void logBranchSample(const PerfBranchSample *sample) {
+    fprintf(logFile, "\n\nPID: %ld  PC: 0x%lx\n", sample->PID, sample->PC);
+    for (uint32_t i = 0; i < sample->LBRCount; ++i) {
+        fprintf(logFile, "From: 0x%lx To: 0x%lx Mispred: %d", sample->From[i], sample->To[i],
+                (int)((sample->MispredMask >> i) & 1));
+        if (sample->Extra) {
+            for (size_t j = 0; j < sample->Extra[i].Count; j++) {
+                fprintf(logFile, "  %s", sample->Extra[i].Fields[j]);
+            }
+        }
+        fprintf(logFile, "\n");
+    }
+}
+
+/*
+ * 该函数的主要功能：具体的处理Branch事件的代码，line指向扫描器映射的区域，不以'\0'结尾
+ * 超过MAX_LBR_ENTRIES的项会被丢弃，额外字段从arena中分配，由调用者reset时统一回收
+ * */
+bool parseBranchSample(const char *line, size_t len, Arena *arena, PerfBranchSample *sample) {
+    sample->PID = 0;
+    sample->PC = 0;
+    sample->LBRCount = 0;
+    sample->MispredMask = 0;
+    sample->SkipMask = 0;
+    sample->Extra = NULL;
+
+    const char *ptr = line;
+    const char *end = line + len;
+    const char *token;
+    size_t tokenLen;
+
+    if (!nextField(&ptr, end, ' ', &token, &tokenLen)) {
+        fprintf(logFile, "Error: PID not found.\n");
+        return false;
+    }
+    parseDecView(token, tokenLen, &sample->PID);
+
+    if (!nextField(&ptr, end, ' ', &token, &tokenLen)) {
+        fprintf(logFile, "Error: PC not found.\n");
+        return false;
+    }
+    parseHexView(token, tokenLen, &sample->PC);
+
+    const char *restStr = ptr;
+    if (!nextField(&restStr, end, ' ', &token, &tokenLen)) {
+        fprintf(logFile, "Error: Rest of line not found.\n");
+        return false;
+    }
+
+    if (KeepExtraFields) {
+        sample->Extra = (LBRExtraFields *)arenaAlloc(arena, MAX_LBR_ENTRIES * sizeof(LBRExtraFields));
+        if (!sample->Extra) {
+            fprintf(logFile, "Error allocating memory for extraFields\n");
+            return false;
+        }
+    }
+
+    while (nextField(&ptr, end, ' ', &token, &tokenLen)) {
+        LBREntry entry;
+        if (!parseLBREntry(token, tokenLen, &entry, arena)) {
+            return false;
+        }
+        if (sample->LBRCount == MAX_LBR_ENTRIES) {
+            ++NumTruncatedEntries;
+            continue;
+        }
+        sample->From[sample->LBRCount] = entry.from;
+        sample->To[sample->LBRCount] = entry.to;
+        sample->MispredMask |= (uint32_t)entry.mispred << sample->LBRCount;
+        if (sample->Extra) {
+            sample->Extra[sample->LBRCount].Fields = entry.extraFields;
+            sample->Extra[sample->LBRCount].Count = entry.extraFieldsCount;
+        }
+        sample->LBRCount++;
+    }
+    return true;
+}
+
+/*
+ * 该函数的主要功能：查找PID对应的地址转换索引，没有mmap信息时返回NULL，进程没有映射可执行文件时返回空索引
+ * */
+const AddressIndex *findAddressIndex(const ProcessAddressTable *table, uint64_t PID) {
+    if (table->Capacity == 0) {
+        return NULL;
+    }
+    size_t Index = (size_t)((PID * 0x9E3779B97F4A7C15ULL) >> 32) & (table->Capacity - 1);
+    while (table->Slots[Index].PID != UINT64_MAX) {
+        if (table->Slots[Index].PID == PID) {
+            return table->Slots[Index].Index;
+        }
+        Index = (Index + 1) & (table->Capacity - 1);
+    }
+    return &EmptyAddressIndex;
+}
+
+static inline const AddressIndex *getWorkerAddressIndex(BranchWorker *worker, uint64_t PID) {
+    if (!worker->LastIndex || worker->LastPID != PID) {
+        worker->LastIndex = findAddressIndex(&ProcessAddresses, PID);
+        worker->LastPID = PID;
+    }
+    return worker->LastIndex;
+}
+
+static inline const AddressRange *findAddressRange(const AddressIndex *Index, uint64_t Address) {
+    // 找到最后一个Start <= Address的区间
+    size_t Low = 0;
+    size_t High = Index->NumRanges;
+    while (Low < High) {
+        size_t Mid = (Low + High) / 2;
+        if (Index->Ranges[Mid].Start <= Address) {
+            Low = Mid + 1;
+        } else {
+            High = Mid;
+        }
+    }
+    if (Low > 0 && Address < Index->Ranges[Low - 1].End) {
+        return &Index->Ranges[Low - 1];
+    }
+    return NULL;
+}
+
+/*
+ * 该函数的主要功能：把运行时地址转换成相对二进制文件的偏移，对应shell脚本中!HasFixedLoadAddress的处理
+ * Index为NULL时认为是固定加载地址，原样返回；不在该进程任何可执行映射中的地址返回UINT64_MAX
+ * */
+uint64_t adjustAddress(const AddressIndex *Index, uint64_t Address) {
+    if (!Index) {
+        return Address;
+    }
+    const AddressRange *Range = findAddressRange(Index, Address);
+    return Range ? Address - Range->Base : UINT64_MAX;
+}
+
+/*
+ * 该函数的主要功能：--all-dsos时把运行时地址转换成(DSO编号, DSO中的地址)，不在任何映射中时DSO编号为UINT32_MAX
+ * */
+static inline uint64_t translateAddress(const AddressIndex *Index, uint64_t Address, uint32_t *Dso) {
+    const AddressRange *Range = Index ? findAddressRange(Index, Address) : NULL;
+    *Dso = Range ? Range->Dso : UINT32_MAX;
+    return Range ? Address - Range->Base : UINT64_MAX;
+}
+
+/*
+ * 该函数的主要功能：返回符号表已经加载的DSO，第一次调用时加载，多个解析线程同时调用时只加载一次
+ * */
+const DsoInfo *ensureDsoLoaded(uint32_t Dso) {
+    DsoInfo *Info = &Dsos.Dsos[Dso];
+    int State = __atomic_load_n(&Info->Loaded, __ATOMIC_ACQUIRE);
+    if (State == 0) {
+        pthread_mutex_lock(&Dsos.Lock);
+        State = Info->Loaded;
+        if (State == 0) {
+            State = loadFunctionIndexFromElf(&Info->Functions, &Info->Elf) ? 1 : -1;
+            __atomic_store_n(&Info->Loaded, State, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&Dsos.Lock);
+    }
+    return State == 1 ? Info : NULL;
+}
+
+/*
+ * 该函数的主要功能：--all-dsos时在Dso的符号表中查找函数，与DA_getBinaryFunctionContainingAddress共用缓存，
+ * 缓存的key在地址的高位带上DSO编号（DSO中的地址都小于2^40）
+ * */
+const BinaryFunction *DA_getDsoFunctionContainingAddress(uint32_t Dso, uint64_t Address) {
+    if (Dso == UINT32_MAX) {
+        return NULL;
+    }
+    const DsoInfo *Info = ensureDsoLoaded(Dso);
+    if (!Info || Address < Info->Layout.FirstAllocAddress || Address >= Info->Layout.LayoutStartAddress) {
+        return NULL;
+    }
+    uint64_t Key = Address | ((uint64_t)(Dso + 1) << 40);
+    AddressCache *Cache = &FunctionCache;
+    size_t Slot = (size_t)((Key * 0x9E3779B97F4A7C15ULL) >> (64 - ADDRESS_CACHE_BITS));
+    if (Cache->Address[Slot] == Key) {
+        ++Cache->Hits;
+        return Cache->Function[Slot];
+    }
+    ++Cache->Misses;
+    const BinaryFunction *Function = findFunctionInIndex(&Info->Functions, Address, false, true);
+    Cache->Address[Slot] = Key;
+    Cache->Function[Slot] = Function;
+    return Function;
+}
+
+/*
+ * 该结构体的功能：mmap信息中属于可执行文件的一条映射，Seq是它在文件中的顺序
+ * */
+typedef struct {
+    uint64_t PID;
+    uint64_t Start;
+    uint64_t Size;
+    uint64_t Offset;
+    size_t Seq;
+    uint32_t Dso;
+} MMapRecord;
+
+typedef struct {
+    MMapRecord *Records;
+    size_t Size;
+    size_t Capacity;
+} MMapRecordList;
+
+/*
+ * 该函数的主要功能：按shell脚本中的公式计算映射的加载基址：找到与映射偏移对齐后相同的LOAD段，
+ * BasicAddress = MMapAddress - (SegInfo.Address - alignDown(SegInfo.FileOffset) + alignDown(FileOffset))
+ * 只有可执行的LOAD段才会进入地址转换索引
+ * */
+bool getMappingBase(const BinaryLayout *layout, uint64_t MMapAddress, uint64_t Offset, uint64_t *Base) {
+    for (size_t i = 0; i < layout->NumSegments; ++i) {
+        const LoadSegment *Segment = &layout->Segments[i];
+        uint64_t Mask = Segment->Align ? Segment->Align - 1 : 0;
+        uint64_t SegmentOffset = Segment->Offset & ~Mask;
+        uint64_t FileOffset = Offset & ~Mask;
+        if (SegmentOffset == FileOffset) {
+            if (!(Segment->Flags & PF_X)) {
+                return false;
+            }
+            *Base = MMapAddress - (Segment->VirtAddr - SegmentOffset + FileOffset);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * 该函数的主要功能：比较映射的文件名与可执行文件的文件名，只比较最后一个'/'之后的部分，
+ * 这样task的完整路径和shell脚本的perf_temp_mmap.log中只有文件名的格式都能匹配
+ * */
+bool isExecutableMapping(const char *Name, size_t NameLen, const char *ExecBaseName) {
+    for (size_t i = NameLen; i > 0; --i) {
+        if (Name[i - 1] == '/') {
+            NameLen -= i;
+            Name += i;
+            break;
+        }
+    }
+    return NameLen == strlen(ExecBaseName) && memcmp(Name, ExecBaseName, NameLen) == 0;
+}
+
+bool appendMMapRecord(MMapRecordList *list, const MMapRecord *Record) {
+    if (list->Size == list->Capacity) {
+        size_t Capacity = list->Capacity ? list->Capacity * 2 : 64;
+        MMapRecord *Records = (MMapRecord *)realloc(list->Records, Capacity * sizeof(MMapRecord));
+        if (!Records) {
+            return false;
+        }
+        list->Records = Records;
+        list->Capacity = Capacity;
+    }
+    list->Records[list->Size++] = *Record;
+    return true;
+}
+
+int compareMMapRecord(const void *a, const void *b) {
+    const MMapRecord *A = (const MMapRecord *)a;
+    const MMapRecord *B = (const MMapRecord *)b;
+    if (A->PID != B->PID) {
+        return A->PID < B->PID ? -1 : 1;
+    }
+    return A->Seq < B->Seq ? -1 : (A->Seq > B->Seq);
+}
+
+int compareAddressRange(const void *a, const void *b) {
+    uint64_t A = ((const AddressRange *)a)->Start;
+    uint64_t B = ((const AddressRange *)b)->Start;
+    return A < B ? -1 : (A > B);
+}
+
+static inline uint64_t hashPath(const char *Path, size_t Len) {
+    uint64_t Hash = 0xCBF29CE484222325ULL;  // FNV-1a
+    for (size_t i = 0; i < Len; ++i) {
+        Hash = (Hash ^ (uint8_t)Path[i]) * 0x100000001B3ULL;
+    }
+    return Hash;
+}
+
+/*
+ * 该函数的主要功能：按路径登记一个DSO，返回编号，已经登记过时直接返回，内存不足时返回UINT32_MAX
+ * 新文件打开后读取LOAD段和build-id，与已有文件的build-id相同时记为它的别名
+ * */
+uint32_t registerDso(DsoTable *table, const char *Path, size_t Len) {
+    uint64_t Hash = hashPath(Path, Len);
+    if ((table->NumDsos + 1) * 2 > table->SlotCapacity) {
+        uint32_t Capacity = table->SlotCapacity ? table->SlotCapacity * 2 : 64;
+        uint32_t *Slots = (uint32_t *)calloc(Capacity, sizeof(uint32_t));
+        if (!Slots) {
+            return UINT32_MAX;
+        }
+        for (uint32_t i = 0; i < table->NumDsos; ++i) {
+            size_t Slot = table->Dsos[i].PathHash & (Capacity - 1);
+            while (Slots[Slot]) {
+                Slot = (Slot + 1) & (Capacity - 1);
+            }
+            Slots[Slot] = i + 1;
+        }
+        free(table->Slots);
+        table->Slots = Slots;
+        table->SlotCapacity = Capacity;
+    }
+    size_t Slot = Hash & (table->SlotCapacity - 1);
+    while (table->Slots[Slot]) {
+        const DsoInfo *Info = &table->Dsos[table->Slots[Slot] - 1];
+        if (Info->PathHash == Hash && strncmp(Info->Path, Path, Len) == 0 && Info->Path[Len] == '\0') {
+            return table->Slots[Slot] - 1;
+        }
+        Slot = (Slot + 1) & (table->SlotCapacity - 1);
+    }
+
+    if (table->NumDsos == table->Capacity) {
+        uint32_t Capacity = table->Capacity ? table->Capacity * 2 : 32;
+        DsoInfo *Infos = (DsoInfo *)realloc(table->Dsos, Capacity * sizeof(DsoInfo));
+        if (!Infos) {
+            return UINT32_MAX;
+        }
+        table->Dsos = Infos;
+        table->Capacity = Capacity;
+    }
+    uint32_t Id = table->NumDsos;
+    DsoInfo *Info = &table->Dsos[Id];
+    memset(Info, 0, sizeof(*Info));
+    Info->Path = strndup(Path, Len);
+    if (!Info->Path) {
+        return UINT32_MAX;
+    }
+    Info->PathHash = Hash;
+    Info->Alias = Id;
+    Info->Usable = openElfFile(&Info->Elf, Info->Path) && getBinaryLayout(&Info->Elf, &Info->Layout);
+    if (Info->Usable) {
+        Info->BuildIdSize = getElfBuildId(&Info->Elf, Info->BuildId, sizeof(Info->BuildId));
+        for (uint32_t i = 0; i < Id && Info->BuildIdSize; ++i) {
+            const DsoInfo *Other = &table->Dsos[i];
+            if (Other->Usable && Other->Alias == i && Other->BuildIdSize == Info->BuildIdSize &&
+                memcmp(Other->BuildId, Info->BuildId, Info->BuildIdSize) == 0) {
+                Info->Alias = i;
+                break;
+            }
+        }
+    } else {
+        fprintf(logFile, "Warning: cannot read ELF file %s, samples in it are dropped\n", Info->Path);
+    }
+    if (Info->Alias != Id) {
+        closeElfFile(&Info->Elf);
+    }
+    ++table->NumDsos;
+    table->Slots[Slot] = Id + 1;
+    return Id;
+}
+
+void freeDsoTable(DsoTable *table) {
+    for (uint32_t i = 0; i < table->NumDsos; ++i) {
+        free(table->Dsos[i].Path);
+        closeElfFile(&table->Dsos[i].Elf);
+        freeFunctionIndex(&table->Dsos[i].Functions);
+    }
+    free(table->Dsos);
+    free(table->Slots);
+    table->Dsos = NULL;
+    table->Slots = NULL;
+    table->NumDsos = table->Capacity = table->SlotCapacity = 0;
+}
+
+/*
+ * 该函数的主要功能：判断一条映射是否需要进入地址转换索引，是的话填写它的DSO编号；
+ * --all-dsos时所有以'/'开头的文件都登记为DSO（[vdso]、匿名映射等除外），否则只接受可执行文件
+ * */
+bool selectMapping(const char *Name, size_t NameLen, const char *ExecBaseName, uint32_t *Dso) {
+    if (!MultiDso) {
+        *Dso = 0;
+        return isExecutableMapping(Name, NameLen, ExecBaseName);
+    }
+    while (NameLen > 0 && (Name[NameLen - 1] == ' ' || Name[NameLen - 1] == '\r')) {
+        --NameLen;
+    }
+    if (NameLen == 0 || Name[0] != '/' ||
+        (NameLen >= strlen("(deleted)") && memcmp(Name + NameLen - strlen("(deleted)"), "(deleted)", strlen("(deleted)")) == 0)) {
+        return false;
+    }
+    *Dso = registerDso(&Dsos, Name, NameLen);
+    if (*Dso == UINT32_MAX || !Dsos.Dsos[*Dso].Usable) {
+        return false;
+    }
+    *Dso = Dsos.Dsos[*Dso].Alias;
+    return true;
+}
+
+/*
+ * 该函数的主要功能：读取mmap信息中属于可执行文件的映射，支持两种格式：
+ * task生成的"Time: / PID: / MMapAddress: / Size: / Offset: / FileName: / Forked:"块，fork出来的子进程已经带上了继承的映射；
+ * shell脚本生成的perf_temp_mmap.log中的"filename <name> PID <pid> MMapAddr <addr> SIZE <size> OFFSET <offset>"行
+ * */
+bool readMMapRecords(MMapRecordList *list, const char *filename, const char *ExecBaseName) {
+    LineScanner scanner;
+    if (!openLineScanner(&scanner, filename)) {
+        return false;
+    }
+    LineView line;
+    MMapRecord Record = {0};
+    bool IsExecutable = false;
+    bool Success = true;
+    while (Success && nextLine(&scanner, &line)) {
+        const char *ptr = line.Data;
+        const char *end = line.Data + line.Len;
+        const char *Key, *Value;
+        size_t KeyLen, ValueLen;
+        if (!nextField(&ptr, end, ' ', &Key, &KeyLen) || !nextField(&ptr, end, ' ', &Value, &ValueLen)) {
+            continue;
+        }
+        if (KeyLen == strlen("filename") && memcmp(Key, "filename", KeyLen) == 0) {
+            const char *Field;
+            size_t FieldLen;
+            MMapRecord Line = {0};
+            if (!selectMapping(Value, ValueLen, ExecBaseName, &Line.Dso) ||
+                !nextField(&ptr, end, ' ', &Field, &FieldLen) || !nextField(&ptr, end, ' ', &Field, &FieldLen) ||
+                !parseDecView(Field, FieldLen, &Line.PID) ||
+                !nextField(&ptr, end, ' ', &Field, &FieldLen) || !nextField(&ptr, end, ' ', &Field, &FieldLen) ||
+                !parseHexView(Field, FieldLen, &Line.Start) ||
+                !nextField(&ptr, end, ' ', &Field, &FieldLen) || !nextField(&ptr, end, ' ', &Field, &FieldLen) ||
+                !parseHexView(Field, FieldLen, &Line.Size) ||
+                !nextField(&ptr, end, ' ', &Field, &FieldLen) || !nextField(&ptr, end, ' ', &Field, &FieldLen) ||
+                !parseHexView(Field, FieldLen, &Line.Offset)) {
+                continue;
+            }
+            Line.Seq = list->Size;
+            Success = appendMMapRecord(list, &Line);
+        } else if (KeyLen == strlen("PID:") && memcmp(Key, "PID:", KeyLen) == 0) {
+            memset(&Record, 0, sizeof(Record));
+            IsExecutable = false;
+            parseDecView(Value, ValueLen, &Record.PID);
+        } else if (KeyLen == strlen("MMapAddress:") && memcmp(Key, "MMapAddress:", KeyLen) == 0) {
+            parseHexView(Value, ValueLen, &Record.Start);
+        } else if (KeyLen == strlen("Size:") && memcmp(Key, "Size:", KeyLen) == 0) {
+            parseHexView(Value, ValueLen, &Record.Size);
+        } else if (KeyLen == strlen("Offset:") && memcmp(Key, "Offset:", KeyLen) == 0) {
+            parseHexView(Value, ValueLen, &Record.Offset);
+        } else if (KeyLen == strlen("FileName:") && memcmp(Key, "FileName:", KeyLen) == 0) {
+            // 路径中可能有空格，取到行尾
+            IsExecutable = selectMapping(Value, end - Value, ExecBaseName, &Record.Dso);
+        } else if (KeyLen == strlen("Forked:") && memcmp(Key, "Forked:", KeyLen) == 0 && IsExecutable) {
+            Record.Seq = list->Size;
+            Success = appendMMapRecord(list, &Record);
+            IsExecutable = false;
+        }
+    }
+    closeLineScanner(&scanner);
+    return Success;
+}
+
+/*
+ * 该函数的主要功能：返回与Ranges内容相同的已有索引，没有时新建一个，fork出来的子进程因此共用父进程的索引
+ * Dedup是以Hash为key的开放寻址表，容量是2的幂
+ * */
+const AddressIndex *internAddressIndex(ProcessAddressTable *table, AddressIndex **Dedup, size_t DedupCapacity,
+                                       const AddressRange *Ranges, size_t NumRanges) {
+    uint64_t Hash = NumRanges;
+    for (size_t i = 0; i < NumRanges; ++i) {
+        Hash = (Hash ^ Ranges[i].Start) * 0x9E3779B97F4A7C15ULL;
+        Hash = (Hash ^ Ranges[i].End) * 0xBF58476D1CE4E5B9ULL;
+        Hash = (Hash ^ Ranges[i].Base) * 0x94D049BB133111EBULL;
+        Hash = (Hash ^ Ranges[i].Dso) * 0x9E3779B97F4A7C15ULL;
+    }
+    size_t Slot = (size_t)(Hash >> 32) & (DedupCapacity - 1);
+    while (Dedup[Slot]) {
+        bool Same = Dedup[Slot]->Hash == Hash && Dedup[Slot]->NumRanges == NumRanges;
+        for (size_t i = 0; Same && i < NumRanges; ++i) {
+            const AddressRange *A = &Dedup[Slot]->Ranges[i];
+            Same = A->Start == Ranges[i].Start && A->End == Ranges[i].End && A->Base == Ranges[i].Base &&
+                   A->Dso == Ranges[i].Dso;
+        }
+        if (Same) {
+            return Dedup[Slot];
+        }
+        Slot = (Slot + 1) & (DedupCapacity - 1);
+    }
+    AddressIndex *Index = (AddressIndex *)malloc(sizeof(AddressIndex));
+    AddressRange *Copy = (AddressRange *)malloc(NumRanges * sizeof(AddressRange));
+    if (!Index || !Copy) {
+        free(Index);
+        free(Copy);
+        return NULL;
+    }
+    memcpy(Copy, Ranges, NumRanges * sizeof(AddressRange));
+    Index->NumRanges = NumRanges;
+    Index->Ranges = Copy;
+    Index->Base = Ranges[0].Base;
+    Index->Hash = Hash;
+    Index->Low = Ranges[0].Start;
+    Index->High = 0;
+    for (size_t i = 0; i < NumRanges; ++i) {
+        Index->High = Ranges[i].End > Index->High ? Ranges[i].End : Index->High;
+    }
+    table->Indexes[table->NumIndexes++] = Index;
+    Dedup[Slot] = Index;
+    return Index;
+}
+
+void freeProcessAddresses(ProcessAddressTable *table) {
+    for (size_t i = 0; i < table->NumIndexes; ++i) {
+        free(table->Indexes[i]->Ranges);
+        free(table->Indexes[i]);
+    }
+    free(table->Indexes);
+    free(table->Slots);
+    memset(table, 0, sizeof(*table));
+}
+
+/*
+ * 该函数的主要功能：从mmap信息建立每个进程的地址转换索引，需要先得到可执行文件的LOAD段
+ * 同一进程后出现的映射覆盖与之重叠的旧映射；表的容量至少是进程数的两倍
+ * */
+bool loadProcessAddresses(ProcessAddressTable *table, const char *filename, const char *ExecName) {
+    memset(table, 0, sizeof(*table));
+    const char *ExecBaseName = !ExecName ? "" : strrchr(ExecName, '/') ? strrchr(ExecName, '/') + 1 : ExecName;
+    MMapRecordList list = {0};
+    if (!readMMapRecords(&list, filename, ExecBaseName)) {
+        free(list.Records);
+        return false;
+    }
+    qsort(list.Records, list.Size, sizeof(MMapRecord), compareMMapRecord);
+
+    size_t NumProcesses = 0;
+    for (size_t i = 0; i < list.Size; ++i) {
+        NumProcesses += (i == 0 || list.Records[i].PID != list.Records[i - 1].PID);
+    }
+    size_t Capacity = 16;
+    while (Capacity < NumProcesses * 2) {
+        Capacity *= 2;
+    }
+    table->Slots = (ProcessAddressSlot *)malloc(Capacity * sizeof(ProcessAddressSlot));
+    table->Indexes = (AddressIndex **)malloc((NumProcesses + 1) * sizeof(AddressIndex *));
+    AddressIndex **Dedup = (AddressIndex **)calloc(Capacity, sizeof(AddressIndex *));
+    AddressRange *Ranges = (AddressRange *)malloc((list.Size + 1) * sizeof(AddressRange));
+    bool Success = table->Slots && table->Indexes && Dedup && Ranges;
+    if (Success) {
+        table->Capacity = Capacity;
+        for (size_t i = 0; i < Capacity; ++i) {
+            table->Slots[i].PID = UINT64_MAX;
+        }
+    }
+
+    for (size_t Begin = 0; Success && Begin < list.Size;) {
+        uint64_t PID = list.Records[Begin].PID;
+        size_t NumRanges = 0;
+        size_t i = Begin;
+        for (; i < list.Size && list.Records[i].PID == PID; ++i) {
+            const MMapRecord *Record = &list.Records[i];
+            AddressRange Range = {Record->Start, Record->Start + Record->Size, 0, Record->Dso};
+            const BinaryLayout *layout = MultiDso ? &Dsos.Dsos[Record->Dso].Layout : &Layout;
+            if (Record->Size == 0 || !getMappingBase(layout, Record->Start, Record->Offset, &Range.Base)) {
+                continue;
+            }
+            // 删除被新映射覆盖的区间（映射数很少，直接线性处理）
+            size_t Kept = 0;
+            for (size_t j = 0; j < NumRanges; ++j) {
+                if (Ranges[j].End <= Range.Start || Ranges[j].Start >= Range.End) {
+                    Ranges[Kept++] = Ranges[j];
+                }
+            }
+            NumRanges = Kept;
+            Ranges[NumRanges++] = Range;
+        }
+        Begin = i;
+        if (NumRanges == 0) {
+            continue;
+        }
+        qsort(Ranges, NumRanges, sizeof(AddressRange), compareAddressRange);
+        const AddressIndex *Index = internAddressIndex(table, Dedup, Capacity, Ranges, NumRanges);
+        if (!Index) {
+            Success = false;
+            break;
+        }
+        size_t Slot = (size_t)((PID * 0x9E3779B97F4A7C15ULL) >> 32) & (Capacity - 1);
+        while (table->Slots[Slot].PID != UINT64_MAX) {
+            Slot = (Slot + 1) & (Capacity - 1);
+        }
+        table->Slots[Slot].PID = PID;
+        table->Slots[Slot].Index = Index;
+        ++table->Size;
+    }
+
+    free(Dedup);
+    free(Ranges);
+    free(list.Records);
+    if (!Success) {
+        freeProcessAddresses(table);
+    }
+    return Success;
+}
+
+static inline size_t hashTraceKey(uint64_t Key, size_t Capacity) {
+    // Fibonacci哈希，取乘积的高位，避免相邻地址落在相邻的槽中
+    return (size_t)((Key * 0x9E3779B97F4A7C15ULL) >> 32) & (Capacity - 1);
+}
+
+bool initBranchTraceTable(BranchTraceTable *table, size_t Capacity) {
+    table->Slots = (BranchTraceSlot *)malloc(Capacity * sizeof(BranchTraceSlot));
+    if (!table->Slots) {
+        return false;
+    }
+    for (size_t i = 0; i < Capacity; ++i) {
+        table->Slots[i].Key = EMPTY_TRACE_KEY;
+    }
+    table->Capacity = Capacity;
+    table->Size = 0;
+    table->NumOverflow = 0;
+    return true;
+}
+
+void freeBranchTraceTable(BranchTraceTable *table) {
+    free(table->Slots);
+    table->Slots = NULL;
+    table->Capacity = 0;
+    table->Size = 0;
+}
+
+/*
+ * 该函数的主要功能：找到key所在的槽，不存在时返回应该插入的空槽
+ * */
+static inline BranchTraceSlot *findTraceSlot(BranchTraceSlot *Slots, size_t Capacity, uint64_t Key) {
+    size_t Index = hashTraceKey(Key, Capacity);
+    while (Slots[Index].Key != Key && Slots[Index].Key != EMPTY_TRACE_KEY) {
+        Index = (Index + 1) & (Capacity - 1);
+    }
+    return &Slots[Index];
+}
+
+/*
+ * 该函数的主要功能：槽数扩大一倍并重新插入所有trace
+ * */
+bool growBranchTraceTable(BranchTraceTable *table) {
+    BranchTraceTable NewTable;
+    if (!initBranchTraceTable(&NewTable, table->Capacity * 2)) {
+        return false;
+    }
+    for (size_t i = 0; i < table->Capacity; ++i) {
+        if (table->Slots[i].Key != EMPTY_TRACE_KEY) {
+            *findTraceSlot(NewTable.Slots, NewTable.Capacity, table->Slots[i].Key) = table->Slots[i];
+        }
+    }
+    NewTable.Size = table->Size;
+    NewTable.NumOverflow = table->NumOverflow;
+    free(table->Slots);
+    *table = NewTable;
+    return true;
+}
+
+/*
+ * 该函数的主要功能：把一条trace的计数累加到表中，负载超过一半时扩容
+ * */
+static inline bool addBranchTraceCounts(BranchTraceTable *table, uint64_t Key, uint64_t Taken, uint64_t Mispred) {
+    BranchTraceSlot *Slot = findTraceSlot(table->Slots, table->Capacity, Key);
+    if (Slot->Key == EMPTY_TRACE_KEY) {
+        if ((table->Size + 1) * 2 > table->Capacity) {
+            if (!growBranchTraceTable(table)) {
+                return false;
+            }
+            Slot = findTraceSlot(table->Slots, table->Capacity, Key);
+        }
+        Slot->Key = Key;
+        Slot->TakenCount = 0;
+        Slot->MispredCount = 0;
+        ++table->Size;
+    }
+    Slot->TakenCount += Taken;
+    Slot->MispredCount += Mispred;
+    return true;
+}
+
+/*
+ * 该函数的主要功能：累加一条(From, To)分支的taken和mispred计数
+ * */
+bool addBranchTrace(BranchTraceTable *table, uint64_t From, uint64_t To, uint64_t Count, uint64_t Mispred) {
+    if (From >= UINT32_MAX || To >= UINT32_MAX) {
+        ++table->NumOverflow;
+        return false;
+    }
+    return addBranchTraceCounts(table, (From << 32) | To, Count, Mispred);
+}
+
+/*
+ * 该函数的主要功能：把src中的trace合并到dst中，合并结果与合并顺序无关
+ * */
+bool mergeBranchTraceTable(BranchTraceTable *dst, const BranchTraceTable *src) {
+    for (size_t i = 0; i < src->Capacity; ++i) {
+        const BranchTraceSlot *Slot = &src->Slots[i];
+        if (Slot->Key != EMPTY_TRACE_KEY &&
+            !addBranchTraceCounts(dst, Slot->Key, Slot->TakenCount, Slot->MispredCount)) {
+            return false;
+        }
+    }
+    dst->NumOverflow += src->NumOverflow;
+    return true;
+}
+
+/*
+ * 该函数的主要功能：把trace表中的计数乘以Scale并四舍五入，下采样之后把计数还原到全部sample的量级
+ * */
+void scaleBranchTraceTable(BranchTraceTable *table, double Scale) {
+    if (Scale == 1.0 || !table->Slots) {
+        return;
+    }
+    for (size_t i = 0; i < table->Capacity; ++i) {
+        BranchTraceSlot *Slot = &table->Slots[i];
+        if (Slot->Key != EMPTY_TRACE_KEY) {
+            Slot->TakenCount = (uint64_t)(Slot->TakenCount * Scale + 0.5);
+            Slot->MispredCount = (uint64_t)(Slot->MispredCount * Scale + 0.5);
+        }
+    }
+}
+
+bool initMemAccessTable(MemAccessTable *table, size_t Capacity) {
+    table->Slots = (MemAccessSlot *)malloc(Capacity * sizeof(MemAccessSlot));
+    if (!table->Slots) {
+        return false;
+    }
+    for (size_t i = 0; i < Capacity; ++i) {
+        table->Slots[i].IP = UINT64_MAX;
+    }
+    table->Capacity = Capacity;
+    table->Size = 0;
+    return true;
+}
+
+void freeMemAccessTable(MemAccessTable *table) {
+    free(table->Slots);
+    table->Slots = NULL;
+    table->Capacity = 0;
+    table->Size = 0;
+}
+
+static inline MemAccessSlot *findMemAccessSlot(MemAccessSlot *Slots, size_t Capacity, uint64_t IP, uint64_t Bucket) {
+    size_t Index = hashTraceKey((IP << 20) ^ (IP >> 44) ^ Bucket, Capacity);
+    while ((Slots[Index].IP != IP || Slots[Index].Bucket != Bucket) && Slots[Index].IP != UINT64_MAX) {
+        Index = (Index + 1) & (Capacity - 1);
+    }
+    return &Slots[Index];
+}
+
+bool growMemAccessTable(MemAccessTable *table) {
+    MemAccessTable NewTable;
+    if (!initMemAccessTable(&NewTable, table->Capacity * 2)) {
+        return false;
+    }
+    for (size_t i = 0; i < table->Capacity; ++i) {
+        const MemAccessSlot *Slot = &table->Slots[i];
+        if (Slot->IP != UINT64_MAX) {
+            *findMemAccessSlot(NewTable.Slots, NewTable.Capacity, Slot->IP, Slot->Bucket) = *Slot;
+        }
+    }
+    NewTable.Size = table->Size;
+    free(table->Slots);
+    *table = NewTable;
+    return true;
+}
+
+/*
+ * 该函数的主要功能：累加一项访存计数，负载超过一半时扩容
+ * */
+static inline bool addMemAccess(MemAccessTable *table, uint64_t IP, uint64_t Bucket, uint64_t Loads, uint64_t Stores) {
+    MemAccessSlot *Slot = findMemAccessSlot(table->Slots, table->Capacity, IP, Bucket);
+    if (Slot->IP == UINT64_MAX) {
+        if ((table->Size + 1) * 2 > table->Capacity) {
+            if (!growMemAccessTable(table)) {
+                return false;
+            }
+            Slot = findMemAccessSlot(table->Slots, table->Capacity, IP, Bucket);
+        }
+        Slot->IP = IP;
+        Slot->Bucket = Bucket;
+        Slot->Loads = 0;
+        Slot->Stores = 0;
+        ++table->Size;
+    }
+    Slot->Loads += Loads;
+    Slot->Stores += Stores;
+    return true;
+}
+
+bool mergeMemAccessTable(MemAccessTable *dst, const MemAccessTable *src) {
+    for (size_t i = 0; i < src->Capacity; ++i) {
+        const MemAccessSlot *Slot = &src->Slots[i];
+        if (Slot->IP != UINT64_MAX && !addMemAccess(dst, Slot->IP, Slot->Bucket, Slot->Loads, Slot->Stores)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int compareMemAccessSlot(const void *a, const void *b) {
+    const MemAccessSlot *A = (const MemAccessSlot *)a;
+    const MemAccessSlot *B = (const MemAccessSlot *)b;
+    if (A->IP != B->IP) return A->IP < B->IP ? -1 : 1;
+    return A->Bucket < B->Bucket ? -1 : (A->Bucket > B->Bucket);
+}
+
+int compareBranchTraceSlot(const void *a, const void *b) {
+    uint64_t A = ((const BranchTraceSlot *)a)->Key;
+    uint64_t B = ((const BranchTraceSlot *)b)->Key;
+    return A < B ? -1 : (A > B);
+}
+
+/*
+ * 该函数的主要功能：取出表中所有trace并按(From, To)排序，结果与哈希表的槽顺序以及解析线程数无关
+ * */
+BranchTraceSlot *sortBranchTraces(const BranchTraceTable *table, size_t *Count) {
+    BranchTraceSlot *Sorted = (BranchTraceSlot *)malloc((table->Size + 1) * sizeof(BranchTraceSlot));
+    if (!Sorted) {
+        return NULL;
+    }
+    *Count = 0;
+    for (size_t i = 0; i < table->Capacity; ++i) {
+        if (table->Slots[i].Key != EMPTY_TRACE_KEY) {
+            Sorted[(*Count)++] = table->Slots[i];
+        }
+    }
+    qsort(Sorted, *Count, sizeof(BranchTraceSlot), compareBranchTraceSlot);
+    return Sorted;
+}
+
+/*
+ * 该函数的主要功能：对应shell脚本中END部分，把trace按函数+偏移的形式写入perf.fdata
+ * 每行的格式为"src_id src_func src_offset dst_id dst_func dst_offset mispred count"，按(From, To)排序后输出
+ * */
+bool writeBranchProfile(const BranchTraceTable *table, const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        return false;
+    }
+    size_t Count;
+    BranchTraceSlot *Sorted = sortBranchTraces(table, &Count);
+    if (!Sorted) {
+        fclose(file);
+        return false;
+    }
+    for (size_t i = 0; i < Count; ++i) {
+        uint64_t From = Sorted[i].Key >> 32;
+        uint64_t To = Sorted[i].Key & UINT32_MAX;
+        const BinaryFunction *FromFunc = From ? DA_getBinaryFunctionContainingAddress(From) : NULL;
+        const BinaryFunction *ToFunc = To ? DA_getBinaryFunctionContainingAddress(To) : NULL;
+        fprintf(file, "%d %s %" PRIX64 " %d %s %" PRIX64 " %" PRIu64 " %" PRIu64 "\n",
+                FromFunc != NULL, FromFunc ? FromFunc->Name : "[unknown]", FromFunc ? From - FromFunc->Address : 0,
+                ToFunc != NULL, ToFunc ? ToFunc->Name : "[unknown]", ToFunc ? To - ToFunc->Address : 0,
+                Sorted[i].MispredCount, Sorted[i].TakenCount);
+    }
+    free(Sorted);
+    fclose(file);
+    return true;
+}
+
+/*
+ * 该函数的主要功能：牛顿迭代求平方根，只用于估计误差，避免为此链接libm
+ * */
+static double squareRoot(double x) {
+    if (x <= 0) {
+        return 0;
+    }
+    double Root = x > 1 ? x : 1;
+    for (;;) {
+        double Next = 0.5 * (Root + x / Root);
+        if (Next >= Root) {
+            return Root;
+        }
+        Root = Next;
+    }
+}
+
+/*
+ * 该函数的主要功能：下采样时报告计数最高的几条边（跳转和展开后的fall-through边）和它们的估计相对误差（95%置信区间的半宽）
+ * Fraction是实际处理的sample占全部sample的比例，把sample看作独立抽样，计数为c的边的相对标准误差约为sqrt((1-Fraction)/c)；
+ * 同一个sample中多次出现的边（循环）实际误差会更大，按预算提前停止时还假设处理过的部分能代表整个输入
+ * */
+void reportSampledEdges(const BranchTraceTable *table, double Fraction) {
+    const BranchTraceSlot *Top[TOP_EDGES_REPORTED];
+    size_t NumTop = 0;
+    for (size_t i = 0; i < table->Capacity; ++i) {
+        const BranchTraceSlot *Slot = &table->Slots[i];
+        if (Slot->Key == EMPTY_TRACE_KEY) {
+            continue;
+        }
+        // 计数相同时按key排序，保证报告的内容与线程数无关
+        size_t Pos = NumTop;
+        while (Pos > 0 && (Top[Pos - 1]->TakenCount < Slot->TakenCount ||
+                           (Top[Pos - 1]->TakenCount == Slot->TakenCount && Top[Pos - 1]->Key > Slot->Key))) {
+            --Pos;
+        }
+        if (Pos >= TOP_EDGES_REPORTED) {
+            continue;
+        }
+        size_t Last = NumTop < TOP_EDGES_REPORTED ? NumTop++ : TOP_EDGES_REPORTED - 1;
+        memmove(&Top[Pos + 1], &Top[Pos], (Last - Pos) * sizeof(Top[0]));
+        Top[Pos] = Slot;
+    }
+    fprintf(logFile, "Hottest edges (estimated count, 95%% relative error):\n");
+    for (size_t i = 0; i < NumTop; ++i) {
+        uint64_t From = Top[i]->Key >> 32;
+        uint64_t To = Top[i]->Key & UINT32_MAX;
+        const BinaryFunction *FromFunc = From ? DA_getBinaryFunctionContainingAddress(From) : NULL;
+        const BinaryFunction *ToFunc = To ? DA_getBinaryFunctionContainingAddress(To) : NULL;
+        double Sampled = Top[i]->TakenCount * Fraction;
+        double Error = Sampled > 0 ? 1.96 * squareRoot((1 - Fraction) / Sampled) : 0;
+        fprintf(logFile, "  %s+0x%" PRIx64 " -> %s+0x%" PRIx64 ": %" PRIu64 " +/- %.1f%%\n",
+                FromFunc ? FromFunc->Name : "[unknown]", FromFunc ? From - FromFunc->Address : 0,
+                ToFunc ? ToFunc->Name : "[unknown]", ToFunc ? To - ToFunc->Address : 0,
+                Top[i]->TakenCount, 100 * Error);
+    }
+}
+
+/*
+ * 该函数的主要功能：以processAggregatedLine能读取的格式写出聚合后的跳转和fall-through trace，
+ * 只保存地址和计数，不需要可执行文件，可以在生产机器上生成后代替原始的perf.data传输
+ * */
+bool writeAggregatedProfile(const BranchTraceTable *Branches, const BranchTraceTable *Fallthroughs, const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        return false;
+    }
+    size_t NumBranches, NumFallthroughs;
+    BranchTraceSlot *SortedBranches = sortBranchTraces(Branches, &NumBranches);
+    BranchTraceSlot *SortedFallthroughs = sortBranchTraces(Fallthroughs, &NumFallthroughs);
+    if (!SortedBranches || !SortedFallthroughs) {
+        free(SortedBranches);
+        free(SortedFallthroughs);
+        fclose(file);
+        return false;
+    }
+    for (size_t i = 0; i < NumBranches; ++i) {
+        fprintf(file, "B %" PRIx64 " %" PRIx64 " %" PRIu64 " %" PRIu64 "\n", SortedBranches[i].Key >> 32,
+                SortedBranches[i].Key & UINT32_MAX, SortedBranches[i].TakenCount, SortedBranches[i].MispredCount);
+    }
+    for (size_t i = 0; i < NumFallthroughs; ++i) {
+        uint64_t Start = SortedFallthroughs[i].Key >> 32;
+        uint64_t End = SortedFallthroughs[i].Key & UINT32_MAX;
+        if (SortedFallthroughs[i].TakenCount) {
+            fprintf(file, "F %" PRIx64 " %" PRIx64 " %" PRIu64 "\n", Start, End, SortedFallthroughs[i].TakenCount);
+        }
+        if (SortedFallthroughs[i].MispredCount) {
+            fprintf(file, "f %" PRIx64 " %" PRIx64 " %" PRIu64 "\n", Start, End, SortedFallthroughs[i].MispredCount);
+        }
+    }
+    free(SortedBranches);
+    free(SortedFallthroughs);
+    return fclose(file) == 0;
+}
+
+/*
+ * 该函数的主要功能：写出访存profile，每行的格式与perf.fdata类似：
+ * "code_id code_func code_offset data_id data_symbol data_offset loads stores"
+ * 数据地址为桶的起始地址，在可执行文件中时用所在的数据对象或者节（.data/.bss/.rodata等）加偏移表示，
+ * 否则data_id为0，data_symbol为[anon]或[kernel]，data_offset为桶的绝对地址；按(代码地址, 数据地址)排序输出
+ * */
+bool writeMemProfile(const MemAccessTable *table, const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        return false;
+    }
+    MemAccessSlot *Sorted = (MemAccessSlot *)malloc((table->Size + 1) * sizeof(MemAccessSlot));
+    if (!Sorted) {
+        fclose(file);
+        return false;
+    }
+    size_t Count = 0;
+    for (size_t i = 0; i < table->Capacity; ++i) {
+        if (table->Slots[i].IP != UINT64_MAX) {
+            Sorted[Count++] = table->Slots[i];
+        }
+    }
+    qsort(Sorted, Count, sizeof(MemAccessSlot), compareMemAccessSlot);
+
+    for (size_t i = 0; i < Count; ++i) {
+        const BinaryFunction *Function = Sorted[i].IP ? DA_getBinaryFunctionContainingAddress(Sorted[i].IP) : NULL;
+        uint64_t DataAddress = (Sorted[i].Bucket & ~EXTERNAL_BUCKET) << MEM_BUCKET_BITS;
+        const char *DataName = DataAddress >= KernelBaseAddr ? "[kernel]" : "[anon]";
+        uint64_t DataOffset = DataAddress;
+        bool DataKnown = false;
+        if (!(Sorted[i].Bucket & EXTERNAL_BUCKET)) {
+            const BinaryFunction *Object = findDataObject(&DataObjects, DataAddress, 1ULL << MEM_BUCKET_BITS);
+            const Elf64_Shdr *Section = (!Object && BinaryElf.Data) ? findElfSection(&BinaryElf, DataAddress) : NULL;
+            if (Object) {
+                // 对象从桶的中间开始时偏移记为0
+                DataName = Object->Name;
+                DataOffset = DataAddress > Object->Address ? DataAddress - Object->Address : 0;
+                DataKnown = true;
+            } else if (Section) {
+                DataName = getElfSectionName(&BinaryElf, Section);
+                DataOffset = DataAddress - Section->sh_addr;
+                DataKnown = true;
+            } else {
+                DataName = "[unknown]";
+            }
+        }
+        fprintf(file, "%d %s %" PRIX64 " %d %s %" PRIX64 " %" PRIu64 " %" PRIu64 "\n",
+                Function != NULL, Function ? Function->Name : "[unknown]", Function ? Sorted[i].IP - Function->Address : 0,
+                DataKnown, DataName, DataOffset, Sorted[i].Loads, Sorted[i].Stores);
+    }
+    free(Sorted);
+    fclose(file);
+    return true;
+}
+
+/*
+ * 该函数的主要功能：把一个无符号整数按LEB128变长编码追加到Buffer中，每个字节低7位为数据，最高位表示后面还有字节
+ * */
+bool appendVarint(uint8_t **Buffer, size_t *Size, size_t *Capacity, uint64_t Value) {
+    if (*Size + 10 > *Capacity) {
+        size_t NewCapacity = *Capacity ? *Capacity * 2 : 4096;
+        uint8_t *NewBuffer = (uint8_t *)realloc(*Buffer, NewCapacity);
+        if (!NewBuffer) {
+            return false;
+        }
+        *Buffer = NewBuffer;
+        *Capacity = NewCapacity;
+    }
+    while (Value >= 0x80) {
+        (*Buffer)[(*Size)++] = (uint8_t)(Value | 0x80);
+        Value >>= 7;
+    }
+    (*Buffer)[(*Size)++] = (uint8_t)Value;
+    return true;
+}
+
+/*
+ * 该函数的主要功能：读取一个LEB128变长整数，越界或者超过64位时返回false
+ * */
+static inline bool readVarint(const uint8_t **ptr, const uint8_t *end, uint64_t *Value) {
+    uint64_t Result = 0;
+    for (unsigned Shift = 0; *ptr < end && Shift < 64; Shift += 7) {
+        uint8_t Byte = *(*ptr)++;
+        Result |= (uint64_t)(Byte & 0x7f) << Shift;
+        if (!(Byte & 0x80)) {
+            *Value = Result;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * 该函数的主要功能：写出二进制格式的profile
+ * 函数名只在字符串表中出现一次，边按(From, To)排序，每条边依次编码为：
+ * 源函数编号与上一条边的差值、源偏移（与上一条边同一源函数时为差值）、目标函数编号、目标偏移、mispred、count
+ * 函数编号按地址顺序分配，编号0为[unknown]，所以源函数编号的差值不会是负数
+ * */
+bool writeBinaryProfile(const BranchTraceTable *table, const uint8_t *BuildId, size_t BuildIdSize, const char *filename) {
+    size_t Count;
+    BranchTraceSlot *Sorted = sortBranchTraces(table, &Count);
+    uint32_t *FunctionIds = (uint32_t *)calloc(BinaryFunctions.NumFunctions + 1, sizeof(uint32_t));
+    if (!Sorted || !FunctionIds) {
+        free(Sorted);
+        free(FunctionIds);
+        return false;
+    }
+
+    BinaryProfileHeader Header;
+    memset(&Header, 0, sizeof(Header));
+    memcpy(Header.Magic, BINARY_PROFILE_MAGIC, sizeof(Header.Magic));
+    Header.Version = BINARY_PROFILE_VERSION;
+    Header.BuildIdSize = BuildIdSize < sizeof(Header.BuildId) ? BuildIdSize : sizeof(Header.BuildId);
+    memcpy(Header.BuildId, BuildId, Header.BuildIdSize);
+    Header.NumEdges = Count;
+
+    // 先标记用到的函数，再按地址顺序编号
+    for (size_t i = 0; i < Count; ++i) {
+        uint64_t From = Sorted[i].Key >> 32;
+        uint64_t To = Sorted[i].Key & UINT32_MAX;
+        const BinaryFunction *FromFunc = From ? DA_getBinaryFunctionContainingAddress(From) : NULL;
+        const BinaryFunction *ToFunc = To ? DA_getBinaryFunctionContainingAddress(To) : NULL;
+        if (FromFunc) FunctionIds[FromFunc - BinaryFunctions.Functions] = 1;
+        if (ToFunc) FunctionIds[ToFunc - BinaryFunctions.Functions] = 1;
+        Header.TotalCount += Sorted[i].TakenCount;
+        Header.TotalMispred += Sorted[i].MispredCount;
+    }
+    uint64_t NamesSize = strlen("[unknown]") + 1;
+    Header.NumFunctions = 1;
+    for (size_t i = 0; i < BinaryFunctions.NumFunctions; ++i) {
+        if (FunctionIds[i]) {
+            FunctionIds[i] = Header.NumFunctions++;
+            NamesSize += strlen(BinaryFunctions.Functions[i].Name) + 1;
+        }
+    }
+
+    uint8_t *Edges = NULL;
+    size_t EdgesSize = 0;
+    size_t EdgesCapacity = 0;
+    uint64_t PrevFromId = 0;
+    uint64_t PrevFromOffset = 0;
+    bool Ok = true;
+    for (size_t i = 0; i < Count && Ok; ++i) {
+        uint64_t From = Sorted[i].Key >> 32;
+        uint64_t To = Sorted[i].Key & UINT32_MAX;
+        const BinaryFunction *FromFunc = From ? DA_getBinaryFunctionContainingAddress(From) : NULL;
+        const BinaryFunction *ToFunc = To ? DA_getBinaryFunctionContainingAddress(To) : NULL;
+        uint64_t FromId = FromFunc ? FunctionIds[FromFunc - BinaryFunctions.Functions] : 0;
+        uint64_t FromOffset = FromFunc ? From - FromFunc->Address : 0;
+        Ok = appendVarint(&Edges, &EdgesSize, &EdgesCapacity, FromId - PrevFromId) &&
+             appendVarint(&Edges, &EdgesSize, &EdgesCapacity,
+                          FromId == PrevFromId && i > 0 ? FromOffset - PrevFromOffset : FromOffset) &&
+             appendVarint(&Edges, &EdgesSize, &EdgesCapacity, ToFunc ? FunctionIds[ToFunc - BinaryFunctions.Functions] : 0) &&
+             appendVarint(&Edges, &EdgesSize, &EdgesCapacity, ToFunc ? To - ToFunc->Address : 0) &&
+             appendVarint(&Edges, &EdgesSize, &EdgesCapacity, Sorted[i].MispredCount) &&
+             appendVarint(&Edges, &EdgesSize, &EdgesCapacity, Sorted[i].TakenCount);
+        PrevFromId = FromId;
+        PrevFromOffset = FromOffset;
+    }
+
+    // 文件布局：头部、NameOffsets[NumFunctions + 1]、以'\0'结尾的函数名、边
+    Header.StringTableOffset = sizeof(Header);
+    Header.StringTableSize = (Header.NumFunctions + 1) * sizeof(uint32_t) + NamesSize;
+    Header.EdgesOffset = Header.StringTableOffset + Header.StringTableSize;
+    Header.EdgesSize = EdgesSize;
+    FILE *file = Ok && NamesSize < UINT32_MAX ? fopen(filename, "wb") : NULL;
+    if (file) {
+        Ok = fwrite(&Header, sizeof(Header), 1, file) == 1;
+        uint32_t NameOffset = 0;
+        Ok = Ok && fwrite(&NameOffset, sizeof(NameOffset), 1, file) == 1;
+        NameOffset += strlen("[unknown]") + 1;
+        for (size_t i = 0; i < BinaryFunctions.NumFunctions && Ok; ++i) {
+            if (FunctionIds[i]) {
+                Ok = fwrite(&NameOffset, sizeof(NameOffset), 1, file) == 1;
+                NameOffset += strlen(BinaryFunctions.Functions[i].Name) + 1;
+            }
+        }
+        Ok = Ok && fwrite(&NameOffset, sizeof(NameOffset), 1, file) == 1;
+        Ok = Ok && fwrite("[unknown]", strlen("[unknown]") + 1, 1, file) == 1;
+        for (size_t i = 0; i < BinaryFunctions.NumFunctions && Ok; ++i) {
+            if (FunctionIds[i]) {
+                const char *Name = BinaryFunctions.Functions[i].Name;
+                Ok = fwrite(Name, strlen(Name) + 1, 1, file) == 1;
+            }
+        }
+        Ok = Ok && (EdgesSize == 0 || fwrite(Edges, EdgesSize, 1, file) == 1);
+        Ok = (fclose(file) == 0) && Ok;
+    } else {
+        Ok = false;
+    }
+    free(Edges);
+    free(FunctionIds);
+    free(Sorted);
+    return Ok;
+}
+
+void closeBinaryProfile(BinaryProfile *profile) {
+    if (profile->Data) {
+        munmap((void *)profile->Data, profile->Size);
+    }
+    memset(profile, 0, sizeof(*profile));
+}
+
+/*
+ * 该函数的主要功能：用一次mmap加载二进制profile，检查头部以及字符串表和边的范围，之后所有访问都直接读映射区域
+ * */
+bool openBinaryProfile(BinaryProfile *profile, const char *filename) {
+    memset(profile, 0, sizeof(*profile));
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BinaryProfileHeader)) {
+        if (fd != -1) close(fd);
+        return false;
+    }
+    void *Data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (Data == MAP_FAILED) {
+        return false;
+    }
+    profile->Data = (const uint8_t *)Data;
+    profile->Size = st.st_size;
+    profile->Header = (const BinaryProfileHeader *)Data;
+
+    const BinaryProfileHeader *Header = profile->Header;
+    uint64_t OffsetsSize = (Header->NumFunctions + 1) * sizeof(uint32_t);
+    if (memcmp(Header->Magic, BINARY_PROFILE_MAGIC, sizeof(Header->Magic)) != 0 ||
+        Header->Version != BINARY_PROFILE_VERSION || Header->NumFunctions == 0 ||
+        Header->NumFunctions > Header->StringTableSize / sizeof(uint32_t) ||
+        Header->StringTableOffset != sizeof(BinaryProfileHeader) || OffsetsSize > Header->StringTableSize ||
+        Header->StringTableOffset + Header->StringTableSize > profile->Size ||
+        Header->EdgesOffset < Header->StringTableOffset + Header->StringTableSize ||
+        Header->EdgesOffset > profile->Size || Header->EdgesSize > profile->Size - Header->EdgesOffset) {
+        closeBinaryProfile(profile);
+        return false;
+    }
+    profile->NameOffsets = (const uint32_t *)(profile->Data + Header->StringTableOffset);
+    profile->Names = (const char *)(profile->Data + Header->StringTableOffset + OffsetsSize);
+    uint64_t NamesSize = Header->StringTableSize - OffsetsSize;
+    if (NamesSize == 0 || profile->Names[NamesSize - 1] != '\0' ||
+        profile->NameOffsets[Header->NumFunctions] != NamesSize) {
+        closeBinaryProfile(profile);
+        return false;
+    }
+    for (uint64_t i = 0; i < Header->NumFunctions; ++i) {
+        if (profile->NameOffsets[i] >= NamesSize) {
+            closeBinaryProfile(profile);
+            return false;
+        }
+    }
+    return true;
+}
+
+void initBinaryProfileCursor(const BinaryProfile *profile, BinaryProfileCursor *cursor) {
+    memset(cursor, 0, sizeof(*cursor));
+    cursor->Ptr = profile->Data + profile->Header->EdgesOffset;
+    cursor->End = cursor->Ptr + profile->Header->EdgesSize;
+}
+
+/*
+ * 该函数的主要功能：解码下一条边，读完或者数据损坏时返回false
+ * */
+bool nextBinaryProfileEdge(const BinaryProfile *profile, BinaryProfileCursor *cursor, ProfileEdge *edge) {
+    uint64_t FromIdDelta, Offset, ToId;
+    if (cursor->Ptr >= cursor->End ||
+        !readVarint(&cursor->Ptr, cursor->End, &FromIdDelta) || !readVarint(&cursor->Ptr, cursor->End, &Offset) ||
+        !readVarint(&cursor->Ptr, cursor->End, &ToId) || !readVarint(&cursor->Ptr, cursor->End, &edge->ToOffset) ||
+        !readVarint(&cursor->Ptr, cursor->End, &edge->Mispred) || !readVarint(&cursor->Ptr, cursor->End, &edge->Count)) {
+        return false;
+    }
+    cursor->FromOffset = (FromIdDelta == 0 && cursor->NumEdges > 0) ? cursor->FromOffset + Offset : Offset;
+    cursor->FromId += FromIdDelta;
+    if (cursor->FromId >= profile->Header->NumFunctions || ToId >= profile->Header->NumFunctions) {
+        return false;
+    }
+    edge->FromKnown = cursor->FromId != 0;
+    edge->FromName = profile->Names + profile->NameOffsets[cursor->FromId];
+    edge->FromOffset = cursor->FromOffset;
+    edge->ToKnown = ToId != 0;
+    edge->ToName = profile->Names + profile->NameOffsets[ToId];
+    ++cursor->NumEdges;
+    return true;
+}
+
+void writeProfileEdge(FILE *file, const ProfileEdge *edge) {
+    fprintf(file, "%d %s %" PRIX64 " %d %s %" PRIX64 " %" PRIu64 " %" PRIu64 "\n",
+            edge->FromKnown, edge->FromName, edge->FromOffset, edge->ToKnown, edge->ToName, edge->ToOffset,
+            edge->Mispred, edge->Count);
+}
+
+/*
+ * 该函数的主要功能：把二进制profile转换回文本格式的perf.fdata，输出与writeBranchProfile完全相同
+ * */
+int convertBinaryProfile(const char *filename, const char *output) {
+    BinaryProfile profile;
+    if (!openBinaryProfile(&profile, filename)) {
+        fprintf(stderr, "Error reading binary profile: %s\n", filename);
+        return 1;
+    }
+    FILE *file = fopen(output, "w");
+    if (!file) {
+        perror("Error opening output file");
+        closeBinaryProfile(&profile);
+        return 1;
+    }
+    BinaryProfileCursor cursor;
+    ProfileEdge edge;
+    initBinaryProfileCursor(&profile, &cursor);
+    while (nextBinaryProfileEdge(&profile, &cursor, &edge)) {
+        writeProfileEdge(file, &edge);
+    }
+    fclose(file);
+
+    const BinaryProfileHeader *Header = profile.Header;
+    printf("Build ID: ");
+    for (uint32_t i = 0; i < Header->BuildIdSize && i < sizeof(Header->BuildId); ++i) {
+        printf("%02x", Header->BuildId[i]);
+    }
+    printf("\nFunctions: %" PRIu64 "  Edges: %" PRIu64 "  Total Count: %" PRIu64 "  Total Mispred: %" PRIu64 "\n",
+           Header->NumFunctions - 1, Header->NumEdges, Header->TotalCount, Header->TotalMispred);
+    bool Complete = cursor.NumEdges == Header->NumEdges;
+    if (!Complete) {
+        fprintf(stderr, "Error: corrupted binary profile, %" PRIu64 " of %" PRIu64 " edges decoded\n",
+                cursor.NumEdges, Header->NumEdges);
+    }
+    closeBinaryProfile(&profile);
+    return Complete ? 0 : 1;
+}
+
+int compareProfileEdge(const ProfileEdge *A, const ProfileEdge *B) {
+    int Result = strcmp(A->FromName, B->FromName);
+    if (Result != 0) return Result;
+    if (A->FromOffset != B->FromOffset) return A->FromOffset < B->FromOffset ? -1 : 1;
+    Result = strcmp(A->ToName, B->ToName);
+    if (Result != 0) return Result;
+    if (A->ToOffset != B->ToOffset) return A->ToOffset < B->ToOffset ? -1 : 1;
+    if (A->FromKnown != B->FromKnown) return A->FromKnown < B->FromKnown ? -1 : 1;
+    return A->ToKnown < B->ToKnown ? -1 : (A->ToKnown > B->ToKnown);
+}
+
+int compareProfileEdgeQsort(const void *a, const void *b) {
+    return compareProfileEdge((const ProfileEdge *)a, (const ProfileEdge *)b);
+}
+
+bool pushProfileEdge(ProfileInput *input, size_t *Capacity, const ProfileEdge *edge) {
+    if (input->NumEdges == *Capacity) {
+        size_t NewCapacity = *Capacity ? *Capacity * 2 : 4096;
+        ProfileEdge *NewEdges = (ProfileEdge *)realloc(input->Edges, NewCapacity * sizeof(ProfileEdge));
+        if (!NewEdges) {
+            return false;
+        }
+        input->Edges = NewEdges;
+        *Capacity = NewCapacity;
+    }
+    input->Edges[input->NumEdges++] = *edge;
+    return true;
+}
+
+/*
+ * 该函数的主要功能：解析文本perf.fdata中的一行，函数名拷贝到输入自己的arena中
+ * */
+bool parseProfileEdge(const char *line, size_t len, Arena *Names, ProfileEdge *edge) {
+    const char *ptr = line;
+    const char *end = line + len;
+    const char *Field[8];
+    size_t FieldLen[8];
+    uint64_t FromKnown, ToKnown;
+    for (int i = 0; i < 8; ++i) {
+        if (!nextField(&ptr, end, ' ', &Field[i], &FieldLen[i])) {
+            return false;
+        }
+    }
+    if (!parseDecView(Field[0], FieldLen[0], &FromKnown) || !parseHexView(Field[2], FieldLen[2], &edge->FromOffset) ||
+        !parseDecView(Field[3], FieldLen[3], &ToKnown) || !parseHexView(Field[5], FieldLen[5], &edge->ToOffset) ||
+        !parseDecView(Field[6], FieldLen[6], &edge->Mispred) || !parseDecView(Field[7], FieldLen[7], &edge->Count)) {
+        return false;
+    }
+    edge->FromKnown = FromKnown != 0;
+    edge->ToKnown = ToKnown != 0;
+    edge->FromName = arenaStrndup(Names, Field[1], FieldLen[1]);
+    edge->ToName = arenaStrndup(Names, Field[4], FieldLen[4]);
+    return edge->FromName && edge->ToName;
+}
+
+/*
+ * 该函数的主要功能：读取一个--merge输入的全部边并排序，perf.bfdata直接从映射区域解码，其他文件按文本perf.fdata解析
+ * */
+void loadProfileInput(ProfileInput *input) {
+    size_t Capacity = 0;
+    ProfileEdge edge;
+    if (openBinaryProfile(&input->Binary, input->Filename)) {
+        BinaryProfileCursor cursor;
+        initBinaryProfileCursor(&input->Binary, &cursor);
+        while (nextBinaryProfileEdge(&input->Binary, &cursor, &edge)) {
+            if (!pushProfileEdge(input, &Capacity, &edge)) {
+                input->Failed = true;
+                return;
+            }
+        }
+        input->Failed = cursor.NumEdges != input->Binary.Header->NumEdges;
+    } else {
+        LineScanner scanner;
+        if (!openLineScanner(&scanner, input->Filename)) {
+            input->Failed = true;
+            return;
+        }
+        LineView line;
+        while (nextLine(&scanner, &line)) {
+            if (line.Len == 0) {
+                continue;
+            }
+            if (!parseProfileEdge(line.Data, line.Len, &input->Names, &edge) || !pushProfileEdge(input, &Capacity, &edge)) {
+                input->Failed = true;
+                break;
+            }
+        }
+        closeLineScanner(&scanner);
+    }
+    qsort(input->Edges, input->NumEdges, sizeof(ProfileEdge), compareProfileEdgeQsort);
+}
+
+typedef struct {
+    ProfileInput *Inputs;
+    size_t NumInputs;
+    size_t NextInput;  // 下一个待读取的输入，各线程用原子操作领取
+} ProfileLoader;
+
+void *loadProfileInputs(void *arg) {
+    ProfileLoader *loader = (ProfileLoader *)arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&loader->NextInput, 1, __ATOMIC_RELAXED);
+        if (i >= loader->NumInputs) {
+            return NULL;
+        }
+        loadProfileInput(&loader->Inputs[i]);
+    }
+}
+
+/*
+ * 该函数的主要功能：k路归并时的小顶堆，堆中保存输入的下标，按各输入当前的边比较
+ * */
+static inline bool profileInputLess(const ProfileInput *Inputs, size_t a, size_t b) {
+    return compareProfileEdge(&Inputs[a].Edges[Inputs[a].Next], &Inputs[b].Edges[Inputs[b].Next]) < 0;
+}
+
+void siftDownProfileHeap(const ProfileInput *Inputs, size_t *Heap, size_t HeapSize, size_t i) {
+    for (;;) {
+        size_t Smallest = i;
+        size_t Left = 2 * i + 1;
+        size_t Right = Left + 1;
+        if (Left < HeapSize && profileInputLess(Inputs, Heap[Left], Heap[Smallest])) Smallest = Left;
+        if (Right < HeapSize && profileInputLess(Inputs, Heap[Right], Heap[Smallest])) Smallest = Right;
+        if (Smallest == i) {
+            return;
+        }
+        size_t Tmp = Heap[i];
+        Heap[i] = Heap[Smallest];
+        Heap[Smallest] = Tmp;
+        i = Smallest;
+    }
+}
+
+/*
+ * 该函数的主要功能：合并多个profile，参数为"文件[:权重]"，权重默认为1
+ * 各输入由最多NumThreads个线程并行读取和排序，然后k路归并，相同的边计数按权重加权求和后四舍五入，结果写入output
+ * */
+int mergeProfiles(char **Args, int NumArgs, int NumThreads, const char *output) {
+    ProfileInput *Inputs = (ProfileInput *)calloc(NumArgs, sizeof(ProfileInput));
+    size_t *Heap = (size_t *)calloc(NumArgs, sizeof(size_t));
+    if (!Inputs || !Heap) {
+        fprintf(stderr, "Error allocating memory for profiles\n");
+        free(Inputs);
+        free(Heap);
+        return 1;
+    }
+    for (int i = 0; i < NumArgs; ++i) {
+        Inputs[i].Filename = Args[i];
+        Inputs[i].Weight = 1.0;
+        char *Colon = strrchr(Args[i], ':');
+        if (Colon) {
+            char *WeightEnd;
+            double Weight = strtod(Colon + 1, &WeightEnd);
+            if (WeightEnd != Colon + 1 && *WeightEnd == '\0' && Weight >= 0) {
+                *Colon = '\0';
+                Inputs[i].Weight = Weight;
+            }
+        }
+    }
+
+    ProfileLoader loader = {Inputs, NumArgs, 0};
+    pthread_t Threads[MAX_PARSE_THREADS];
+    int NumStarted = 0;
+    if (NumThreads > NumArgs) {
+        NumThreads = NumArgs;
+    }
+    if (NumThreads > MAX_PARSE_THREADS) {
+        NumThreads = MAX_PARSE_THREADS;
+    }
+    for (; NumStarted < NumThreads - 1; ++NumStarted) {
+        if (pthread_create(&Threads[NumStarted], NULL, loadProfileInputs, &loader) != 0) {
+            break;
+        }
+    }
+    loadProfileInputs(&loader);
+    for (int i = 0; i < NumStarted; ++i) {
+        pthread_join(Threads[i], NULL);
+    }
+
+    int Result = 0;
+    size_t HeapSize = 0;
+    for (int i = 0; i < NumArgs; ++i) {
+        if (Inputs[i].Failed) {
+            fprintf(stderr, "Error reading profile: %s\n", Inputs[i].Filename);
+            Result = 1;
+        }
+        if (Inputs[i].NumEdges > 0) {
+            Heap[HeapSize++] = i;
+        }
+    }
+    FILE *file = Result == 0 ? fopen(output, "w") : NULL;
+    if (Result == 0 && !file) {
+        perror("Error opening output file");
+        Result = 1;
+    }
+
+    uint64_t NumMerged = 0;
+    if (file) {
+        for (size_t i = HeapSize; i-- > 0;) {
+            siftDownProfileHeap(Inputs, Heap, HeapSize, i);
+        }
+        while (HeapSize > 0) {
+            ProfileEdge Merged = Inputs[Heap[0]].Edges[Inputs[Heap[0]].Next];
+            double Count = 0;
+            double Mispred = 0;
+            // 取出所有与堆顶相同的边，包括同一个输入中重复的行
+            while (HeapSize > 0 && compareProfileEdge(&Inputs[Heap[0]].Edges[Inputs[Heap[0]].Next], &Merged) == 0) {
+                ProfileInput *input = &Inputs[Heap[0]];
+                Count += input->Edges[input->Next].Count * input->Weight;
+                Mispred += input->Edges[input->Next].Mispred * input->Weight;
+                if (++input->Next == input->NumEdges) {
+                    Heap[0] = Heap[--HeapSize];
+                }
+                siftDownProfileHeap(Inputs, Heap, HeapSize, 0);
+            }
+            Merged.Count = (uint64_t)(Count + 0.5);
+            Merged.Mispred = (uint64_t)(Mispred + 0.5);
+            if (Merged.Count > 0 || Merged.Mispred > 0) {
+                writeProfileEdge(file, &Merged);
+                ++NumMerged;
+            }
+        }
+        fclose(file);
+        for (int i = 0; i < NumArgs; ++i) {
+            printf("%s: %zu edges, weight %g\n", Inputs[i].Filename, Inputs[i].NumEdges, Inputs[i].Weight);
+        }
+        printf("Merged %d profiles into %s: %" PRIu64 " edges\n", NumArgs, output, NumMerged);
+    }
+
+    for (int i = 0; i < NumArgs; ++i) {
+        free(Inputs[i].Edges);
+        arenaDestroy(&Inputs[i].Names);
+        closeBinaryProfile(&Inputs[i].Binary);
+    }
+    free(Inputs);
+    free(Heap);
+    return Result;
+}
+
+/*
+ * 该函数的主要功能：对应BOLT中DataAggregator::getFallthroughsInTrace，把一条fall-through trace展开为
+ * 途经的每个基本块到下一个块的边（块中最后一条指令的偏移 -> 下一个块的起始偏移），途中某个块不能顺序执行时整条trace无效
+ * */
+bool recordFallthroughTrace(const BinaryFunction *Function, const FunctionCFG *cfg, uint64_t TraceFrom, uint64_t TraceTo,
+                            uint64_t Count, BranchTraceTable *table, uint64_t *NumEdges) {
+    if (TraceFrom < Function->Address || TraceTo < TraceFrom || TraceTo - Function->Address >= Function->Size) {
+        return false;
+    }
+    uint32_t FromBB = findBlockContainingOffset(cfg, TraceFrom - Function->Address);
+    uint32_t ToBB = findBlockContainingOffset(cfg, TraceTo - Function->Address);
+    for (uint32_t BB = FromBB; BB < ToBB; ++BB) {
+        if (!cfg->FallsThrough[BB]) {
+            return false;
+        }
+    }
+    for (uint32_t BB = FromBB; BB < ToBB; ++BB) {
+        uint64_t From = Function->Address + cfg->LastInstr[BB];
+        uint64_t To = Function->Address + cfg->BlockStart[BB + 1];
+        if (!addBranchTraceCounts(table, (From << 32) | To, Count, 0)) {
+            return false;
+        }
+        ++*NumEdges;
+    }
+    return true;
+}
+
+/*
+ * 该函数的主要功能：对应BOLT中processBranchEvents处理FallthroughLBRs的部分，InternCount和ExternCount都计入，
+ * 得到的块间fall-through边与分支trace合并到同一个表中，写perf.fdata时与跳转一样按"函数 偏移"输出，mispred为0
+ * */
+void addFallthroughEdges(const BranchTraceTable *Fallthroughs, BranchTraceTable *table) {
+    uint64_t NumEdges = 0;
+    uint64_t NumMismatched = 0;
+    uint64_t NumUndecodable = 0;
+    BinaryCFGs = (FunctionCFG *)calloc(BinaryFunctions.NumFunctions, sizeof(FunctionCFG));
+    if (!BinaryCFGs) {
+        fprintf(logFile, "Error allocating memory for basic blocks\n");
+        return;
+    }
+    for (size_t i = 0; i < Fallthroughs->Capacity; ++i) {
+        const BranchTraceSlot *Slot = &Fallthroughs->Slots[i];
+        if (Slot->Key == EMPTY_TRACE_KEY) {
+            continue;
+        }
+        uint64_t TraceFrom = Slot->Key >> 32;
+        uint64_t TraceTo = Slot->Key & UINT32_MAX;
+        const BinaryFunction *Function = DA_getBinaryFunctionContainingAddress(TraceFrom);
+        if (!Function) {
+            continue;
+        }
+        FunctionCFG *cfg = &BinaryCFGs[Function - BinaryFunctions.Functions];
+        if (!cfg->Built && !buildFunctionCFG(&BinaryElf, Function, cfg, &CFGArena)) {
+            ++NumUndecodable;
+        }
+        if (cfg->NumBlocks == 0 ||
+            !recordFallthroughTrace(Function, cfg, TraceFrom, TraceTo, Slot->TakenCount + Slot->MispredCount, table, &NumEdges)) {
+            ++NumMismatched;
+        }
+    }
+    fprintf(logFile, "Fall-through Edges: %" PRIu64 "\n", NumEdges);
+    fprintf(logFile, "Fall-through Traces mismatching disassembly: %" PRIu64 "\n", NumMismatched);
+    fprintf(logFile, "Functions failed to disassemble: %" PRIu64 "\n", NumUndecodable);
+}
+
+/*
+ * 该函数的主要功能：判断PC是否位于函数内，与BOLT中BinaryFunction::containsAddress一致，不使用对齐后的大小
+ * */
+static inline bool functionContainsAddress(const BinaryFunction *Function, uint64_t PC) {
+    return Function->Address <= PC && PC < Function->Address + Function->Size;
+}
+
+/*
+ * 该函数主要功能：解析LBR信息的函数
+ * LBR按从新到旧的顺序排列，第i项的to到第i-1项的from之间是顺序执行的一段指令（fall-through trace）：
+ * 起点和终点在同一个函数中时记录到FallthroughLBRs，第i项的from也在该函数中时记为InternCount，否则为ExternCount
+ * */
+uint64_t parseLBRSample(const PerfBranchSample *sample, bool needsSkylakeFix, BranchWorker *worker) {
+    uint64_t numTraces = 0;
+    uint64_t NextPC = 0;
+    const BinaryFunction *NextFunc = NULL;  // 上一项from所在的函数，也就是trace终点所在的函数
+    const AddressIndex *Index = getWorkerAddressIndex(worker, sample->PID);
+    uint32_t NumEntry = 0;
+    for (uint32_t i = 0; i < sample->LBRCount; ++i) {
+        ++NumEntry;
+        if (needsSkylakeFix && NumEntry <= 2){
+            continue;
+        }
+        if ((sample->SkipMask >> i) & 1) {
+            // 两端都不在可执行文件中：没有跳转可记，以它为端点的trace也都不在同一个函数中
+            if (NextPC) {
+                ++worker->NumLongRangeTraces;
+                ++numTraces;
+            }
+            NextPC = Index ? UINT64_MAX : sample->From[i];
+            NextFunc = NULL;
+            continue;
+        }
+        const uint64_t LBRFrom = adjustAddress(Index, sample->From[i]);
+        const uint64_t LBRTo = adjustAddress(Index, sample->To[i]);
+        // 每一项只查找两次函数，trace的起点和终点复用本项的to和上一项的from的结果
+        const BinaryFunction *FromFunc = DA_getBinaryFunctionContainingAddress(LBRFrom);
+        const BinaryFunction *ToFunc = DA_getBinaryFunctionContainingAddress(LBRTo);
+        if (NextPC){
+            const uint64_t TraceFrom = LBRTo;
+            const uint64_t TraceTo = NextPC;
+            const BinaryFunction *TraceBF = ToFunc;
+            if (TraceBF && functionContainsAddress(TraceBF, TraceTo)) {
+                bool Intern = functionContainsAddress(TraceBF, LBRFrom);
+                if (TraceFrom < UINT32_MAX && TraceTo < UINT32_MAX) {
+                    addBranchTraceCounts(&worker->Fallthroughs, (TraceFrom << 32) | TraceTo, Intern, !Intern);
+                } else {
+                    ++worker->Fallthroughs.NumOverflow;
+                }
+            } else if (TraceBF && NextFunc) {
+                ++worker->NumInvalidTraces;
+            } else {
+                ++worker->NumLongRangeTraces;
+            }
+            ++numTraces;
+        }
+        NextPC = LBRFrom;
+        NextFunc = FromFunc;
+        uint64_t From = FromFunc ? LBRFrom : 0;
+        uint64_t To = ToFunc ? LBRTo : 0;
+        if (!From && !To) {
+            continue;
+        }
+        addBranchTrace(&worker->Traces, From, To, 1, (sample->MispredMask >> i) & 1);
+    }
+    return numTraces;
+}
+
 /*
- * 该结构体的功能：保存二进制文件相关信息
+ * 该函数的主要功能：返回解析线程中Dso的trace表，第一次用到时分配，内存不足时返回NULL
  * */
-typedef struct {
-    uint64_t FirstAllocAddress;
-    uint64_t LayoutStartAddress;
-} BinaryLayout;
+static inline DsoTraceTables *getDsoTraces(BranchWorker *worker, uint32_t Dso) {
+    DsoTraceTables *Tables = &worker->DsoTraces[Dso];
+    if (!Tables->Traces.Slots) {
+        if (!initBranchTraceTable(&Tables->Traces, INITIAL_TRACE_TABLE_SIZE) ||
+            !initBranchTraceTable(&Tables->Fallthroughs, INITIAL_TRACE_TABLE_SIZE)) {
+            freeBranchTraceTable(&Tables->Traces);
+            freeBranchTraceTable(&Tables->Fallthroughs);
+            worker->Failed = true;
+            return NULL;
+        }
+    }
+    return Tables;
+}
+
+/*
+ * 该函数主要功能：--all-dsos时解析LBR信息，流程与parseLBRSample相同，区别在于每个地址先按PID转换成(DSO, DSO中的地址)，
+ * 函数在各自DSO的符号表中查找，trace记到所在DSO的表中；fall-through的两端必须在同一个DSO中，
+ * 跨DSO的跳转在两边各记一次，另一端记为0（外部），与分别为每个DSO转换一次的结果相同
+ * */
+uint64_t parseLBRSampleDsos(const PerfBranchSample *sample, bool needsSkylakeFix, BranchWorker *worker) {
+    uint64_t numTraces = 0;
+    uint64_t NextPC = 0;
+    uint32_t NextDso = UINT32_MAX;
+    const BinaryFunction *NextFunc = NULL;
+    const AddressIndex *Index = getWorkerAddressIndex(worker, sample->PID);
+    uint32_t NumEntry = 0;
+    for (uint32_t i = 0; i < sample->LBRCount; ++i) {
+        ++NumEntry;
+        if (needsSkylakeFix && NumEntry <= 2){
+            continue;
+        }
+        if ((sample->SkipMask >> i) & 1) {
+            if (NextPC) {
+                ++worker->NumLongRangeTraces;
+                ++numTraces;
+            }
+            NextPC = UINT64_MAX;
+            NextDso = UINT32_MAX;
+            NextFunc = NULL;
+            continue;
+        }
+        uint32_t FromDso, ToDso;
+        const uint64_t LBRFrom = translateAddress(Index, sample->From[i], &FromDso);
+        const uint64_t LBRTo = translateAddress(Index, sample->To[i], &ToDso);
+        const BinaryFunction *FromFunc = DA_getDsoFunctionContainingAddress(FromDso, LBRFrom);
+        const BinaryFunction *ToFunc = DA_getDsoFunctionContainingAddress(ToDso, LBRTo);
+        if (NextPC){
+            const uint64_t TraceFrom = LBRTo;
+            const uint64_t TraceTo = NextPC;
+            const BinaryFunction *TraceBF = ToFunc;
+            DsoTraceTables *Tables;
+            if (TraceBF && NextDso == ToDso && functionContainsAddress(TraceBF, TraceTo)) {
+                bool Intern = FromDso == ToDso && functionContainsAddress(TraceBF, LBRFrom);
+                if (!(Tables = getDsoTraces(worker, ToDso))) {
+                    return numTraces;
+                }
+                if (TraceFrom < UINT32_MAX && TraceTo < UINT32_MAX) {
+                    addBranchTraceCounts(&Tables->Fallthroughs, (TraceFrom << 32) | TraceTo, Intern, !Intern);
+                } else {
+                    ++Tables->Fallthroughs.NumOverflow;
+                }
+            } else if (TraceBF && NextFunc) {
+                ++worker->NumInvalidTraces;
+            } else {
+                ++worker->NumLongRangeTraces;
+            }
+            ++numTraces;
+        }
+        NextPC = LBRFrom;
+        NextDso = FromDso;
+        NextFunc = FromFunc;
+        uint64_t Mispred = (sample->MispredMask >> i) & 1;
+        DsoTraceTables *Tables;
+        if (FromFunc && ToFunc && FromDso == ToDso) {
+            if ((Tables = getDsoTraces(worker, FromDso))) {
+                addBranchTrace(&Tables->Traces, LBRFrom, LBRTo, 1, Mispred);
+            }
+            continue;
+        }
+        if (FromFunc && (Tables = getDsoTraces(worker, FromDso))) {
+            addBranchTrace(&Tables->Traces, LBRFrom, 0, 1, Mispred);
+        }
+        if (ToFunc && (Tables = getDsoTraces(worker, ToDso))) {
+            addBranchTrace(&Tables->Traces, 0, LBRTo, 1, Mispred);
+        }
+    }
+    return numTraces;
+}
 
+/*
+ * 该函数的主要功能：解析预聚合输入中的地址，与BOLT一样允许"buildid:"前缀，前缀部分忽略
+ * */
+bool parseAggregatedAddress(const char *str, size_t len, uint64_t *Address) {
+    const char *Colon = memchr(str, ':', len);
+    if (Colon) {
+        len -= Colon + 1 - str;
+        str = Colon + 1;
+    }
+    return parseHexView(str, len, Address);
+}
 
 /*
- * 该函数主要功能，通过readelf -l获取的布局信息
+ * 该函数的主要功能：处理预聚合输入的一行，格式与BOLT的pre-aggregated profile相同，地址为十六进制，已经是可执行文件中的地址：
+ * "B <from> <to> <count> <mispred>"为跳转，"F <start> <end> <count>"为fall-through，
+ * "f <start> <end> <count>"为起点来自函数外部的fall-through（计入ExternCount）
+ * 记录直接进入与parseLBRSample相同的trace表，不再经过逐个sample的循环
  * */
- uint64_t getAddress(){
+void processAggregatedLine(BranchWorker *worker, const char *line, size_t len) {
+    const char *ptr = line;
+    const char *end = line + len;
+    const char *Type, *Field;
+    size_t TypeLen, FieldLen;
+    uint64_t From, To, Count, Mispred = 0;
+    if (!nextField(&ptr, end, ' ', &Type, &TypeLen) || Type[0] == '#') {
+        return;
+    }
+    ++worker->NumTotalSamples;
+    if (TypeLen != 1 || (Type[0] != 'B' && Type[0] != 'F' && Type[0] != 'f') ||
+        !nextField(&ptr, end, ' ', &Field, &FieldLen) || !parseAggregatedAddress(Field, FieldLen, &From) ||
+        !nextField(&ptr, end, ' ', &Field, &FieldLen) || !parseAggregatedAddress(Field, FieldLen, &To) ||
+        !nextField(&ptr, end, ' ', &Field, &FieldLen) || !parseDecView(Field, FieldLen, &Count) ||
+        (Type[0] == 'B' && (!nextField(&ptr, end, ' ', &Field, &FieldLen) || !parseDecView(Field, FieldLen, &Mispred)))) {
+        ++worker->NumMalformedLines;
+        return;
+    }
+    ++worker->NumSamples;
 
- }
+    const BinaryFunction *FromFunc = DA_getBinaryFunctionContainingAddress(From);
+    if (Type[0] == 'B') {
+        ++worker->NumEntries;
+        const BinaryFunction *ToFunc = DA_getBinaryFunctionContainingAddress(To);
+        From = FromFunc ? From : 0;
+        To = ToFunc ? To : 0;
+        if (From || To) {
+            addBranchTrace(&worker->Traces, From, To, Count, Mispred);
+        }
+        return;
+    }
+    ++worker->NumTraces;
+    if (FromFunc && functionContainsAddress(FromFunc, To)) {
+        if (From < UINT32_MAX && To < UINT32_MAX) {
+            addBranchTraceCounts(&worker->Fallthroughs, (From << 32) | To, Type[0] == 'F' ? Count : 0,
+                                 Type[0] == 'f' ? Count : 0);
+        } else {
+            ++worker->Fallthroughs.NumOverflow;
+        }
+    } else if (FromFunc && DA_getBinaryFunctionContainingAddress(To)) {
+        ++worker->NumInvalidTraces;
+    } else {
+        ++worker->NumLongRangeTraces;
+    }
+}
 
 /*
- * 该函数的主要功能：判断地址信息是否在布局信息内
+ * 该函数的主要功能：判断数据地址是否落在可执行文件的某个LOAD段中，地址已经按加载基址调整过
  * */
-bool containsAddress(uint64_t Address) {
-    return Address >= FirstAllocAddress && Address < LayoutStartAddress;
-} 
+bool isBinaryDataAddress(uint64_t Address) {
+    for (size_t i = 0; i < Layout.NumSegments; ++i) {
+        const LoadSegment *Segment = &Layout.Segments[i];
+        if (Address >= Segment->VirtAddr && Address < Segment->VirtAddr + Segment->MemSize) {
+            return true;
+        }
+    }
+    return false;
+}
 
 /*
- * 该函数的主要功能：
- * TODO:
+ * 该函数的主要功能：处理perf_mem.log中的一行"pid event: addr ip"，按(代码地址, 数据地址桶)聚合
+ * 事件名中带有store的计为写，其他计为读；PIE的数据段与代码段使用同一个加载基址
  * */
-uint64_t BC_getBinaryFunctionContainingAddress(uint64_t Address, bool CheckPastEnd, bool UseMaxSize){
+void processMemLine(BranchWorker *worker, const char *line, size_t len) {
+    const char *ptr = line;
+    const char *end = line + len;
+    const char *Field;
+    size_t FieldLen;
+    uint64_t PID, Addr, IP;
+    ++worker->NumTotalSamples;
+    if (!nextField(&ptr, end, ' ', &Field, &FieldLen) || !parseDecView(Field, FieldLen, &PID)) {
+        ++worker->NumMalformedLines;
+        return;
+    }
+    // 事件名本身可能带空格以外的任何字符，以':'结尾
+    const char *Event = ptr;
+    const char *EventEnd = memchr(ptr, ':', end - ptr);
+    if (!EventEnd) {
+        ++worker->NumMalformedLines;
+        return;
+    }
+    ptr = EventEnd + 1;
+    if (!nextField(&ptr, end, ' ', &Field, &FieldLen) || !parseHexView(Field, FieldLen, &Addr) ||
+        !nextField(&ptr, end, ' ', &Field, &FieldLen) || !parseHexView(Field, FieldLen, &IP)) {
+        ++worker->NumMalformedLines;
+        return;
+    }
+    ++worker->NumSamples;
+    if (Addr == 0) {
+        ++worker->NumMemNoAddr;
+        return;
+    }
+    if (IP >= KernelBaseAddr) {
+        ++worker->NumMemKernel;
+        return;
+    }
+    bool IsStore = false;
+    for (const char *p = Event; p + 5 <= EventEnd && !IsStore; ++p) {
+        IsStore = memcmp(p, "store", 5) == 0;
+    }
 
+    const AddressIndex *Index = getWorkerAddressIndex(worker, PID);
+    uint64_t CodeAddress = adjustAddress(Index, IP);
+    const BinaryFunction *Function = DA_getBinaryFunctionContainingAddress(CodeAddress);
+    uint64_t DataAddress = (Index && Index->NumRanges && Addr >= Index->Base) ? Addr - Index->Base : Addr;
+    uint64_t Bucket = isBinaryDataAddress(DataAddress) ? DataAddress >> MEM_BUCKET_BITS
+                                                       : (Addr >> MEM_BUCKET_BITS) | EXTERNAL_BUCKET;
+    addMemAccess(&worker->MemAccesses, Function ? CodeAddress : 0, Bucket, !IsStore, IsStore);
 }
 
-
 /*
- * 该函数的主要功能：获取二进制文件的地址信息
+ * 该函数的主要功能：处理一行brstack，line不以'\0'结尾
  * */
- uint64_t DA_getBinaryFunctionContainingAddress(uint64_t Address){
-    if(!containsAddress(Address)){
-        return NULL;
+void processBranchLine(BranchWorker *worker, const char *line, size_t len) {
+    if (PreAggregated) {
+        processAggregatedLine(worker, line, len);
+        return;
     }
-    return BC_getBinaryFunctionContainingAddress(Address, false, true);
- }
+    if (MemProfile) {
+        processMemLine(worker, line, len);
+        return;
+    }
+    // 上一批sample已经聚合完成，一次性回收它们占用的内存
+    if (worker->NumTotalSamples % ARENA_BATCH_LINES == 0) {
+        arenaReset(&worker->arena);
+    }
+    ++worker->NumTotalSamples;
+    // 不需要额外字段时先走向量化解码，格式不符合或者没有LBR项的行再交给parseBranchSample
+    PerfBranchSample sample;
+    if (KeepExtraFields || decodeBrstackLine(line, len, &sample) <= 0) {
+        if (!parseBranchSample(line, len, &worker->arena, &sample)) {
+            return;
+        }
+    } else {
+        ++worker->NumFastPathSamples;
+    }
+    if (worker->LogSamples) {
+        logBranchSample(&sample);
+    }
+    filterLBREntries(&sample, getWorkerAddressIndex(worker, sample.PID), worker);
+    ++worker->NumSamples;
+
+    worker->NumEntries += sample.LBRCount;
+    if (worker->LogSamples) {
+        fprintf(logFile, "sample.LBRCount: %u\n", sample.LBRCount);
+    }
+    if (sample.LBRCount == 0) {
+        worker->NumSamplesNoLBR++;
+    }
+    if (MultiDso) {
+        worker->NumTraces += parseLBRSampleDsos(&sample, worker->NeedsSkylakeFix, worker);
+    } else {
+        worker->NumTraces += parseLBRSample(&sample, worker->NeedsSkylakeFix, worker);
+    }
+}
 
 /*
- * 该函数的主要功能：解析LBR的控制函数
+ * 该函数的主要功能：判断文件偏移为Offset的行是否被--sample-rate选中，只与偏移有关，与线程数和处理顺序无关
  * */
-bool parseLBREntry(const char *str, LBREntry *entry) {
-    char *token;
-    char *endptr;
-    size_t extraFieldsCapacity = INITIAL_EXTRA_FIELDS_SIZE;
-    entry->extraFields = (char **)malloc(extraFieldsCapacity * sizeof(char *));
-    if (entry->extraFields == NULL) {
-        fprintf(logFile, "Error allocating memory for extraFields\n");
-        return false;
+static inline bool selectSample(uint64_t Offset) {
+    if (SampleRate >= 1.0) {
+        return true;
     }
-    entry->extraFieldsCount = 0;
+    uint64_t Hash = (Offset ^ DOWNSAMPLE_SEED) * 0x9E3779B97F4A7C15ULL;
+    Hash = (Hash ^ (Hash >> 32)) * 0xBF58476D1CE4E5B9ULL;
+    Hash ^= Hash >> 29;
+    return (Hash >> 11) < (uint64_t)(SampleRate * (double)(1ULL << 53));
+}
 
-    char *strCopy = strdup(str);
-    if (!strCopy) {
-        fprintf(logFile, "Error duplicating string for LBR entry\n");
-        free(entry->extraFields);
-        return false;
+/*
+ * 该函数的主要功能：判断worker的sample预算或者时间预算是否已经用完
+ * */
+static inline bool budgetExhausted(const BranchWorker *worker) {
+    if (worker->SampleBudget && worker->NumTotalSamples >= worker->SampleBudget) {
+        return true;
     }
+    if (TimeBudget > 0 && worker->NumTotalSamples % BUDGET_CHECK_LINES == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec > ParseDeadline.tv_sec ||
+               (now.tv_sec == ParseDeadline.tv_sec && now.tv_nsec >= ParseDeadline.tv_nsec);
+    }
+    return false;
+}
 
-    token = strtok(strCopy, "/");
-    if (token == NULL) {
-        fprintf(logFile, "Error: expected hexadecimal number for From address\n");
-        free(strCopy);
-        free(entry->extraFields);
-        return false;
+/*
+ * 该函数的主要功能：下采样时处理文件偏移为Offset的一行，没有选中的行只计数，预算用完时返回false
+ * */
+static inline bool sampleBranchLine(BranchWorker *worker, const char *line, size_t len, uint64_t Offset) {
+    if (!Downsampling) {
+        processBranchLine(worker, line, len);
+        return true;
     }
-    entry->from = strtoull(token, &endptr, 16);
-    if (*endptr != '\0') {
-        fprintf(logFile, "Error: invalid hexadecimal number for From address\n");
-        free(strCopy);
-        free(entry->extraFields);
+    if (budgetExhausted(worker)) {
+        worker->Stopped = true;
         return false;
     }
+    if (selectSample(Offset)) {
+        processBranchLine(worker, line, len);
+    } else {
+        ++worker->NumSampledOut;
+    }
+    return true;
+}
+
+/*
+ * 该函数的主要功能：解析线程的入口，依次处理[Begin, End)中的每一行
+ * */
+void *parseBranchRange(void *arg) {
+    BranchWorker *worker = (BranchWorker *)arg;
+    resetAddressCache();
+    NumTruncatedEntries = 0;
+    const char *line = worker->Begin;
+    while (line < worker->End) {
+        const char *lineEnd = memchr(line, '\n', worker->End - line);
+        if (!lineEnd) {
+            lineEnd = worker->End;
+        }
+        if (lineEnd > line && !sampleBranchLine(worker, line, lineEnd - line, worker->BeginOffset + (line - worker->Begin))) {
+            break;
+        }
+        line = lineEnd + 1;
+    }
+    worker->BytesDone = worker->Stopped ? (uint64_t)(line - worker->Begin) : worker->BytesTotal;
+    worker->NumTruncatedEntries = NumTruncatedEntries;
+    worker->CacheHits = FunctionCache.Hits;
+    worker->CacheMisses = FunctionCache.Misses;
+    return NULL;
+}
 
-    token = strtok(NULL, "/");
-    if (token == NULL) {
-        fprintf(logFile, "Error: expected hexadecimal number for To address\n");
-        free(strCopy);
-        free(entry->extraFields);
+/*
+ * 该函数的主要功能：单线程处理，通过LineScanner读取，可以处理管道和比内存还大的文件
+ * */
+bool parseBranchSerial(BranchWorker *worker, const char *filename) {
+    LineScanner scanner;
+    if (!openLineScanner(&scanner, filename)) {
         return false;
     }
-    entry->to = strtoull(token, &endptr, 16);
-    if (*endptr != '\0') {
-        fprintf(logFile, "Error: invalid hexadecimal number for To address\n");
-        free(strCopy);
-        free(entry->extraFields);
-        return false;
+    resetAddressCache();
+    NumTruncatedEntries = 0;
+    worker->BytesTotal = scanner.FileSize;
+    worker->SampleBudget = SampleBudget;
+    uint64_t Offset = 0;
+    LineView line;
+    while (nextLine(&scanner, &line)) {
+        if (!sampleBranchLine(worker, line.Data, line.Len, Offset)) {
+            break;
+        }
+        Offset += line.Len + 1;
     }
+    worker->BytesDone = worker->Stopped ? Offset : worker->BytesTotal;
+    closeLineScanner(&scanner);
+    worker->NumTruncatedEntries = NumTruncatedEntries;
+    worker->CacheHits = FunctionCache.Hits;
+    worker->CacheMisses = FunctionCache.Misses;
+    return true;
+}
 
-    token = strtok(NULL, "/");
-    if (token == NULL || (token[0] != 'P' && token[0] != 'M' && token[0] != '-')) {
-        fprintf(logFile, "Error: expected single char for mispred bit, found: %s\n", token);
-        free(strCopy);
-        free(entry->extraFields);
+/*
+ * 该函数的主要功能：多线程处理，把整个文件映射到内存后按行切成NumThreads段，每段一个线程
+ * 返回false表示输入不是可以映射的普通文件，调用者退回单线程处理
+ * */
+bool parseBranchParallel(BranchWorker *workers, int NumThreads, const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        if (fd != -1) close(fd);
         return false;
     }
-    entry->mispred = (token[0] == 'M');
+    const char *data = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+    const char *dataEnd = data + st.st_size;
 
-    // 处理额外字段
-    while ((token = strtok(NULL, "/")) != NULL) {
-        if (entry->extraFieldsCount == extraFieldsCapacity) {
-            extraFieldsCapacity *= 2;
-            char **newExtraFields = (char **)realloc(entry->extraFields, extraFieldsCapacity * sizeof(char *));
-            if (newExtraFields == NULL) {
-                fprintf(logFile, "Error reallocating memory for extraFields\n");
-                for (size_t i = 0; i < entry->extraFieldsCount; ++i) {
-                    free(entry->extraFields[i]);
-                }
-                free(entry->extraFields);
-                free(strCopy);
-                return false;
-            }
-            entry->extraFields = newExtraFields;
+    // 每段的起点移动到下一个换行符之后，保证每一行只属于一个线程
+    const char *Begin = data;
+    for (int i = 0; i < NumThreads; ++i) {
+        const char *End = (i == NumThreads - 1) ? dataEnd : data + (uint64_t)st.st_size * (i + 1) / NumThreads;
+        if (End < Begin) {
+            End = Begin;
         }
-        entry->extraFields[entry->extraFieldsCount] = strdup(token);
-        if (entry->extraFields[entry->extraFieldsCount] == NULL) {
-            fprintf(logFile, "Error duplicating string for extraField\n");
-            for (size_t i = 0; i < entry->extraFieldsCount; ++i) {
-                free(entry->extraFields[i]);
-            }
-            free(entry->extraFields);
-            free(strCopy);
-            return false;
+        if (End < dataEnd) {
+            const char *Newline = memchr(End, '\n', dataEnd - End);
+            End = Newline ? Newline + 1 : dataEnd;
         }
-        entry->extraFieldsCount++;
+        workers[i].Begin = Begin;
+        workers[i].End = End;
+        workers[i].BeginOffset = Begin - data;
+        workers[i].BytesTotal = End - Begin;
+        // sample预算按每段的大小分配，每个线程至少处理一个sample
+        workers[i].SampleBudget = SampleBudget ? (uint64_t)((double)SampleBudget * (End - Begin) / st.st_size) + 1 : 0;
+        Begin = End;
     }
 
-    fprintf(logFile, "From: 0x%lx To: 0x%lx Mispred: %d", entry->from, entry->to, entry->mispred);
-    for (size_t i = 0; i < entry->extraFieldsCount; i++) {
-        fprintf(logFile, "  %s", entry->extraFields[i]);
+    pthread_t threads[MAX_PARSE_THREADS];
+    int Started = 0;
+    for (; Started < NumThreads; ++Started) {
+        if (pthread_create(&threads[Started], NULL, parseBranchRange, &workers[Started]) != 0) {
+            break;
+        }
+    }
+    // 创建线程失败时，剩下的段在当前线程中处理
+    for (int i = Started; i < NumThreads; ++i) {
+        parseBranchRange(&workers[i]);
+    }
+    for (int i = 0; i < Started; ++i) {
+        pthread_join(threads[i], NULL);
     }
-    fprintf(logFile, "\n");
 
-    free(strCopy);
+    munmap((void *)data, st.st_size);
     return true;
 }
 
-
 /*
- * 该函数的主要功能：判断地址是否位于内存范围
+ * 该函数的主要功能：--all-dsos时按DSO合并各线程的trace表，依次把每个有sample的DSO设为当前的可执行文件，
+ * 走与单个可执行文件相同的流程（展开fall-through、排序、写出），结果写入perf.<文件名>.fdata，
+ * 文件名重复（不同路径、build-id不同）时在文件名后加上DSO编号
  * */
-bool ignoreKernelInterrupt(LBREntry *LBR) {
-    return IgnoreInterruptLBR &&
-           (LBR->from >= KernelBaseAddr || LBR->to >= KernelBaseAddr);
-}
+void writeDsoProfiles(BranchWorker *workers, int NumThreads, double Scale, double Fraction) {
+    FunctionIndex SavedFunctions = BinaryFunctions;
+    ElfFile SavedElf = BinaryElf;
+    BinaryLayout SavedLayout = Layout;
+    uint32_t NumWritten = 0;
+    for (uint32_t Dso = 0; Dso < Dsos.NumDsos; ++Dso) {
+        DsoInfo *Info = &Dsos.Dsos[Dso];
+        if (Info->Alias != Dso || Info->Loaded != 1) {
+            continue;
+        }
+        BranchTraceTable Traces = {0};
+        BranchTraceTable Fallthroughs = {0};
+        for (int i = 0; i < NumThreads; ++i) {
+            DsoTraceTables *Tables = &workers[i].DsoTraces[Dso];
+            if (!Tables->Traces.Slots) {
+                continue;
+            }
+            if (!Traces.Slots) {
+                Traces = Tables->Traces;
+                Fallthroughs = Tables->Fallthroughs;
+                Tables->Traces.Slots = NULL;
+                Tables->Fallthroughs.Slots = NULL;
+            } else if (!mergeBranchTraceTable(&Traces, &Tables->Traces) ||
+                       !mergeBranchTraceTable(&Fallthroughs, &Tables->Fallthroughs)) {
+                fprintf(logFile, "Error allocating memory for branch traces\n");
+            }
+        }
+        if (!Traces.Slots) {
+            continue;
+        }
+
+        const char *BaseName = strrchr(Info->Path, '/') ? strrchr(Info->Path, '/') + 1 : Info->Path;
+        char Name[512];
+        snprintf(Name, sizeof(Name), "%s", BaseName);
+        for (uint32_t i = 0; i < Dso; ++i) {
+            const char *Other = strrchr(Dsos.Dsos[i].Path, '/') ? strrchr(Dsos.Dsos[i].Path, '/') + 1 : Dsos.Dsos[i].Path;
+            if (Dsos.Dsos[i].Alias == i && Dsos.Dsos[i].Loaded == 1 && strcmp(Other, BaseName) == 0) {
+                snprintf(Name, sizeof(Name), "%s.%u", BaseName, Dso);
+                break;
+            }
+        }
+        char Output[600];
+        snprintf(Output, sizeof(Output), CompactProfile ? TEMP_DSO_BFDATA_FORMAT : TEMP_DSO_FDATA_FORMAT, Name);
 
+        BinaryFunctions = Info->Functions;
+        BinaryElf = Info->Elf;
+        Layout = Info->Layout;
+        resetAddressCache();
+        fprintf(logFile, "DSO %s: %zu functions, %zu branch traces, %zu fall-through traces -> %s\n", Info->Path,
+                Info->Functions.NumFunctions, Traces.Size, Fallthroughs.Size, Output);
+        if (Downsampling) {
+            scaleBranchTraceTable(&Traces, Scale);
+            scaleBranchTraceTable(&Fallthroughs, Scale);
+        }
+        addFallthroughEdges(&Fallthroughs, &Traces);
+        if (Downsampling) {
+            reportSampledEdges(&Traces, Fraction);
+        }
+        bool Written = CompactProfile ? writeBinaryProfile(&Traces, Info->BuildId, Info->BuildIdSize, Output)
+                                      : writeBranchProfile(&Traces, Output);
+        if (!Written) {
+            fprintf(logFile, "Error writing %s\n", Output);
+        }
+        NumWritten += Written;
+        free(BinaryCFGs);
+        BinaryCFGs = NULL;
+        arenaDestroy(&CFGArena);
+        freeBranchTraceTable(&Traces);
+        freeBranchTraceTable(&Fallthroughs);
+    }
+    BinaryFunctions = SavedFunctions;
+    BinaryElf = SavedElf;
+    Layout = SavedLayout;
+    resetAddressCache();
+    fprintf(logFile, "DSO profiles written: %u (%u files in mmap information)\n", NumWritten, Dsos.NumDsos);
+}
 
 /*
- * 该函数的主要功能：具体的处理Branch事件的代码
+ * 该函数的主要功能：解析分支的主控函数，NumThreads大于1时按行切分输入并行解析，再合并各线程的结果
+ * 合并后的trace按(From, To)排序输出，perf.fdata与线程数无关
  * */
-PerfBranchSample parseBranchSample(const char *line) {
-    PerfBranchSample sample = {0};
-    sample.LBR = NULL;
-    sample.LBRCount = 0;
-    sample.LBRCapacity = INITIAL_LBR_CAPACITY;
-    sample.PC = 0;
-    sample.PID = 0;
+int parseBranchEvents(const char *filename, int NumThreads) {
+    // --mem和brstack可能先后在同一目录运行（task.c --stream），各自写自己的日志，互不覆盖
+    logFile = fopen(MemProfile ? "mem_events.log" : "branch_events.log", "w");  // 打开日志文件
+    if (!logFile) {
+        perror("Error opening log file");
+        return 1;
+    }
+    if (NumThreads < 1) {
+        NumThreads = 1;
+    }
+    if (NumThreads > MAX_PARSE_THREADS) {
+        NumThreads = MAX_PARSE_THREADS;
+    }
 
-    char *lineCopy = strdup(line);
-    if (!lineCopy) {
-        fprintf(logFile, "Error duplicating line\n");
-        return sample;
+    if (BinaryPath) {
+        // 直接读取ELF文件，同时写出perf_temp_func.log，与shell脚本生成的函数表相同
+        // 文件保持映射，写perf.fdata之前还要反汇编函数得到基本块
+        if (!openElfFile(&BinaryElf, BinaryPath) || !loadFunctionIndexFromElf(&BinaryFunctions, &BinaryElf) ||
+            !getBinaryLayout(&BinaryElf, &Layout)) {
+            fprintf(logFile, "Error reading ELF file: %s\n", BinaryPath);
+            closeElfFile(&BinaryElf);
+        } else if (!writeFunctionTable(&BinaryFunctions, TEMP_FUNC_FILE) ||
+                   !writeBinaryLayout(&Layout, TEMP_READELF_FILE)) {
+            fprintf(logFile, "Error writing %s or %s\n", TEMP_FUNC_FILE, TEMP_READELF_FILE);
+        }
+        if (MemProfile && BinaryElf.Data && !loadDataObjectsFromElf(&DataObjects, &BinaryElf)) {
+            fprintf(logFile, "Error reading data symbols: %s\n", BinaryPath);
+        }
+    } else {
+        if (!loadFunctionIndex(&BinaryFunctions, TEMP_FUNC_FILE)) {
+            fprintf(logFile, "Warning: no function information in %s\n", TEMP_FUNC_FILE);
+        }
+        if (!loadBinaryLayout(&Layout, TEMP_READELF_FILE)) {
+            fprintf(logFile, "Warning: no layout information in %s\n", TEMP_READELF_FILE);
+        }
+    }
+    fprintf(logFile, "Functions: %zu\n", BinaryFunctions.NumFunctions);
+    fprintf(logFile, "FirstAllocAddress: 0x%" PRIx64 "  LayoutStartAddress: 0x%" PRIx64 "\n",
+            Layout.FirstAllocAddress, Layout.LayoutStartAddress);
+    if (MultiDso && (!MMapPath || PreAggregated || MemProfile)) {
+        fprintf(logFile, "Warning: --all-dsos needs --mmap and branch samples, writing %s only\n", TEMP_FDATA_FILE);
+        MultiDso = false;
+    }
+    if (MMapPath) {
+        // 没有mmap信息时保持原来的行为，认为可执行文件是固定加载地址
+        const char *Name = BinaryPath ? BinaryPath : ExecName;
+        if (!Name && !MultiDso) {
+            fprintf(logFile, "Warning: --mmap needs --binary or --exec-name to find the executable, addresses not adjusted\n");
+        } else if (!loadProcessAddresses(&ProcessAddresses, MMapPath, Name)) {
+            fprintf(logFile, "Error reading mmap information: %s\n", MMapPath);
+            MultiDso = false;
+        } else {
+            fprintf(logFile, "Processes mapping the executable: %zu (%zu distinct address indexes)\n",
+                    ProcessAddresses.Size, ProcessAddresses.NumIndexes);
+        }
     }
 
-    char *pidStr = strtok(lineCopy, " ");
-    if (!pidStr) {
-        fprintf(logFile, "Error: PID not found.\n");
-        free(lineCopy);
-        return sample;
+    Downsampling = SampleRate < 1.0 || SampleBudget || TimeBudget > 0;
+    if (Downsampling && (PreAggregated || MemProfile)) {
+        fprintf(logFile, "Warning: --sample-rate, --max-samples and --time-budget only apply to brstack input, ignored\n");
+        Downsampling = false;
+        SampleRate = 1.0;
+        SampleBudget = 0;
+        TimeBudget = 0;
     }
-    sample.PID = strtoull(pidStr, NULL, 10);
 
-    char *pcStr = strtok(NULL, " ");
-    if (!pcStr) {
-        fprintf(logFile, "Error: PC not found.\n");
-        free(lineCopy);
-        return sample;
+    BranchWorker *workers = (BranchWorker *)calloc(NumThreads, sizeof(BranchWorker));
+    if (!workers) {
+        fprintf(logFile, "Error allocating memory for parse threads\n");
+        freeFunctionIndex(&BinaryFunctions);
+        freeProcessAddresses(&ProcessAddresses);
+        fclose(logFile);
+        return 1;
+    }
+    for (int i = 0; i < NumThreads; ++i) {
+        workers[i].LogSamples = (NumThreads == 1);
+        workers[i].NeedsSkylakeFix = false;
+        if (MultiDso && !(workers[i].DsoTraces = (DsoTraceTables *)calloc(Dsos.NumDsos + 1, sizeof(DsoTraceTables)))) {
+            fprintf(logFile, "Error allocating memory for branch traces\n");
+            NumThreads = i + 1;
+            goto cleanup;
+        }
+        if (!initBranchTraceTable(&workers[i].Traces, INITIAL_TRACE_TABLE_SIZE) ||
+            !initBranchTraceTable(&workers[i].Fallthroughs, INITIAL_TRACE_TABLE_SIZE) ||
+            (MemProfile && !initMemAccessTable(&workers[i].MemAccesses, INITIAL_TRACE_TABLE_SIZE))) {
+            fprintf(logFile, "Error allocating memory for branch traces\n");
+            NumThreads = i + 1;
+            goto cleanup;
+        }
     }
-    sample.PC = strtoull(pcStr, NULL, 16);
 
-    fprintf(logFile, "\n\nPID: %ld  PC: 0x%lx\n", sample.PID, sample.PC);
+    if (TimeBudget > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &ParseDeadline);
+        ParseDeadline.tv_sec += (time_t)TimeBudget;
+        ParseDeadline.tv_nsec += (long)((TimeBudget - (time_t)TimeBudget) * 1e9);
+        if (ParseDeadline.tv_nsec >= 1000000000L) {
+            ParseDeadline.tv_sec += 1;
+            ParseDeadline.tv_nsec -= 1000000000L;
+        }
+    }
+    if (NumThreads == 1 || !parseBranchParallel(workers, NumThreads, filename)) {
+        // 无法映射的输入（管道等）只能顺序读取，全部交给第一个worker
+        if (!parseBranchSerial(&workers[0], filename)) {
+            fprintf(logFile, "Error opening file: %s\n", filename);
+            goto cleanup;
+        }
+    }
 
-    char *restStr = strtok(NULL, "\n");
-    if (!restStr) {
-        fprintf(logFile, "Error: Rest of line not found.\n");
-        free(lineCopy);
-        return sample;
-    } else {
-        sample.LBR = (LBREntry *)malloc(sample.LBRCapacity * sizeof(LBREntry));
-        if (!sample.LBR) {
-            fprintf(logFile, "Error allocating memory for LBR entries\n");
-            free(lineCopy);
-            return sample;
-        }
-
-        char *restStrCopy = strdup(restStr);
-        char *token;
-        char *saveptr;
-
-        token = strtok_r(restStrCopy, " ", &saveptr);
-        while (token != NULL) {
-            if (sample.LBRCount >= sample.LBRCapacity) {
-                sample.LBRCapacity *= 2;
-                LBREntry *newLBR = (LBREntry *)realloc(sample.LBR, sample.LBRCapacity * sizeof(LBREntry));
-                if (!newLBR) {
-                    fprintf(logFile, "Error reallocating memory for LBR entries\n");
-                    for (size_t i = 0; i < sample.LBRCount; ++i) {
-                        for (size_t j = 0; j < sample.LBR[i].extraFieldsCount; ++j) {
-                            free(sample.LBR[i].extraFields[j]);
-                        }
-                        free(sample.LBR[i].extraFields);
-                    }
-                    free(sample.LBR);
-                    free(lineCopy);
-                    free(restStrCopy);
-                    sample.LBR = NULL;
-                    return sample;
-                }
-                sample.LBR = newLBR;
+    // 预算用完提前停止的线程按已经扫描的字节比例外推，先在各自的表上放大；
+    // --sample-rate的比例对所有线程相同，合并之后再统一放大，结果与线程数无关
+    double Processed = 0;
+    double Estimated = 0;
+    double Selected = 0;  // 外推之后被--sample-rate选中的sample数，Estimated / Selected是合并之后还要放大的倍数
+    int NumStopped = 0;
+    bool SizeUnknown = false;
+    for (int i = 0; Downsampling && i < NumThreads; ++i) {
+        double Seen = (double)(workers[i].NumTotalSamples + workers[i].NumSampledOut);
+        double Extrapolate = 1.0;
+        if (workers[i].Stopped) {
+            ++NumStopped;
+            if (workers[i].BytesTotal && workers[i].BytesDone) {
+                Extrapolate = (double)workers[i].BytesTotal / workers[i].BytesDone;
+            } else {
+                SizeUnknown = true;
             }
+        }
+        scaleBranchTraceTable(&workers[i].Traces, Extrapolate);
+        scaleBranchTraceTable(&workers[i].Fallthroughs, Extrapolate);
+        for (uint32_t Dso = 0; workers[i].DsoTraces && Dso < Dsos.NumDsos; ++Dso) {
+            scaleBranchTraceTable(&workers[i].DsoTraces[Dso].Traces, Extrapolate);
+            scaleBranchTraceTable(&workers[i].DsoTraces[Dso].Fallthroughs, Extrapolate);
+        }
+        Processed += (double)workers[i].NumTotalSamples;
+        Estimated += Seen * Extrapolate;
+        Selected += workers[i].NumTotalSamples * Extrapolate;
+    }
+    double Fraction = Estimated > 0 ? Processed / Estimated : 1.0;
+    double Scale = Selected > 0 ? Estimated / Selected : 1.0;
 
-            char *buffer = strdup(token);
-            if (buffer == NULL) {
-                fprintf(logFile, "Error duplicating string for LBR entry\n");
-                for (size_t i = 0; i < sample.LBRCount; ++i) {
-                    for (size_t j = 0; j < sample.LBR[i].extraFieldsCount; ++j) {
-                        free(sample.LBR[i].extraFields[j]);
-                    }
-                    free(sample.LBR[i].extraFields);
-                }
-                free(sample.LBR);
-                free(lineCopy);
-                free(restStrCopy);
-                sample.LBR = NULL;
-                return sample;
-            }
-
-            if (!parseLBREntry(buffer, &sample.LBR[sample.LBRCount])) {
-                for (size_t i = 0; i < sample.LBRCount; ++i) {
-                    for (size_t j = 0; j < sample.LBR[i].extraFieldsCount; ++j) {
-                        free(sample.LBR[i].extraFields[j]);
-                    }
-                    free(sample.LBR[i].extraFields);
-                }
-                free(sample.LBR);
-                free(lineCopy);
-                free(restStrCopy);
-                free(buffer);
-                sample.LBR = NULL;
-                return sample;
-            }
-            free(buffer);
-            if (ignoreKernelInterrupt(&sample.LBR[sample.LBRCount])) {
-                for (size_t j = 0; j < sample.LBR[sample.LBRCount].extraFieldsCount; ++j) {
-                    free(sample.LBR[sample.LBRCount].extraFields[j]);
-                }
-                free(sample.LBR[sample.LBRCount].extraFields);
-                sample.LBRCount--;
-            }
-            sample.LBRCount++;
-            token = strtok_r(NULL, " ", &saveptr);
+    // 按线程编号依次合并，计数求和，trace表合并的结果与顺序无关
+    BranchWorker Total = {0};
+    BranchLBRs = workers[0].Traces;
+    FallthroughLBRs = workers[0].Fallthroughs;
+    MemAccessTable MemAccesses = workers[0].MemAccesses;
+    workers[0].Traces.Slots = NULL;
+    workers[0].Fallthroughs.Slots = NULL;
+    workers[0].MemAccesses.Slots = NULL;
+    for (int i = 0; i < NumThreads; ++i) {
+        if (i > 0 && (!mergeBranchTraceTable(&BranchLBRs, &workers[i].Traces) ||
+                      !mergeBranchTraceTable(&FallthroughLBRs, &workers[i].Fallthroughs) ||
+                      (MemProfile && !mergeMemAccessTable(&MemAccesses, &workers[i].MemAccesses)))) {
+            fprintf(logFile, "Error allocating memory for branch traces\n");
         }
-        free(lineCopy);
-        free(restStrCopy);
+        Total.NumTotalSamples += workers[i].NumTotalSamples;
+        Total.NumEntries += workers[i].NumEntries;
+        Total.NumSamples += workers[i].NumSamples;
+        Total.NumSamplesNoLBR += workers[i].NumSamplesNoLBR;
+        Total.NumTraces += workers[i].NumTraces;
+        Total.NumInvalidTraces += workers[i].NumInvalidTraces;
+        Total.NumLongRangeTraces += workers[i].NumLongRangeTraces;
+        Total.NumFastPathSamples += workers[i].NumFastPathSamples;
+        Total.NumTruncatedEntries += workers[i].NumTruncatedEntries;
+        Total.NumKernelEntries += workers[i].NumKernelEntries;
+        Total.NumOutsideEntries += workers[i].NumOutsideEntries;
+        Total.CacheHits += workers[i].CacheHits;
+        Total.CacheMisses += workers[i].CacheMisses;
+        Total.NumMalformedLines += workers[i].NumMalformedLines;
+        Total.NumMemNoAddr += workers[i].NumMemNoAddr;
+        Total.NumMemKernel += workers[i].NumMemKernel;
     }
-    // fprintf(logFile, "sample.LBRCount: %d\n", sample.LBRCount);
-    return sample;
-}
 
-/*
- * 该函数主要功能：解析LBR信息的函数
- * TODO:
- * */
-uint64_t parseLBRSample(PerfBranchSample sample, bool needsSkylakeFix) {
-    uint64_t numTraces = 0;
-    uint64_t NextPC = 0;
-    uint32_t NumEntry = 0;
-    for (size_t i = 0; i < sample.LBRCount; ++i) {
-        ++NumEntry;
-        if (needsSkylakeFix && NumEntry <= 2){
-            continue;
+    if (MemProfile) {
+        fprintf(logFile, "Total Memory Samples: %" PRIu64 "\n", Total.NumTotalSamples);
+        fprintf(logFile, "Memory Samples Parsed: %" PRIu64 "\n", Total.NumSamples);
+        fprintf(logFile, "Malformed lines: %" PRIu64 "\n", Total.NumMalformedLines);
+        fprintf(logFile, "Samples without data address: %" PRIu64 "\n", Total.NumMemNoAddr);
+        fprintf(logFile, "Samples in kernel code: %" PRIu64 "\n", Total.NumMemKernel);
+        fprintf(logFile, "Data Objects: %zu\n", DataObjects.NumFunctions);
+        fprintf(logFile, "Unique (code, data bucket) pairs: %zu\n", MemAccesses.Size);
+        fprintf(logFile, "Parse threads: %d\n", NumThreads);
+        resetAddressCache();
+        if (!writeMemProfile(&MemAccesses, TEMP_MEM_PROFILE_FILE)) {
+            fprintf(logFile, "Error writing %s\n", TEMP_MEM_PROFILE_FILE);
         }
-        if (NextPC){
-            const uint64_t TraceFrom = sample.LBR.To;
-            const uint64_t TraceTo = NextPC;
-            
+        freeMemAccessTable(&MemAccesses);
+        freeBranchTraceTable(&BranchLBRs);
+        freeBranchTraceTable(&FallthroughLBRs);
+        goto cleanup;
+    }
 
+    fprintf(logFile, "Total Samples: %ld\n", Total.NumTotalSamples);
+    fprintf(logFile, "Total Entries: %ld\n", Total.NumEntries);
+    fprintf(logFile, "Total Samples Parsed: %ld\n", Total.NumSamples);
+    fprintf(logFile, "Total Samples with No LBR: %ld\n", Total.NumSamplesNoLBR);
+    fprintf(logFile, "Total Traces: %ld\n", Total.NumTraces);
+    fprintf(logFile, "Invalid Traces: %" PRIu64 "\n", Total.NumInvalidTraces);
+    fprintf(logFile, "Long Range Traces: %" PRIu64 "\n", Total.NumLongRangeTraces);
+    fprintf(logFile, "Unique Fall-through Traces: %zu\n", FallthroughLBRs.Size);
+    fprintf(logFile, "Total Errors: %d\n", num_error);
+    fprintf(logFile, "Samples decoded by %s: %" PRIu64 "\n", brstackDecoderName(BrstackDecoder), Total.NumFastPathSamples);
+    fprintf(logFile, "LBR entries beyond %d dropped: %" PRIu64 "\n", MAX_LBR_ENTRIES, Total.NumTruncatedEntries);
+    fprintf(logFile, "LBR entries dropped in kernel: %" PRIu64 "\n", Total.NumKernelEntries);
+    fprintf(logFile, "LBR entries outside binary: %" PRIu64 "\n", Total.NumOutsideEntries);
+    fprintf(logFile, "Unique Branch Traces: %zu (%zu slots)\n", BranchLBRs.Size, BranchLBRs.Capacity);
+    fprintf(logFile, "Branch Traces beyond 32-bit offsets: %" PRIu64 "\n", BranchLBRs.NumOverflow);
+    uint64_t Lookups = Total.CacheHits + Total.CacheMisses;
+    fprintf(logFile, "Function lookup cache: %" PRIu64 " hits, %" PRIu64 " misses (%.2f%% hit rate)\n",
+            Total.CacheHits, Total.CacheMisses, Lookups ? 100.0 * Total.CacheHits / Lookups : 0.0);
+    fprintf(logFile, "Parse threads: %d\n", NumThreads);
+    if (PreAggregated) {
+        fprintf(logFile, "Malformed pre-aggregated lines: %" PRIu64 "\n", Total.NumMalformedLines);
+    }
+    if (Downsampling) {
+        fprintf(logFile, "Downsampling: %.0f of an estimated %.0f samples processed (%.4f), counts scaled by %.3f\n",
+                Processed, Estimated, Fraction, Fraction > 0 ? 1 / Fraction : 1.0);
+        if (NumStopped) {
+            fprintf(logFile, "Stopped by sample or time budget: %d of %d threads\n", NumStopped, NumThreads);
         }
-        NextPC = sample.LBR[i].From;
-        uint64_t From = getBinaryFunctionContainingAddress(sample.LBR.From) ? sample.LBR.From : 0;
-        uint64_t To = getBinaryFunctionContainingAddress(sample.LBR.To) ? sample.LBR.To : 0;
-        if (!From && !To) {
-            continue;
+        if (SizeUnknown) {
+            fprintf(logFile, "Warning: input size unknown, counts after the budget ran out are not extrapolated\n");
         }
-        // TakenBranchInfo &Info = BranchLBRs[Trace(From, To)];
-        // ++Info.TakenCount;
-        // Info.MispredCount += LBR.Mispred;
     }
-    return numTraces;
+    if (MultiDso) {
+        writeDsoProfiles(workers, NumThreads, Scale, Fraction);
+        freeBranchTraceTable(&BranchLBRs);
+        freeBranchTraceTable(&FallthroughLBRs);
+        goto cleanup;
+    }
+
+    resetAddressCache();
+    if (Downsampling) {
+        scaleBranchTraceTable(&BranchLBRs, Scale);
+        scaleBranchTraceTable(&FallthroughLBRs, Scale);
+    }
+    // 预聚合profile保存的是展开基本块之前的trace，必须在addFallthroughEdges修改BranchLBRs之前写出
+    if (WriteAggregated && !writeAggregatedProfile(&BranchLBRs, &FallthroughLBRs, TEMP_AGGREGATED_FILE)) {
+        fprintf(logFile, "Error writing %s\n", TEMP_AGGREGATED_FILE);
+    }
+    if (BinaryElf.Data) {
+        addFallthroughEdges(&FallthroughLBRs, &BranchLBRs);
+    } else {
+        fprintf(logFile, "Warning: fall-through traces need --binary to find basic blocks, not written to %s\n",
+                TEMP_FDATA_FILE);
+    }
+    if (Downsampling) {
+        reportSampledEdges(&BranchLBRs, Fraction);
+    }
+    if (CompactProfile) {
+        uint8_t BuildId[MAX_BUILD_ID_SIZE];
+        size_t BuildIdSize = BinaryElf.Data ? getElfBuildId(&BinaryElf, BuildId, sizeof(BuildId)) : 0;
+        if (!writeBinaryProfile(&BranchLBRs, BuildId, BuildIdSize, TEMP_BFDATA_FILE)) {
+            fprintf(logFile, "Error writing %s\n", TEMP_BFDATA_FILE);
+        }
+    } else if (!writeBranchProfile(&BranchLBRs, TEMP_FDATA_FILE)) {
+        fprintf(logFile, "Error writing %s\n", TEMP_FDATA_FILE);
+    }
+    freeBranchTraceTable(&BranchLBRs);
+    freeBranchTraceTable(&FallthroughLBRs);
+
+cleanup:
+    for (int i = 0; i < NumThreads; ++i) {
+        freeBranchTraceTable(&workers[i].Traces);
+        freeBranchTraceTable(&workers[i].Fallthroughs);
+        freeMemAccessTable(&workers[i].MemAccesses);
+        arenaDestroy(&workers[i].arena);
+        for (uint32_t Dso = 0; workers[i].DsoTraces && Dso < Dsos.NumDsos; ++Dso) {
+            freeBranchTraceTable(&workers[i].DsoTraces[Dso].Traces);
+            freeBranchTraceTable(&workers[i].DsoTraces[Dso].Fallthroughs);
+        }
+        free(workers[i].DsoTraces);
+    }
+    free(workers);
+    freeFunctionIndex(&BinaryFunctions);
+    freeFunctionIndex(&DataObjects);
+    free(BinaryCFGs);
+    BinaryCFGs = NULL;
+    arenaDestroy(&CFGArena);
+    closeElfFile(&BinaryElf);
+    freeProcessAddresses(&ProcessAddresses);
+    freeDsoTable(&Dsos);
+
+    fclose(logFile);  // 关闭日志文件
+    return 0;
 }
 
+/*
+ * 该函数的主要功能：对比parseLBREntry和向量化解码器每秒能处理的LBR条目数
+ * */
+double elapsedSeconds(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
 
 /*
- * 该函数的主要功能：解析分支的主控函数
+ * 该函数的主要功能：用几行边界输入检查各个解码器，解码成功时结果必须和parseLBREntry逐项相同
  * */
-int parseBranchEvents(const char *filename) {
-    logFile = fopen("branch_events.log", "w");  // 打开日志文件
+bool checkBrstackDecoders(void) {
+    static const char *const Lines[] = {
+        "1234 0x401000 0x40@100/0x401200/P/-/-/0 0x401`00/0x401300/M/-/-/0",
+        "1234 0x401000 0x4011G0/0x401200/P/-/-/0 0x401:00/0x401300/M/-/-/0",
+        "1234 0x401000 0x4011\xb9" "0/0x401200/P/-/-/0 0x4011/0x401300/M/-/-/0",
+        "1234 0x401000 0x4011aF/0x40120A/M/-/-/0 0x9/0xFFFFFFFFFFFFFFFF/P/-/-/0",
+    };
+    Arena arena = {0};
+    bool Ok = true;
+    for (size_t l = 0; l < sizeof(Lines) / sizeof(Lines[0]); ++l) {
+        const char *line = Lines[l];
+        const char *lineEnd = line + strlen(line);
+        PerfBranchSample expected;
+        expected.LBRCount = 0;
+        expected.MispredMask = 0;
+        const char *ptr = line;
+        const char *token;
+        size_t tokenLen;
+        nextField(&ptr, lineEnd, ' ', &token, &tokenLen);
+        nextField(&ptr, lineEnd, ' ', &token, &tokenLen);
+        while (nextField(&ptr, lineEnd, ' ', &token, &tokenLen) && expected.LBRCount < MAX_LBR_ENTRIES) {
+            LBREntry entry;
+            if (parseLBREntry(token, tokenLen, &entry, &arena)) {
+                expected.From[expected.LBRCount] = entry.from;
+                expected.To[expected.LBRCount] = entry.to;
+                expected.MispredMask |= (uint32_t)entry.mispred << expected.LBRCount;
+                ++expected.LBRCount;
+            }
+        }
+        arenaReset(&arena);
+
+        BrstackDecoderKind Kinds[] = {DECODER_SCALAR, DECODER_SSE42, DECODER_AVX2};
+        for (size_t k = 0; k < sizeof(Kinds) / sizeof(Kinds[0]) && Kinds[k] <= BrstackDecoder; ++k) {
+            PerfBranchSample decoded;
+            // 解码失败的行会交给parseLBREntry，结果自然一致
+            if (decodeBrstackLineWith(Kinds[k], line, lineEnd - line, &decoded) < 0) {
+                continue;
+            }
+            bool Same = decoded.LBRCount == expected.LBRCount && decoded.MispredMask == expected.MispredMask;
+            for (uint32_t i = 0; Same && i < decoded.LBRCount; ++i) {
+                Same = decoded.From[i] == expected.From[i] && decoded.To[i] == expected.To[i];
+            }
+            if (!Same) {
+                fprintf(stderr, "Self-check failed for %s decoder: %s\n", brstackDecoderName(Kinds[k]), line);
+                Ok = false;
+            }
+        }
+    }
+    arenaDestroy(&arena);
+    return Ok;
+}
+
+int benchBrstackDecoder(const char *filename) {
+    logFile = fopen("/dev/null", "w");
     if (!logFile) {
-        perror("Error opening log file");
+        perror("Error opening /dev/null");
         return 1;
     }
-
-    uint64_t NumTotalSamples = 0;
-    uint64_t NumEntries = 0;
-    uint64_t NumSamples = 0;
-    uint64_t NumSamplesNoLBR = 0;
-    uint64_t NumTraces = 0;
-    bool NeedsSkylakeFix = false;
-
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        fprintf(logFile, "Error opening file: %s\n", filename);
+    if (!checkBrstackDecoders()) {
         fclose(logFile);
         return 1;
     }
 
-    char *line = NULL;
-    size_t len = INITIAL_LINE_SIZE;
-    ssize_t read = 0;
-
-    line = (char *)malloc(len);
-    if (!line) {
-        fprintf(logFile, "Error allocating memory for line\n");
-        fclose(file);
+    // 先把整个文件映射到内存中，避免把I/O时间算到解码时间里
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "Error opening file: %s\n", filename);
+        fclose(logFile);
+        return 1;
+    }
+    const char *data = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
         fclose(logFile);
         return 1;
     }
+    const char *dataEnd = data + st.st_size;
 
-    while ((read = getline(&line, &len, file)) != -1) {
-        ++NumTotalSamples;
-        PerfBranchSample sample = parseBranchSample(line);
-        if (sample.LBR == NULL) {
-            continue;
+    // parseLBREntry：逐个token解析，与parseBranchSample中的用法相同
+    struct timespec start;
+    Arena arena = {0};
+    uint64_t Entries = 0;
+    uint64_t Checksum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (const char *line = data; line < dataEnd;) {
+        const char *lineEnd = memchr(line, '\n', dataEnd - line);
+        if (!lineEnd) lineEnd = dataEnd;
+        const char *ptr = line;
+        const char *token;
+        size_t tokenLen;
+        nextField(&ptr, lineEnd, ' ', &token, &tokenLen);
+        nextField(&ptr, lineEnd, ' ', &token, &tokenLen);
+        while (nextField(&ptr, lineEnd, ' ', &token, &tokenLen)) {
+            LBREntry entry;
+            if (parseLBREntry(token, tokenLen, &entry, &arena)) {
+                ++Entries;
+                Checksum += entry.from ^ entry.to ^ entry.mispred;
+            }
         }
-        ++NumSamples;
-
-        NumEntries += sample.LBRCount;
-        fprintf(logFile, "sample.LBRCount: %d\n", sample.LBRCount);
-        if (sample.LBRCount == 0) {
-            NumSamplesNoLBR++;
-        } 
-        NumTraces += parseLBRSample(sample, NeedsSkylakeFix);
+        arenaReset(&arena);
+        line = lineEnd + 1;
     }
+    arenaDestroy(&arena);
+    double Seconds = elapsedSeconds(&start);
+    printf("%-16s %12" PRIu64 " entries %8.3f s %12.0f entries/s  checksum %016" PRIx64 "\n",
+           "parseLBREntry", Entries, Seconds, Entries / Seconds, Checksum);
 
-    free(line);
-    fclose(file);
-
-    fprintf(logFile, "Total Samples: %ld\n", NumTotalSamples);
-    fprintf(logFile, "Total Entries: %ld\n", NumEntries);
-    fprintf(logFile, "Total Samples Parsed: %ld\n", NumSamples);
-    fprintf(logFile, "Total Samples with No LBR: %ld\n", NumSamplesNoLBR);
-    fprintf(logFile, "Total Traces: %ld\n", NumTraces);
-    fprintf(logFile, "Total Errors: %d\n", num_error);
+    BrstackDecoderKind Kinds[] = {DECODER_SCALAR, DECODER_SSE42, DECODER_AVX2};
+    for (size_t k = 0; k < sizeof(Kinds) / sizeof(Kinds[0]); ++k) {
+        if (Kinds[k] > BrstackDecoder) {
+            break;
+        }
+        PerfBranchSample decoded;
+        uint64_t Fallbacks = 0;
+        Entries = 0;
+        Checksum = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (const char *line = data; line < dataEnd;) {
+            const char *lineEnd = memchr(line, '\n', dataEnd - line);
+            if (!lineEnd) lineEnd = dataEnd;
+            if (decodeBrstackLineWith(Kinds[k], line, lineEnd - line, &decoded) < 0) {
+                ++Fallbacks;
+            } else {
+                Entries += decoded.LBRCount;
+                for (uint32_t i = 0; i < decoded.LBRCount; ++i) {
+                    Checksum += decoded.From[i] ^ decoded.To[i] ^ ((decoded.MispredMask >> i) & 1);
+                }
+            }
+            line = lineEnd + 1;
+        }
+        Seconds = elapsedSeconds(&start);
+        printf("%-16s %12" PRIu64 " entries %8.3f s %12.0f entries/s  checksum %016" PRIx64 "  fallback lines %" PRIu64 "\n",
+               brstackDecoderName(Kinds[k]), Entries, Seconds, Entries / Seconds, Checksum, Fallbacks);
+    }
 
-    fclose(logFile);  // 关闭日志文件
+    munmap((void *)data, st.st_size);
+    fclose(logFile);
     return 0;
 }
 
@@ -406,10 +4916,62 @@ int parseBranchEvents(const char *filename) {
  * main函数定义
  * */
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <filename>\n", argv[0]);
+    initBrstackDecoder();
+    const char *filename = NULL;
+    int NumThreads = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            return benchBrstackDecoder(argv[i + 1]);
+        } else if (strcmp(argv[i], "--merge") == 0 && i + 1 < argc) {
+            // --merge之后的参数都是输入，--threads必须写在--merge之前
+            return mergeProfiles(argv + i + 1, argc - i - 1, NumThreads, TEMP_FDATA_FILE);
+        } else if (strcmp(argv[i], "--to-text") == 0 && i + 1 < argc) {
+            return convertBinaryProfile(argv[i + 1], TEMP_FDATA_FILE);
+        } else if (strcmp(argv[i], "--mem") == 0) {
+            MemProfile = true;
+        } else if (strcmp(argv[i], "--pre-aggregated") == 0) {
+            PreAggregated = true;
+        } else if (strcmp(argv[i], "--aggregate") == 0) {
+            WriteAggregated = true;
+        } else if (strcmp(argv[i], "--compact") == 0) {
+            CompactProfile = true;
+        } else if (strcmp(argv[i], "--binary") == 0 && i + 1 < argc) {
+            BinaryPath = argv[++i];
+        } else if (strcmp(argv[i], "--mmap") == 0 && i + 1 < argc) {
+            MMapPath = argv[++i];
+        } else if (strcmp(argv[i], "--exec-name") == 0 && i + 1 < argc) {
+            ExecName = argv[++i];
+        } else if (strcmp(argv[i], "--all-dsos") == 0) {
+            MultiDso = true;
+        } else if (strcmp(argv[i], "--sample-rate") == 0 && i + 1 < argc) {
+            SampleRate = atof(argv[++i]);
+            if (SampleRate <= 0 || SampleRate > 1) {
+                fprintf(stderr, "--sample-rate must be in (0, 1]\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--max-samples") == 0 && i + 1 < argc) {
+            SampleBudget = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--time-budget") == 0 && i + 1 < argc) {
+            TimeBudget = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--extra-fields") == 0) {
+            KeepExtraFields = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            // --threads 0 表示使用所有在线的CPU
+            NumThreads = atoi(argv[++i]);
+            if (NumThreads == 0) {
+                NumThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            }
+        } else if (!filename) {
+            filename = argv[i];
+        } else {
+            filename = NULL;
+            break;
+        }
+    }
+    if (!filename) {
+        fprintf(stderr, "Usage: %s [--bench | --to-text <perf.bfdata> | --merge <fdata[:weight]>... | --extra-fields] [--mem | --pre-aggregated] [--aggregate] [--compact] [--threads N] [--binary <exec>] [--mmap <mmap-log> [--exec-name <name> | --all-dsos]] [--sample-rate R] [--max-samples N] [--time-budget S] <filename>\n", argv[0]);
         return 1;
     }
 
-    return parseBranchEvents(argv[1]);
+    return parseBranchEvents(filename, NumThreads);
 }
@@ -15,22 +15,41 @@
 /*结构体定义*/
 // mmap事件相关
 #define MAX_LINE_LENGTH 1024
-#define MAX_FILENAME_LENGTH 256
 
+#define INITIAL_TABLE_SIZE 256  // 哈希表的初始槽数，必须是2的幂
+#define INVALID_STRING_ID UINT32_MAX
+
+// 文件名字符串池，同一个文件名只保存一份，映射里只记录它的编号
+typedef struct {
+    char *Data;           // 所有字符串依次存放，以'\0'分隔
+    size_t Size;
+    size_t Capacity;
+    uint32_t *Offsets;    // 编号到Data中的偏移
+    uint32_t Count;
+    uint32_t OffsetCapacity;
+    uint32_t *Slots;      // 开放寻址哈希表，保存编号+1，0表示空槽
+    uint32_t SlotCapacity;
+} StringPool;
+
+// 文件名换成字符串池中的编号后，一项只有40字节
 typedef struct {
     uint64_t Time;
-    int PID;
     uint64_t MMapAddress;
     uint64_t Size;
     uint64_t Offset;
-    char FileName[MAX_FILENAME_LENGTH];
-    int forked;
+    int PID;
+    uint32_t FileId;
 } MMapInfo;
 
-typedef struct MMapNode {
-    MMapInfo info;
-    struct MMapNode *next;
-} MMapNode;
+// 按插入顺序保存的映射数组，加上按(PID, 文件, 地址, 大小, 偏移)去重的哈希表
+typedef struct {
+    MMapInfo *Entries;
+    size_t Size;
+    size_t Capacity;
+    uint32_t *Index;      // 保存下标+1，0表示空槽
+    size_t IndexCapacity;
+    StringPool FileNames;
+} MMapTable;
 
 /*函数定义*/
 // 执行perf命令相关
@@ -38,11 +57,12 @@ bool checkPerfDataMagic(const char *FileName);
 char* find_perf_path();
 void execute_perf_command(const char *perf_path, const char *filename, const char *args, int id);
 // 处理mmap事件相关
-void parseMMapEvents(FILE *file, MMapNode **head);
-void addMMapInfo(MMapNode **head, MMapInfo *info);
-void printMMapInfo(MMapNode *head, FILE *outputFile);
-void freeMMapInfo(MMapNode *head);
-int isDuplicate(MMapNode *head, MMapInfo *info);
+void parseMMapEvents(FILE *file, MMapTable *table);
+void addMMapInfo(MMapTable *table, MMapInfo *info);
+void printMMapInfo(MMapTable *table, FILE *outputFile);
+void freeMMapInfo(MMapTable *table);
+int isDuplicate(MMapTable *table, MMapInfo *info);
+uint32_t internString(StringPool *pool, const char *str, size_t len);
 int isValidPID(int pid);
 int isDeletedFile(const char *fileName);
 
@@ -149,18 +169,18 @@ void execute_perf_command(const char *perf_path, const char *filename, const cha
             break;
         case 3:
             printf("Processing output for ID 3 from file: %s\n", temp_file_path);
-            MMapNode *head = NULL;
-            parseMMapEvents(output_file, &head);
+            MMapTable table = {0};
+            parseMMapEvents(output_file, &table);
             char final_output_path[] = TEMP_MMAP_FILE;
             FILE *final_output_file = fopen(final_output_path, "w");
             if (final_output_file) {
-                printMMapInfo(head, final_output_file);
+                printMMapInfo(&table, final_output_file);
                 fclose(final_output_file);
                 printf("Processed mmap events saved to: %s\n", final_output_path);
             } else {
                 perror("fopen final_output_path");
             }
-            freeMMapInfo(head);
+            freeMMapInfo(&table);
             break;
         case 4:
             printf("Processing output for ID 4 from file: %s\n", temp_file_path);
@@ -175,7 +195,7 @@ void execute_perf_command(const char *perf_path, const char *filename, const cha
 }
 
 // 解析mmap events事件
-void parseMMapEvents(FILE *file, MMapNode **head) {
+void parseMMapEvents(FILE *file, MMapTable *table) {
     char line[MAX_LINE_LENGTH];
     while (fgets(line, sizeof(line), file)) {
         if (strstr(line, "PERF_RECORD_MMAP2")) {
@@ -230,15 +250,17 @@ void parseMMapEvents(FILE *file, MMapNode **head) {
                         fileNameEnd++;
                         char *newLine = strchr(fileNameEnd, '\n');
                         if (newLine) *newLine = '\0';
-                        strncpy(info.FileName, fileNameEnd, MAX_FILENAME_LENGTH - 1);
-                        info.FileName[MAX_FILENAME_LENGTH - 1] = '\0';
-                        if (strlen(info.FileName) == 0 || isDeletedFile(info.FileName)) {
+                        if (*fileNameEnd == '\0' || isDeletedFile(fileNameEnd)) {
+                            continue;
+                        }
+                        info.FileId = internString(&table->FileNames, fileNameEnd, strlen(fileNameEnd));
+                        if (info.FileId == INVALID_STRING_ID) {
                             continue;
                         }
-                        if (isDuplicate(*head, &info)) {
+                        if (isDuplicate(table, &info)) {
                             continue;
                         }
-                        addMMapInfo(head, &info);
+                        addMMapInfo(table, &info);
                     }
                 }
             }
@@ -246,46 +268,145 @@ void parseMMapEvents(FILE *file, MMapNode **head) {
     }
 }
 
-void addMMapInfo(MMapNode **head, MMapInfo *info) {
-    MMapNode *newNode = (MMapNode *)malloc(sizeof(MMapNode));
-    if (!newNode) {
-        perror("malloc");
-        exit(EXIT_FAILURE);
+static inline uint64_t hashMMapKey(const MMapInfo *info) {
+    uint64_t hash = ((uint64_t)(uint32_t)info->PID << 32 | info->FileId) * 0x9E3779B97F4A7C15ULL;
+    hash = (hash ^ info->MMapAddress) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ info->Size) * 0x94D049BB133111EBULL;
+    hash = (hash ^ info->Offset) * 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 31);
+}
+
+static void insertMMapIndex(MMapTable *table, size_t entry) {
+    size_t mask = table->IndexCapacity - 1;
+    size_t index = hashMMapKey(&table->Entries[entry]) & mask;
+    while (table->Index[index] != 0) {
+        index = (index + 1) & mask;
     }
-    newNode->info = *info;
-    newNode->next = *head;
-    *head = newNode;
+    table->Index[index] = (uint32_t)entry + 1;
 }
 
-void printMMapInfo(MMapNode *head, FILE *outputFile) {
-    MMapNode *current = head;
-    while (current) {
-        fprintf(outputFile, "%s : %d [0x%lx, 0x%lx @ 0x%lx]\n",
-                current->info.FileName, current->info.PID, current->info.MMapAddress, current->info.Size, current->info.Offset);
-        current = current->next;
+void addMMapInfo(MMapTable *table, MMapInfo *info) {
+    if (table->Size == table->Capacity) {
+        size_t capacity = table->Capacity ? table->Capacity * 2 : INITIAL_TABLE_SIZE;
+        MMapInfo *entries = (MMapInfo *)realloc(table->Entries, capacity * sizeof(MMapInfo));
+        if (!entries) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        table->Entries = entries;
+        table->Capacity = capacity;
+    }
+    if ((table->Size + 1) * 2 > table->IndexCapacity) {
+        size_t capacity = table->IndexCapacity ? table->IndexCapacity * 2 : INITIAL_TABLE_SIZE;
+        uint32_t *slots = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+        if (!slots) {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        free(table->Index);
+        table->Index = slots;
+        table->IndexCapacity = capacity;
+        for (size_t i = 0; i < table->Size; ++i) {
+            insertMMapIndex(table, i);
+        }
     }
+    table->Entries[table->Size++] = *info;
+    insertMMapIndex(table, table->Size - 1);
 }
 
-void freeMMapInfo(MMapNode *head) {
-    MMapNode *current = head;
-    while (current) {
-        MMapNode *temp = current;
-        current = current->next;
-        free(temp);
+void printMMapInfo(MMapTable *table, FILE *outputFile) {
+    // 与原来的链表（头插法）保持一致，后加入的映射先输出
+    for (size_t i = table->Size; i-- > 0;) {
+        const MMapInfo *info = &table->Entries[i];
+        fprintf(outputFile, "%s : %d [0x%lx, 0x%lx @ 0x%lx]\n",
+                table->FileNames.Data + table->FileNames.Offsets[info->FileId], info->PID, info->MMapAddress, info->Size, info->Offset);
     }
 }
 
-int isDuplicate(MMapNode *head, MMapInfo *info) {
-    MMapNode *current = head;
-    while (current) {
-        if (current->info.PID == info->PID && strcmp(current->info.FileName, info->FileName) == 0) {
+void freeMMapInfo(MMapTable *table) {
+    free(table->Entries);
+    free(table->Index);
+    free(table->FileNames.Data);
+    free(table->FileNames.Offsets);
+    free(table->FileNames.Slots);
+    memset(table, 0, sizeof(*table));
+}
+
+int isDuplicate(MMapTable *table, MMapInfo *info) {
+    if (table->IndexCapacity == 0) return 0;
+    size_t mask = table->IndexCapacity - 1;
+    size_t index = hashMMapKey(info) & mask;
+    while (table->Index[index] != 0) {
+        const MMapInfo *other = &table->Entries[table->Index[index] - 1];
+        if (other->PID == info->PID && other->FileId == info->FileId && other->MMapAddress == info->MMapAddress &&
+            other->Size == info->Size && other->Offset == info->Offset) {
             return 1;
         }
-        current = current->next;
+        index = (index + 1) & mask;
     }
     return 0;
 }
 
+static inline uint64_t hashString(const char *str, size_t len) {
+    uint64_t hash = 0xCBF29CE484222325ULL;  // FNV-1a
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ (uint8_t)str[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// 返回字符串在池中的编号，第一次出现时拷贝一份，内存不足时返回INVALID_STRING_ID
+uint32_t internString(StringPool *pool, const char *str, size_t len) {
+    if ((pool->Count + 1) * 2 > pool->SlotCapacity) {
+        uint32_t capacity = pool->SlotCapacity ? pool->SlotCapacity * 2 : INITIAL_TABLE_SIZE;
+        uint32_t *slots = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+        if (!slots) return INVALID_STRING_ID;
+        for (uint32_t id = 0; id < pool->Count; ++id) {
+            const char *old = pool->Data + pool->Offsets[id];
+            size_t index = hashString(old, strlen(old)) & (capacity - 1);
+            while (slots[index] != 0) {
+                index = (index + 1) & (capacity - 1);
+            }
+            slots[index] = id + 1;
+        }
+        free(pool->Slots);
+        pool->Slots = slots;
+        pool->SlotCapacity = capacity;
+    }
+
+    size_t mask = pool->SlotCapacity - 1;
+    size_t index = hashString(str, len) & mask;
+    while (pool->Slots[index] != 0) {
+        const char *candidate = pool->Data + pool->Offsets[pool->Slots[index] - 1];
+        if (strncmp(candidate, str, len) == 0 && candidate[len] == '\0') {
+            return pool->Slots[index] - 1;
+        }
+        index = (index + 1) & mask;
+    }
+
+    if (pool->Size + len + 1 > pool->Capacity) {
+        size_t capacity = pool->Capacity ? pool->Capacity : 4096;
+        while (pool->Size + len + 1 > capacity) capacity *= 2;
+        char *data = (char *)realloc(pool->Data, capacity);
+        if (!data) return INVALID_STRING_ID;
+        pool->Data = data;
+        pool->Capacity = capacity;
+    }
+    if (pool->Count == pool->OffsetCapacity) {
+        uint32_t capacity = pool->OffsetCapacity ? pool->OffsetCapacity * 2 : INITIAL_TABLE_SIZE;
+        uint32_t *offsets = (uint32_t *)realloc(pool->Offsets, capacity * sizeof(uint32_t));
+        if (!offsets) return INVALID_STRING_ID;
+        pool->Offsets = offsets;
+        pool->OffsetCapacity = capacity;
+    }
+    memcpy(pool->Data + pool->Size, str, len);
+    pool->Data[pool->Size + len] = '\0';
+    pool->Offsets[pool->Count] = (uint32_t)pool->Size;
+    pool->Size += len + 1;
+    pool->Slots[index] = pool->Count + 1;
+    return pool->Count++;
+}
+
 int isValidPID(int pid) {
     return pid != -1;
 }
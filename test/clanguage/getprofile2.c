@@ -7,10 +7,12 @@
 
 
 #define BUFFER_SIZE 1024
-#define MAX_MMAP_INFO 1000
+#define INITIAL_MMAP_INFO_SIZE 1024  // 哈希表的初始槽数，必须是2的幂
+#define EMPTY_PID -1
+#define DELETED_PID -2
 
 typedef struct {
-    int PID;
+    int PID;  // EMPTY_PID表示空槽，DELETED_PID表示已删除
     uint64_t MMapAddress;
     uint64_t Size;
     int forked;
@@ -22,39 +24,86 @@ typedef struct {
     unsigned long Time;
 } ForkInfo;
 
-MMapInfo MMapInfoArray[MAX_MMAP_INFO];
-int MMapInfoSize = 0;
+// 以PID为key的开放寻址哈希表，查找、插入、删除都是O(1)，负载（含墓碑）超过一半时扩容
+MMapInfo *MMapInfoArray = NULL;
+size_t MMapInfoCapacity = 0;
+size_t MMapInfoSize = 0;
+size_t MMapInfoUsed = 0;  // 有效的项加上墓碑
+
+static inline size_t hashPID(int pid, size_t capacity) {
+    return (size_t)(((uint64_t)(uint32_t)pid * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+}
 
 // 查找指定PID的MMapInfo
 MMapInfo* findMMapInfo(int pid) {
-    for (int i = 0; i < MMapInfoSize; ++i) {
-        if (MMapInfoArray[i].PID == pid) {
-            return &MMapInfoArray[i];
+    if (MMapInfoCapacity == 0) return NULL;
+    size_t index = hashPID(pid, MMapInfoCapacity);
+    while (MMapInfoArray[index].PID != EMPTY_PID) {
+        if (MMapInfoArray[index].PID == pid) {
+            return &MMapInfoArray[index];
         }
+        index = (index + 1) & (MMapInfoCapacity - 1);
     }
     return NULL;
 }
 
-// 插入新的MMapInfo
-void insertMMapInfo(MMapInfo *info) {
-    if (MMapInfoSize < MAX_MMAP_INFO) {
-        MMapInfoArray[MMapInfoSize++] = *info;
-    } else {
-        fprintf(stderr, "MMapInfoArray is full!\n");
+// 扩容（或者只清理墓碑）后重新插入所有项
+int rehashMMapInfo(size_t capacity) {
+    MMapInfo *slots = (MMapInfo *)malloc(capacity * sizeof(MMapInfo));
+    if (!slots) return -1;
+    for (size_t i = 0; i < capacity; ++i) {
+        slots[i].PID = EMPTY_PID;
+    }
+    for (size_t i = 0; i < MMapInfoCapacity; ++i) {
+        if (MMapInfoArray[i].PID < 0) continue;
+        size_t index = hashPID(MMapInfoArray[i].PID, capacity);
+        while (slots[index].PID != EMPTY_PID) {
+            index = (index + 1) & (capacity - 1);
+        }
+        slots[index] = MMapInfoArray[i];
     }
+    free(MMapInfoArray);
+    MMapInfoArray = slots;
+    MMapInfoCapacity = capacity;
+    MMapInfoUsed = MMapInfoSize;
+    return 0;
 }
 
-// 从列表中移除PID
-void removeMMapInfo(int pid) {
-    for (int i = 0; i < MMapInfoSize; ++i) {
-        if (MMapInfoArray[i].PID == pid && MMapInfoArray[i].forked) {
-            for (int j = i; j < MMapInfoSize - 1; ++j) {
-                MMapInfoArray[j] = MMapInfoArray[j + 1];
-            }
-            MMapInfoSize--;
+// 插入新的MMapInfo，PID已存在时覆盖（是否允许覆盖由调用者判断）
+void insertMMapInfo(MMapInfo *info) {
+    MMapInfo *existing = findMMapInfo(info->PID);
+    if (existing) {
+        *existing = *info;
+        return;
+    }
+    if ((MMapInfoUsed + 1) * 2 > MMapInfoCapacity) {
+        size_t capacity = MMapInfoCapacity ? MMapInfoCapacity : INITIAL_MMAP_INFO_SIZE;
+        if ((MMapInfoSize + 1) * 4 > capacity) {
+            capacity *= 2;
+        }
+        if (rehashMMapInfo(capacity) != 0) {
+            fprintf(stderr, "Error allocating memory for MMapInfoArray\n");
             return;
         }
     }
+    size_t index = hashPID(info->PID, MMapInfoCapacity);
+    while (MMapInfoArray[index].PID >= 0) {
+        index = (index + 1) & (MMapInfoCapacity - 1);
+    }
+    if (MMapInfoArray[index].PID == EMPTY_PID) {
+        ++MMapInfoUsed;
+    }
+    ++MMapInfoSize;
+    MMapInfoArray[index] = *info;
+}
+
+// 从列表中移除PID，只留下墓碑
+void removeMMapInfo(int pid) {
+    MMapInfo *info = findMMapInfo(pid);
+    if (info && info->forked) {
+        info->PID = DELETED_PID;
+        --MMapInfoSize;
+    }
 }
 
 // 解析 "PERF_RECORD_COMM exec" 行中的 PID
@@ -110,6 +159,11 @@ int parseTaskEvents(FILE *file) {
         printf("Processing ForkEvent: ParentPID: %d, ChildPID: %d, Time: %lu\n",
                forkInfo.ParentPID, forkInfo.ChildPID, forkInfo.Time);
 
+        // 与task.c的handleForkEvent规则相同：FORK到仍然存活的PID上时忽略，不覆盖它自己的映射；
+        // 这里没有EXIT事件，fork复制出来的项说明旧的子进程已经不在了，可以被新的子进程替换
+        MMapInfo *existing = findMMapInfo(forkInfo.ChildPID);
+        if (existing && !existing->forked) continue;
+
         MMapInfo *parentInfo = findMMapInfo(forkInfo.ParentPID);
         if (!parentInfo) continue;
 
@@ -142,6 +196,7 @@ int main(int argc, char *argv[]) {
 
     int result = parseTaskEvents(file);
     fclose(file);
+    free(MMapInfoArray);
 
     return result;
 }
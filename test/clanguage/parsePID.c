@@ -1,81 +1,199 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <regex.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#define BUFFER_SIZE 1024
+#define SCAN_WINDOW_SIZE (64UL << 20)  // 每次mmap的窗口大小
+#define SCAN_READ_SIZE (1UL << 20)     // 无法mmap的输入（管道等）每次read的大小
 
-void extract_pids(const char *input_file_path, const char *output_file_path) {
-    FILE *input_file;
-    FILE *output_file;
-    char *data;
-    size_t file_size;
-    regex_t regex;
-    regmatch_t matches[2];
-    const char *pattern = "^([0-9]+)\\s";
-    size_t read_size;
-
-    // 编译正则表达式
-    if (regcomp(&regex, pattern, REG_EXTENDED) != 0) {
-        fprintf(stderr, "Could not compile regex\n");
-        exit(1);
+/*
+ * 该结构体的功能：按行扫描输入文件，每一行以(指针, 长度)的形式指向映射区域，不做拷贝
+ * 普通文件以滑动窗口的方式mmap，可以处理比内存还大的文件；管道等无法mmap的输入退化为read到缓冲区
+ * */
+typedef struct {
+    int fd;
+    bool Mapped;
+    uint64_t FileSize;
+    uint64_t WindowOffset;   // 当前窗口在文件中的偏移，按页对齐
+    char *Window;
+    size_t WindowSize;       // 当前窗口中有效数据的长度
+    size_t WindowCapacity;   // mmap窗口的大小或者read缓冲区的容量
+    size_t Pos;              // 下一行在窗口中的起始位置
+    bool Eof;
+} LineScanner;
+
+typedef struct {
+    const char *Data;
+    size_t Len;
+} LineView;
+
+/*
+ * 该函数的主要功能：打开按行扫描的输入，"-"表示标准输入
+ * */
+bool openLineScanner(LineScanner *scanner, const char *filename) {
+    memset(scanner, 0, sizeof(*scanner));
+    scanner->fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (scanner->fd == -1) {
+        return false;
     }
 
-    // 打开输入文件
-    input_file = fopen(input_file_path, "rb");
-    if (input_file == NULL) {
-        perror("Error opening input file");
-        regfree(&regex);
-        exit(1);
+    struct stat st;
+    if (fstat(scanner->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        scanner->Mapped = true;
+        scanner->FileSize = st.st_size;
+        scanner->WindowCapacity = SCAN_WINDOW_SIZE;
+        return true;
     }
 
-    // 获取文件大小
-    fseek(input_file, 0, SEEK_END);
-    file_size = ftell(input_file);
-    fseek(input_file, 0, SEEK_SET);
-
-    // 分配内存并读取整个文件内容
-    data = (char *)malloc(file_size + 1);
-    if (data == NULL) {
-        fprintf(stderr, "Memory allocation failed\n");
-        fclose(input_file);
-        regfree(&regex);
-        exit(1);
+    scanner->WindowCapacity = SCAN_READ_SIZE;
+    scanner->Window = (char *)malloc(scanner->WindowCapacity);
+    if (!scanner->Window) {
+        if (scanner->fd != STDIN_FILENO) close(scanner->fd);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * 该函数的主要功能：从文件偏移LineStart开始重新映射窗口，保证窗口中至少有MinSize字节
+ * */
+bool remapLineScanner(LineScanner *scanner, uint64_t LineStart, size_t MinSize) {
+    uint64_t PageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t Offset = LineStart & ~(PageSize - 1);
+    size_t Size = scanner->WindowCapacity;
+    while (Size < LineStart - Offset + MinSize) {
+        Size *= 2;
+    }
+    if (Offset + Size > scanner->FileSize) {
+        Size = scanner->FileSize - Offset;
+    }
+
+    if (scanner->Window) {
+        munmap(scanner->Window, scanner->WindowSize);
+        scanner->Window = NULL;
+    }
+    void *Window = mmap(NULL, Size, PROT_READ, MAP_PRIVATE, scanner->fd, Offset);
+    if (Window == MAP_FAILED) {
+        scanner->WindowSize = 0;
+        return false;
     }
+    madvise(Window, Size, MADV_SEQUENTIAL);
+    scanner->Window = (char *)Window;
+    scanner->WindowSize = Size;
+    scanner->WindowOffset = Offset;
+    scanner->Pos = LineStart - Offset;
+    return true;
+}
+
+/*
+ * 该函数的主要功能：返回下一行（不含换行符），返回的视图在下一次调用之前有效
+ * */
+bool nextLine(LineScanner *scanner, LineView *line) {
+    for (;;) {
+        size_t Remaining = scanner->WindowSize - scanner->Pos;
+        const char *Start = scanner->Window + scanner->Pos;
+        const char *NewLine = Remaining ? (const char *)memchr(Start, '\n', Remaining) : NULL;
+        if (NewLine) {
+            line->Data = Start;
+            line->Len = NewLine - Start;
+            scanner->Pos += line->Len + 1;
+            return true;
+        }
+
+        bool AtEnd = scanner->Mapped ? scanner->WindowOffset + scanner->WindowSize >= scanner->FileSize
+                                     : scanner->Eof;
+        if (AtEnd) {
+            // 最后一行没有换行符
+            if (Remaining == 0) {
+                return false;
+            }
+            line->Data = Start;
+            line->Len = Remaining;
+            scanner->Pos = scanner->WindowSize;
+            return true;
+        }
+
+        if (scanner->Mapped) {
+            // 当前行跨越了窗口边界，从行首开始重新映射
+            if (!remapLineScanner(scanner, scanner->WindowOffset + scanner->Pos, Remaining + 1)) {
+                return false;
+            }
+            continue;
+        }
 
-    read_size = fread(data, 1, file_size, input_file);
-    if (read_size != file_size) {
-        fprintf(stderr, "Error reading file\n");
-        free(data);
-        fclose(input_file);
-        regfree(&regex);
+        // read模式：把未处理完的数据移到缓冲区开头，缓冲区满了就扩容
+        memmove(scanner->Window, Start, Remaining);
+        scanner->WindowSize = Remaining;
+        scanner->Pos = 0;
+        if (scanner->WindowSize == scanner->WindowCapacity) {
+            char *NewWindow = (char *)realloc(scanner->Window, scanner->WindowCapacity * 2);
+            if (!NewWindow) {
+                return false;
+            }
+            scanner->Window = NewWindow;
+            scanner->WindowCapacity *= 2;
+        }
+        ssize_t n = read(scanner->fd, scanner->Window + scanner->WindowSize,
+                         scanner->WindowCapacity - scanner->WindowSize);
+        if (n <= 0) {
+            scanner->Eof = true;
+        } else {
+            scanner->WindowSize += n;
+        }
+    }
+}
+
+void closeLineScanner(LineScanner *scanner) {
+    if (scanner->Mapped) {
+        if (scanner->Window) munmap(scanner->Window, scanner->WindowSize);
+    } else {
+        free(scanner->Window);
+    }
+    if (scanner->fd != STDIN_FILENO) {
+        close(scanner->fd);
+    }
+}
+
+void extract_pids(const char *input_file_path, const char *output_file_path) {
+    LineScanner scanner;
+    FILE *output_file;
+
+    // 打开输入文件，按行扫描映射区域，不再把整个文件读入内存
+    if (!openLineScanner(&scanner, input_file_path)) {
+        perror("Error opening input file");
         exit(1);
     }
-    data[file_size] = '\0'; // 添加字符串终止符
 
     // 打开输出文件
     output_file = fopen(output_file_path, "w");
     if (output_file == NULL) {
         perror("Error opening output file");
-        free(data);
-        fclose(input_file);
-        regfree(&regex);
+        closeLineScanner(&scanner);
         exit(1);
     }
 
-    // 在整个文件内容中匹配正则表达式并写入输出文件
-    const char *current_pos = data;
-    while (regexec(&regex, current_pos, 2, matches, 0) == 0) {
-        // 写入匹配的 PID 到输出文件
-        fprintf(output_file, "%.*s\n", (int)(matches[1].rm_eo - matches[1].rm_so), current_pos + matches[1].rm_so);
-        current_pos += matches[1].rm_eo;
+    // 每一行匹配 ^\s*([0-9]+)\s ，把PID写入输出文件（perf script输出的PID前面有对齐用的空格）
+    LineView line;
+    while (nextLine(&scanner, &line)) {
+        const char *ptr = line.Data;
+        const char *end = line.Data + line.Len;
+        while (ptr < end && (*ptr == ' ' || *ptr == '\t')) ptr++;
+        const char *pid = ptr;
+        while (ptr < end && *ptr >= '0' && *ptr <= '9') ptr++;
+        if (ptr == pid || ptr == end || (*ptr != ' ' && *ptr != '\t')) {
+            continue;
+        }
+        fprintf(output_file, "%.*s\n", (int)(ptr - pid), pid);
     }
 
     // 释放资源
-    free(data);
-    fclose(input_file);
+    closeLineScanner(&scanner);
     fclose(output_file);
-    regfree(&regex);
 }
 
 int main(int argc, char *argv[]) {
@@ -7,59 +7,337 @@
 #include <inttypes.h>
 #include <assert.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <spawn.h>
 
 #define MAX_COMMAND_LENGTH 1024  // 最大命令长度
 #define TEMP_FILE_TEMPLATE "/home/dushuai/study/bolt/test/perf_output_XXXXXX"  // 临时文件目录
 #define TEMP_MMAP_FILE "/home/dushuai/study/bolt/test/perf_mmap"
 #define BUFFER_SIZE 1024
-#define MAX_MMAP_INFO 1000
+#define INITIAL_PROCESS_TABLE_SIZE 1024  // PID哈希表的初始槽数，必须是2的幂
+#define INITIAL_MMAP_SET_SIZE 4
+#define EMPTY_PID -1
+#define DELETED_PID -2
+#define MAX_PERF_ARGS 32
+#define STREAM_BUFFER_SIZE (1 << 20)
+#define BRANCH_PARSER "./branch1"  // --stream时解析brstack和mem输出的程序，可以用环境变量BRANCH_PARSER覆盖
+
+extern char **environ;
 
 /* 结构体定义 */
 // mmap事件相关
 #define MAX_LINE_LENGTH 1024
-#define MAX_FILENAME_LENGTH 256
+#define INITIAL_STRING_POOL_SIZE 256  // 字符串池哈希表的初始槽数，必须是2的幂
+#define INVALID_STRING_ID UINT32_MAX
+
+// 文件名字符串池，同一个路径只保存一份，映射里只记录它的编号
+typedef struct {
+    char *Data;           // 所有字符串依次存放，以'\0'分隔
+    size_t Size;
+    size_t Capacity;
+    uint32_t *Offsets;    // 编号到Data中的偏移
+    uint32_t Count;
+    uint32_t OffsetCapacity;
+    uint32_t *Slots;      // 开放寻址哈希表，保存编号+1，0表示空槽
+    uint32_t SlotCapacity;
+} StringPool;
 
+// 文件名换成字符串池中的编号后，一项只有48字节
 typedef struct {
     uint64_t Time;
-    int PID;
     uint64_t MMapAddress;
     uint64_t Size;
     uint64_t Offset;
-    char FileName[MAX_FILENAME_LENGTH];
-    int forked;
+    int PID;
+    uint32_t FileId;
 } MMapInfo;
 
-MMapInfo BinaryMMapInfo[MAX_MMAP_INFO];
-int BinaryMMapInfoSize = 0;
+// 一个进程的mmap信息集合，fork出来的子进程与父进程共享同一个集合，
+// 直到其中一方添加新的映射时才复制一份（copy-on-write），fork本身是O(1)的
+typedef struct {
+    int RefCount;
+    int Size;
+    int Capacity;
+    MMapInfo *Entries;
+    uint32_t *Index;      // 按(文件, 地址, 大小, 偏移)去重的哈希表，保存下标+1，0表示空槽
+    int IndexCapacity;
+} MMapSet;
+
+// PID哈希表中的一项
+typedef struct {
+    int PID;       // EMPTY_PID表示空槽，DELETED_PID表示已删除
+    int forked;
+    bool Exited;   // 已经退出，PID再次出现（FORK、MMAP、COMM exec）时说明被新进程复用
+    uint64_t Seq;  // 创建顺序，输出时按该顺序，与哈希表的槽顺序无关
+    MMapSet *Maps;
+} ProcessInfo;
+
+// 以PID为key的开放寻址哈希表，删除时留下墓碑，负载（含墓碑）超过一半时扩容
+typedef struct {
+    ProcessInfo *Slots;
+    size_t Capacity;
+    size_t Size;  // 有效的项
+    size_t Used;  // 有效的项加上墓碑
+    uint64_t NextSeq;
+} ProcessTable;
+
+ProcessTable Processes;
+StringPool FileNames;
+
+// --stream时<perf.data>之后的参数转给branch1，只接受下表中的选项：HasValue表示后面带一个值，
+// Mem表示--mem那一遍也需要（只对brstack有意义的选项不传给它）
+typedef struct {
+    const char *Name;
+    bool HasValue;
+    bool Mem;
+} ParserOption;
+
+const ParserOption ParserOptions[] = {
+    {"--threads", true, true},
+    {"--binary", true, true},
+    {"--extra-fields", false, false},
+    {"--aggregate", false, false},
+    {"--compact", false, false},
+    {"--mmap", true, true},
+    {"--exec-name", true, true},
+    {"--all-dsos", false, false},
+    {"--sample-rate", true, false},
+    {"--max-samples", true, false},
+    {"--time-budget", true, false},
+};
+
+char **ParserArgs = NULL;
+int NumParserArgs = 0;
+
+// branch事件相关（与branch1.c中的定义对应，额外保存perf_branch_entry的原始标志位）
+#define INITIAL_LBR_CAPACITY 32
+#define TEMP_BRANCH_FILE "perf_branch.log"
+#define TEMP_MEM_FILE "perf_mem.log"
+
+typedef struct {
+    uint64_t from;
+    uint64_t to;
+    int mispred;
+    uint64_t flags;
+} LBREntry;
+
+typedef struct {
+    LBREntry *LBR;
+    size_t LBRCount;
+    size_t LBRCapacity;
+    uint64_t PC;
+    uint64_t PID;
+} PerfBranchSample;
+
+// perf.data文件格式相关，参考linux/perf_event.h和tools/perf/util/header.h
+#define PERF_MAGIC2 0x32454c4946524550ULL  // "PERFILE2"
+#define PERF_RECORD_MMAP 1
+#define PERF_RECORD_COMM 3
+#define PERF_RECORD_EXIT 4
+#define PERF_RECORD_FORK 7
+#define PERF_RECORD_SAMPLE 9
+#define PERF_RECORD_MMAP2 10
+#define PERF_RECORD_FINISHED_ROUND 68
+#define PERF_RECORD_MISC_COMM_EXEC (1 << 13)
+
+#define PERF_SAMPLE_IP (1ULL << 0)
+#define PERF_SAMPLE_TID (1ULL << 1)
+#define PERF_SAMPLE_TIME (1ULL << 2)
+#define PERF_SAMPLE_ADDR (1ULL << 3)
+#define PERF_SAMPLE_READ (1ULL << 4)
+#define PERF_SAMPLE_CALLCHAIN (1ULL << 5)
+#define PERF_SAMPLE_ID (1ULL << 6)
+#define PERF_SAMPLE_CPU (1ULL << 7)
+#define PERF_SAMPLE_PERIOD (1ULL << 8)
+#define PERF_SAMPLE_STREAM_ID (1ULL << 9)
+#define PERF_SAMPLE_RAW (1ULL << 10)
+#define PERF_SAMPLE_BRANCH_STACK (1ULL << 11)
+#define PERF_SAMPLE_IDENTIFIER (1ULL << 16)
+
+#define PERF_FORMAT_TOTAL_TIME_ENABLED (1ULL << 0)
+#define PERF_FORMAT_TOTAL_TIME_RUNNING (1ULL << 1)
+#define PERF_FORMAT_ID (1ULL << 2)
+#define PERF_FORMAT_GROUP (1ULL << 3)
+#define PERF_FORMAT_LOST (1ULL << 4)
+
+#define PERF_SAMPLE_BRANCH_HW_INDEX (1ULL << 17)
+#define PERF_ATTR_SAMPLE_ID_ALL (1ULL << 18)
+#define PERF_BRANCH_ENTRY_SIZE 24
+
+#define HEADER_EVENT_DESC 12
+#define HEADER_FEAT_BITS 256
+#define MAX_EVENT_NAME_LENGTH 64
+
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} PerfFileSection;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t size;
+    uint64_t attr_size;
+    PerfFileSection attrs;
+    PerfFileSection data;
+    PerfFileSection event_types;
+    uint64_t adds_features[HEADER_FEAT_BITS / 64];
+} PerfFileHeader;
+
+typedef struct {
+    uint32_t type;
+    uint16_t misc;
+    uint16_t size;
+} PerfEventHeader;
+
+// 每个perf_event_attr中解析记录时需要用到的信息
+typedef struct {
+    uint64_t SampleType;
+    uint64_t ReadFormat;
+    uint64_t BranchSampleType;
+    bool SampleIdAll;
+    const uint64_t *IDs;
+    size_t NumIDs;
+    char Name[MAX_EVENT_NAME_LENGTH];
+} PerfAttrInfo;
+
+// 通过mmap映射的perf.data文件
+typedef struct {
+    const uint8_t *Data;
+    size_t Size;
+    PerfFileHeader Header;
+    PerfAttrInfo *Attrs;
+    size_t NumAttrs;
+} PerfDataFile;
+
+// 从PERF_RECORD_SAMPLE中解析出来的字段
+typedef struct {
+    const PerfAttrInfo *Attr;
+    int PID;
+    uint64_t Time;
+    uint64_t IP;
+    uint64_t Addr;
+    uint64_t NumBranches;
+    const uint8_t *Branches;  // 指向记录中的perf_branch_entry数组
+} PerfSampleRecord;
+
+// 排序队列中的记录，记录内容直接指向mmap映射的文件，不做拷贝
+typedef struct {
+    uint64_t Time;
+    uint64_t Seq;
+    const uint8_t *Record;
+} PerfQueuedEvent;
+
+// 单次遍历perf.data时各个事件处理函数共享的状态
+typedef struct {
+    const PerfDataFile *Perf;
+    FILE *BranchFile;
+    FILE *MemFile;
+    PerfBranchSample BranchSample;
+    PerfQueuedEvent *Queue;
+    size_t QueueSize;
+    size_t QueueCapacity;
+    uint64_t NumMMapEvents;
+    uint64_t NumTaskEvents;
+    uint64_t NumBranchSamples;
+    uint64_t NumMemSamples;
+} PerfEventDispatcher;
 
 /* 函数定义 */
 // 执行perf命令相关
 bool checkPerfDataMagic(const char *FileName);
 char* find_perf_path();
 void execute_perf_command(const char *perf_path, const char *filename, const char *args, int id);
+void stream_perf_command(const char *perf_path, const char *filename, const char *args, int id);
+void copyStream(FILE *input, const char *output_path);
+const ParserOption* findParserOption(const char *name);
+bool checkParserArgs(char **args, int count);
+pid_t spawn_branch_parser(int input_fd, bool mem);
 // 处理mmap事件相关
 void parseMMapEvents(FILE *file);
 void printMMapInfo(FILE *outputFile);
-int isDuplicate(MMapInfo *info);
+void addMMapInfo(MMapInfo *info);
+int isDuplicate(const MMapSet *maps, MMapInfo *info);
+void insertMMapIndex(MMapSet *maps, int entry);
+bool rebuildMMapIndex(MMapSet *maps, int capacity);
+// 文件名字符串池相关
+uint32_t internString(StringPool *pool, const char *str, size_t len);
+const char* getPooledString(const StringPool *pool, uint32_t id);
 int isValidPID(int pid);
 int isDeletedFile(const char *fileName);
+// 进程表相关
+ProcessInfo* findProcess(int pid);
+ProcessInfo* insertProcess(int pid);
+void removeProcess(int pid);
+void resetExitedProcess(ProcessInfo *process);
+void releaseMMapSet(MMapSet *maps);
+MMapSet* getWritableMMapSet(ProcessInfo *process);
 // 处理task events相关
-MMapInfo* findMMapInfo(int pid);
-void removeMMapInfo(int pid);
 int parseCommExecEvent(const char *line, int *pid);
 int parseTaskEvents(FILE *file);
+void handleCommExecEvent(int pid);
+void handleForkEvent(int parentPID, int childPID);
+void handleExitEvent(int pid);
+// 直接读取perf.data相关
+bool openPerfDataFile(const char *filename, PerfDataFile *perf);
+void closePerfDataFile(PerfDataFile *perf);
+void readPerfEventDesc(PerfDataFile *perf);
+const PerfAttrInfo* findPerfAttr(const PerfDataFile *perf, const uint8_t *body, size_t size);
+bool parsePerfSample(const PerfDataFile *perf, const uint8_t *body, size_t size, PerfSampleRecord *sample);
+uint64_t parseSampleIdTime(const PerfDataFile *perf, const uint8_t *body, size_t size);
+bool fillBranchSample(const PerfSampleRecord *record, PerfBranchSample *sample);
+void writeBranchSample(FILE *file, const PerfBranchSample *sample);
+uint64_t getPerfRecordTime(const PerfDataFile *perf, const uint8_t *record);
+bool queuePerfEvent(PerfEventDispatcher *dispatcher, const uint8_t *record, uint64_t seq);
+void flushPerfEvents(PerfEventDispatcher *dispatcher, uint64_t limit);
+void dispatchPerfEvent(PerfEventDispatcher *dispatcher, const uint8_t *record);
+void handleMMapRecord(PerfEventDispatcher *dispatcher, const PerfEventHeader *header, const uint8_t *body, size_t size);
+void handleTaskRecord(PerfEventDispatcher *dispatcher, const PerfEventHeader *header, const uint8_t *body, size_t size);
+void handleSampleRecord(PerfEventDispatcher *dispatcher, const uint8_t *body, size_t size);
+int processPerfData(const char *filename);
 
 int main(int argc, char *argv[]) {
-    assert(argc >= 2 && "Usage: <filename> is required");
+    assert(argc >= 2 && "Usage: [--native|--stream] <filename> [branch1 options] is required");
 
-    if (checkPerfDataMagic(argv[1])) {
+    // --native: 不再调用perf script，直接解析perf.data的二进制格式
+    // --stream: 仍然调用perf script，但通过管道边读边解析，不再生成临时文件
+    bool UseNativeReader = false;
+    bool UseStream = false;
+    const char *filename = argv[1];
+    if (strcmp(argv[1], "--native") == 0 || strcmp(argv[1], "--stream") == 0) {
+        assert(argc >= 3 && "Usage: [--native|--stream] <filename> [branch1 options] is required");
+        UseNativeReader = strcmp(argv[1], "--native") == 0;
+        UseStream = !UseNativeReader;
+        filename = argv[2];
+        if (UseStream) {
+            ParserArgs = argv + 3;
+            NumParserArgs = argc - 3;
+        }
+    }
+    if (!checkParserArgs(ParserArgs, NumParserArgs)) {
+        return 1;
+    }
+
+    if (checkPerfDataMagic(filename)) {
+        if (UseNativeReader) {
+            return processPerfData(filename);
+        }
         char *perf_path = find_perf_path();
         assert(perf_path != NULL && "Failed to find perf path");
         printf("perf路径为：%s\n", perf_path);
-        execute_perf_command(perf_path, argv[1], "--show-mmap-events --no-itrace", 3);
-        execute_perf_command(perf_path, argv[1], "--show-task-events --no-itrace", 4);
-        execute_perf_command(perf_path, argv[1], "-F pid,ip,brstack", 1);
-        execute_perf_command(perf_path, argv[1], "-F pid,event,addr,ip", 2);
+        if (UseStream) {
+            stream_perf_command(perf_path, filename, "--show-mmap-events --no-itrace", 3);
+            stream_perf_command(perf_path, filename, "--show-task-events --no-itrace", 4);
+            stream_perf_command(perf_path, filename, "-F pid,ip,brstack", 1);
+            stream_perf_command(perf_path, filename, "-F pid,event,addr,ip", 2);
+            return 0;
+        }
+        execute_perf_command(perf_path, filename, "--show-mmap-events --no-itrace", 3);
+        execute_perf_command(perf_path, filename, "--show-task-events --no-itrace", 4);
+        execute_perf_command(perf_path, filename, "-F pid,ip,brstack", 1);
+        execute_perf_command(perf_path, filename, "-F pid,event,addr,ip", 2);
     } else {
         printf("File does not contain the magic number 'PERFILE'.\n");
     }
@@ -147,7 +425,9 @@ void execute_perf_command(const char *perf_path, const char *filename, const cha
             printf("Processing output for ID 1 from file: %s\n", temp_file_path);
             break;
         case 2:
+            // 访存sample由branch1 --mem按(代码地址, 数据地址)聚合，这里只保存到固定的文件名
             printf("Processing output for ID 2 from file: %s\n", temp_file_path);
+            copyStream(output_file, TEMP_MEM_FILE);
             break;
         case 3:
             printf("Processing output for ID 3 from file: %s\n", temp_file_path);
@@ -177,6 +457,197 @@ void execute_perf_command(const char *perf_path, const char *filename, const cha
     // unlink(temp_file_path);
 }
 
+// 通过posix_spawn直接启动perf（不经过shell），perf的标准输出接到管道上，边输出边解析
+void stream_perf_command(const char *perf_path, const char *filename, const char *args, int id) {
+    char args_copy[MAX_COMMAND_LENGTH];
+    char *perf_argv[MAX_PERF_ARGS];
+    int perf_argc = 0;
+
+    snprintf(args_copy, sizeof(args_copy), "%s", args);
+    perf_argv[perf_argc++] = (char *)perf_path;
+    perf_argv[perf_argc++] = "script";
+    char *saveptr;
+    for (char *token = strtok_r(args_copy, " ", &saveptr); token; token = strtok_r(NULL, " ", &saveptr)) {
+        if (perf_argc >= MAX_PERF_ARGS - 5) {
+            printf("Warning: too many perf arguments: %s\n", args);
+            return;
+        }
+        perf_argv[perf_argc++] = token;
+    }
+    perf_argv[perf_argc++] = "-f";
+    perf_argv[perf_argc++] = "-i";
+    perf_argv[perf_argc++] = (char *)filename;
+    perf_argv[perf_argc] = NULL;
+
+    int pipefd[2];
+    if (pipe(pipefd) != 0) {
+        perror("pipe");
+        return;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, pipefd[0]);
+    posix_spawn_file_actions_addclose(&actions, pipefd[1]);
+
+    pid_t pid;
+    int ret = posix_spawn(&pid, perf_path, &actions, NULL, perf_argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipefd[1]);
+    if (ret != 0) {
+        printf("Failed to spawn perf: %s\n", strerror(ret));
+        close(pipefd[0]);
+        return;
+    }
+    printf("Streaming output of: %s script %s -f -i %s\n", perf_path, args, filename);
+
+    if (id == 1 || id == 2) {
+        // brstack和mem的输出可能有几个GB，不经过本进程也不写文件，管道直接作为branch1的标准输入，
+        // perf script输出的同时branch1就在解析
+        pid_t parser = spawn_branch_parser(pipefd[0], id == 2);
+        close(pipefd[0]);
+        int status;
+        if (waitpid(pid, &status, 0) == -1) {
+            perror("waitpid");
+        } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("perf script exited abnormally for ID %d (status %d)\n", id, status);
+        }
+        if (parser > 0) {
+            if (waitpid(parser, &status, 0) == -1) {
+                perror("waitpid");
+            } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                printf("Branch parser exited abnormally for ID %d (status %d)\n", id, status);
+            }
+        }
+        return;
+    }
+
+    FILE *output_file = fdopen(pipefd[0], "r");
+    assert(output_file != NULL && "Failed to open perf pipe");
+    setvbuf(output_file, NULL, _IOFBF, STREAM_BUFFER_SIZE);
+
+    switch (id) {
+        case 3:
+            parseMMapEvents(output_file);
+            FILE *final_output_file = fopen(TEMP_MMAP_FILE, "w");
+            if (final_output_file) {
+                printMMapInfo(final_output_file);
+                fclose(final_output_file);
+                printf("Processed mmap events saved to: %s\n", TEMP_MMAP_FILE);
+            } else {
+                perror("fopen final_output_path");
+            }
+            break;
+        case 4:
+            if (parseTaskEvents(output_file) != 0) {
+                printf("Failed to parse task events.\n");
+            }
+            break;
+        default:
+            printf("Unknown ID: %d\n", id);
+            break;
+    }
+    fclose(output_file);
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1) {
+        perror("waitpid");
+    } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("perf script exited abnormally for ID %d (status %d)\n", id, status);
+    }
+}
+
+// 在ParserOptions中查找选项，找不到时返回NULL
+const ParserOption* findParserOption(const char *name) {
+    for (size_t i = 0; i < sizeof(ParserOptions) / sizeof(ParserOptions[0]); ++i) {
+        if (strcmp(ParserOptions[i].Name, name) == 0) {
+            return &ParserOptions[i];
+        }
+    }
+    return NULL;
+}
+
+// 检查要转给branch1的参数，--pre-aggregated、--merge等改变输入或者运行方式的选项不能用在--stream中
+bool checkParserArgs(char **args, int count) {
+    for (int i = 0; i < count; ++i) {
+        const ParserOption *option = findParserOption(args[i]);
+        if (!option) {
+            fprintf(stderr, "Option %s cannot be passed to branch1 with --stream\n", args[i]);
+            return false;
+        }
+        if (option->HasValue && ++i >= count) {
+            fprintf(stderr, "Option %s requires a value\n", option->Name);
+            return false;
+        }
+    }
+    return true;
+}
+
+// 启动branch1解析从input_fd读入的perf script输出（输入文件为/dev/stdin），mem为true时加上--mem，
+// 并且只传mem也需要的参数；失败时返回-1，input_fd由调用者关闭
+pid_t spawn_branch_parser(int input_fd, bool mem) {
+    const char *parser_path = getenv("BRANCH_PARSER");
+    if (!parser_path || !*parser_path) {
+        parser_path = BRANCH_PARSER;
+    }
+    char **parser_argv = (char **)malloc((NumParserArgs + 4) * sizeof(char *));
+    if (!parser_argv) {
+        fprintf(stderr, "Error allocating memory for parser arguments\n");
+        return -1;
+    }
+    int parser_argc = 0;
+    parser_argv[parser_argc++] = (char *)parser_path;
+    if (mem) {
+        parser_argv[parser_argc++] = "--mem";
+    }
+    for (int i = 0; i < NumParserArgs; ++i) {
+        // 参数已经由checkParserArgs检查过
+        const ParserOption *option = findParserOption(ParserArgs[i]);
+        int n = option->HasValue ? 2 : 1;
+        if (!mem || option->Mem) {
+            memcpy(parser_argv + parser_argc, ParserArgs + i, n * sizeof(char *));
+            parser_argc += n;
+        }
+        i += n - 1;
+    }
+    parser_argv[parser_argc++] = "/dev/stdin";
+    parser_argv[parser_argc] = NULL;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, input_fd, STDIN_FILENO);
+    posix_spawn_file_actions_addclose(&actions, input_fd);
+
+    pid_t pid;
+    int ret = posix_spawn(&pid, parser_path, &actions, NULL, parser_argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    free(parser_argv);
+    if (ret != 0) {
+        printf("Failed to spawn %s: %s\n", parser_path, strerror(ret));
+        return -1;
+    }
+    printf("Parsing %s samples with: %s\n", mem ? "mem" : "branch", parser_path);
+    return pid;
+}
+
+// 非--stream模式下mem的输出由后续程序解析，这里直接写入目标文件
+void copyStream(FILE *input, const char *output_path) {
+    FILE *output = fopen(output_path, "w");
+    if (!output) {
+        perror("fopen");
+        return;
+    }
+    char *buffer = (char *)malloc(STREAM_BUFFER_SIZE);
+    assert(buffer != NULL && "Failed to allocate stream buffer");
+    size_t n;
+    while ((n = fread(buffer, 1, STREAM_BUFFER_SIZE, input)) > 0) {
+        fwrite(buffer, 1, n, output);
+    }
+    free(buffer);
+    fclose(output);
+    printf("Output saved to: %s\n", output_path);
+}
+
 // 解析mmap events事件
 void parseMMapEvents(FILE *file) {
     char line[MAX_LINE_LENGTH];
@@ -184,6 +655,7 @@ void parseMMapEvents(FILE *file) {
         if (strstr(line, "PERF_RECORD_MMAP2")) {
             MMapInfo info;
             memset(&info, 0, sizeof(info));
+            info.FileId = internString(&FileNames, "", 0);
 
             const char *ptr = strstr(line, "PERF_RECORD_MMAP2");
             if (!ptr) {
@@ -227,45 +699,202 @@ void parseMMapEvents(FILE *file) {
                 while (*ptr == ' ' || *ptr == ':') ptr++;
                 char *fileNameStart = strchr(ptr, '/');
                 if (fileNameStart) {
-                    strncpy(info.FileName, fileNameStart, MAX_FILENAME_LENGTH - 1);
-                    info.FileName[MAX_FILENAME_LENGTH - 1] = '\0';
+                    info.FileId = internString(&FileNames, fileNameStart, strcspn(fileNameStart, "\n"));
                 }
             }
+            if (info.FileId == INVALID_STRING_ID) continue;
 
-            if (!isDuplicate(&info)) {
-                BinaryMMapInfo[BinaryMMapInfoSize++] = info;
-            }
+            addMMapInfo(&info);
+        }
+    }
+}
+
+// 去重后保存mmap信息，只需要与同一个进程的映射比较
+void addMMapInfo(MMapInfo *info) {
+    ProcessInfo *process = findProcess(info->PID);
+    if (!process) {
+        process = insertProcess(info->PID);
+        if (!process) {
+            fprintf(stderr, "Error allocating memory for process table\n");
+            return;
+        }
+    } else if (process->Exited) {
+        resetExitedProcess(process);
+    }
+    if (process->Maps && isDuplicate(process->Maps, info)) return;
+    MMapSet *maps = getWritableMMapSet(process);
+    if (!maps) {
+        fprintf(stderr, "Error allocating memory for mmap info\n");
+        return;
+    }
+    if (maps->Size == maps->Capacity) {
+        int capacity = maps->Capacity ? maps->Capacity * 2 : INITIAL_MMAP_SET_SIZE;
+        MMapInfo *entries = (MMapInfo *)realloc(maps->Entries, capacity * sizeof(MMapInfo));
+        if (!entries) {
+            fprintf(stderr, "Error allocating memory for mmap info\n");
+            return;
         }
+        maps->Entries = entries;
+        maps->Capacity = capacity;
     }
+    if ((maps->Size + 1) * 2 > maps->IndexCapacity && !rebuildMMapIndex(maps, maps->Capacity * 2)) {
+        fprintf(stderr, "Error allocating memory for mmap info\n");
+        return;
+    }
+    maps->Entries[maps->Size++] = *info;
+    insertMMapIndex(maps, maps->Size - 1);
 }
 
-// 打印mmap信息到文件
+int compareProcessSeq(const void *a, const void *b) {
+    uint64_t A = (*(const ProcessInfo * const *)a)->Seq;
+    uint64_t B = (*(const ProcessInfo * const *)b)->Seq;
+    return A < B ? -1 : (A > B);
+}
+
+// 打印mmap信息到文件，按进程的创建顺序输出，fork出来的子进程输出继承的所有映射
 void printMMapInfo(FILE *outputFile) {
-    for (int i = 0; i < BinaryMMapInfoSize; ++i) {
-        fprintf(outputFile, "Time: %" PRIu64 "\n", BinaryMMapInfo[i].Time);
-        fprintf(outputFile, "PID: %d\n", BinaryMMapInfo[i].PID);
-        fprintf(outputFile, "MMapAddress: 0x%lx\n", BinaryMMapInfo[i].MMapAddress);
-        fprintf(outputFile, "Size: 0x%lx\n", BinaryMMapInfo[i].Size);
-        fprintf(outputFile, "Offset: 0x%lx\n", BinaryMMapInfo[i].Offset);
-        fprintf(outputFile, "FileName: %s\n", BinaryMMapInfo[i].FileName);
-        fprintf(outputFile, "Forked: %d\n\n", BinaryMMapInfo[i].forked);
-    }
-}
-
-// 判断是否有重复
-int isDuplicate(MMapInfo *info) {
-    for (int i = 0; i < BinaryMMapInfoSize; ++i) {
-        if (BinaryMMapInfo[i].PID == info->PID &&
-            BinaryMMapInfo[i].MMapAddress == info->MMapAddress &&
-            BinaryMMapInfo[i].Size == info->Size &&
-            BinaryMMapInfo[i].Offset == info->Offset &&
-            strcmp(BinaryMMapInfo[i].FileName, info->FileName) == 0) {
+    ProcessInfo **sorted = (ProcessInfo **)malloc((Processes.Size + 1) * sizeof(ProcessInfo *));
+    if (!sorted) {
+        fprintf(stderr, "Error allocating memory for mmap output\n");
+        return;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < Processes.Capacity; ++i) {
+        if (Processes.Slots[i].PID >= 0) {
+            sorted[count++] = &Processes.Slots[i];
+        }
+    }
+    qsort(sorted, count, sizeof(ProcessInfo *), compareProcessSeq);
+    for (size_t i = 0; i < count; ++i) {
+        const MMapSet *maps = sorted[i]->Maps;
+        for (int j = 0; maps && j < maps->Size; ++j) {
+            fprintf(outputFile, "Time: %" PRIu64 "\n", maps->Entries[j].Time);
+            fprintf(outputFile, "PID: %d\n", sorted[i]->PID);
+            fprintf(outputFile, "MMapAddress: 0x%lx\n", maps->Entries[j].MMapAddress);
+            fprintf(outputFile, "Size: 0x%lx\n", maps->Entries[j].Size);
+            fprintf(outputFile, "Offset: 0x%lx\n", maps->Entries[j].Offset);
+            fprintf(outputFile, "FileName: %s\n", getPooledString(&FileNames, maps->Entries[j].FileId));
+            fprintf(outputFile, "Forked: %d\n\n", sorted[i]->forked);
+        }
+    }
+    free(sorted);
+}
+
+static inline uint64_t hashMMapKey(const MMapInfo *info) {
+    uint64_t hash = info->FileId * 0x9E3779B97F4A7C15ULL;
+    hash = (hash ^ info->MMapAddress) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ info->Size) * 0x94D049BB133111EBULL;
+    hash = (hash ^ info->Offset) * 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 31);
+}
+
+static inline bool isSameMapping(const MMapInfo *a, const MMapInfo *b) {
+    return a->FileId == b->FileId && a->MMapAddress == b->MMapAddress &&
+           a->Size == b->Size && a->Offset == b->Offset;
+}
+
+void insertMMapIndex(MMapSet *maps, int entry) {
+    size_t mask = maps->IndexCapacity - 1;
+    size_t index = hashMMapKey(&maps->Entries[entry]) & mask;
+    while (maps->Index[index] != 0) {
+        index = (index + 1) & mask;
+    }
+    maps->Index[index] = (uint32_t)entry + 1;
+}
+
+// 重建集合的去重哈希表，capacity向上取整到2的幂
+bool rebuildMMapIndex(MMapSet *maps, int capacity) {
+    int indexCapacity = INITIAL_MMAP_SET_SIZE * 2;
+    while (indexCapacity < capacity) indexCapacity *= 2;
+    uint32_t *slots = (uint32_t *)calloc(indexCapacity, sizeof(uint32_t));
+    if (!slots) return false;
+    free(maps->Index);
+    maps->Index = slots;
+    maps->IndexCapacity = indexCapacity;
+    for (int i = 0; i < maps->Size; ++i) {
+        insertMMapIndex(maps, i);
+    }
+    return true;
+}
+
+// 判断是否有重复，只查哈希表，不再逐项比较文件名
+int isDuplicate(const MMapSet *maps, MMapInfo *info) {
+    if (maps->IndexCapacity == 0) return 0;
+    size_t mask = maps->IndexCapacity - 1;
+    size_t index = hashMMapKey(info) & mask;
+    while (maps->Index[index] != 0) {
+        if (isSameMapping(&maps->Entries[maps->Index[index] - 1], info)) {
             return 1;
         }
+        index = (index + 1) & mask;
     }
     return 0;
 }
 
+static inline uint64_t hashString(const char *str, size_t len) {
+    uint64_t hash = 0xCBF29CE484222325ULL;  // FNV-1a
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ (uint8_t)str[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// 返回字符串在池中的编号，第一次出现时拷贝一份，内存不足时返回INVALID_STRING_ID
+uint32_t internString(StringPool *pool, const char *str, size_t len) {
+    if ((pool->Count + 1) * 2 > pool->SlotCapacity) {
+        uint32_t capacity = pool->SlotCapacity ? pool->SlotCapacity * 2 : INITIAL_STRING_POOL_SIZE;
+        uint32_t *slots = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+        if (!slots) return INVALID_STRING_ID;
+        for (uint32_t id = 0; id < pool->Count; ++id) {
+            const char *old = pool->Data + pool->Offsets[id];
+            size_t index = hashString(old, strlen(old)) & (capacity - 1);
+            while (slots[index] != 0) {
+                index = (index + 1) & (capacity - 1);
+            }
+            slots[index] = id + 1;
+        }
+        free(pool->Slots);
+        pool->Slots = slots;
+        pool->SlotCapacity = capacity;
+    }
+
+    size_t mask = pool->SlotCapacity - 1;
+    size_t index = hashString(str, len) & mask;
+    while (pool->Slots[index] != 0) {
+        const char *candidate = pool->Data + pool->Offsets[pool->Slots[index] - 1];
+        if (strncmp(candidate, str, len) == 0 && candidate[len] == '\0') {
+            return pool->Slots[index] - 1;
+        }
+        index = (index + 1) & mask;
+    }
+
+    if (pool->Size + len + 1 > pool->Capacity) {
+        size_t capacity = pool->Capacity ? pool->Capacity : 4096;
+        while (pool->Size + len + 1 > capacity) capacity *= 2;
+        char *data = (char *)realloc(pool->Data, capacity);
+        if (!data) return INVALID_STRING_ID;
+        pool->Data = data;
+        pool->Capacity = capacity;
+    }
+    if (pool->Count == pool->OffsetCapacity) {
+        uint32_t capacity = pool->OffsetCapacity ? pool->OffsetCapacity * 2 : INITIAL_STRING_POOL_SIZE;
+        uint32_t *offsets = (uint32_t *)realloc(pool->Offsets, capacity * sizeof(uint32_t));
+        if (!offsets) return INVALID_STRING_ID;
+        pool->Offsets = offsets;
+        pool->OffsetCapacity = capacity;
+    }
+    memcpy(pool->Data + pool->Size, str, len);
+    pool->Data[pool->Size + len] = '\0';
+    pool->Offsets[pool->Count] = (uint32_t)pool->Size;
+    pool->Size += len + 1;
+    pool->Slots[index] = pool->Count + 1;
+    return pool->Count++;
+}
+
+const char* getPooledString(const StringPool *pool, uint32_t id) {
+    return pool->Data + pool->Offsets[id];
+}
+
 // 判断PID是否有效
 int isValidPID(int pid) {
     return pid >= 0 && pid <= INT_MAX;
@@ -276,29 +905,122 @@ int isDeletedFile(const char *fileName) {
     return strstr(fileName, "(deleted)") != NULL;
 }
 
-// 查找PID
-MMapInfo* findMMapInfo(int pid) {
-    for (int i = 0; i < BinaryMMapInfoSize; ++i) {
-        if (BinaryMMapInfo[i].PID == pid) {
-            return &BinaryMMapInfo[i];
+static inline size_t hashPID(int pid, size_t capacity) {
+    return (size_t)(((uint64_t)(uint32_t)pid * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+}
+
+// 查找PID，平均O(1)
+ProcessInfo* findProcess(int pid) {
+    if (Processes.Capacity == 0) return NULL;
+    size_t index = hashPID(pid, Processes.Capacity);
+    while (Processes.Slots[index].PID != EMPTY_PID) {
+        if (Processes.Slots[index].PID == pid) {
+            return &Processes.Slots[index];
         }
+        index = (index + 1) & (Processes.Capacity - 1);
     }
     return NULL;
 }
 
-// 从列表中移除PID
-void removeMMapInfo(int pid) {
-    if (BinaryMMapInfoSize == 0) return;  // 如果数组为空，直接返回
+// 槽数扩大（或者只清理墓碑）后重新插入所有进程
+bool rehashProcessTable(size_t capacity) {
+    ProcessInfo *slots = (ProcessInfo *)malloc(capacity * sizeof(ProcessInfo));
+    if (!slots) return false;
+    for (size_t i = 0; i < capacity; ++i) {
+        slots[i].PID = EMPTY_PID;
+    }
+    for (size_t i = 0; i < Processes.Capacity; ++i) {
+        if (Processes.Slots[i].PID < 0) continue;
+        size_t index = hashPID(Processes.Slots[i].PID, capacity);
+        while (slots[index].PID != EMPTY_PID) {
+            index = (index + 1) & (capacity - 1);
+        }
+        slots[index] = Processes.Slots[i];
+    }
+    free(Processes.Slots);
+    Processes.Slots = slots;
+    Processes.Capacity = capacity;
+    Processes.Used = Processes.Size;
+    return true;
+}
 
-    for (int i = 0; i < BinaryMMapInfoSize; ++i) {
-        if (BinaryMMapInfo[i].PID == pid && BinaryMMapInfo[i].forked) {
-            for (int j = i; j < BinaryMMapInfoSize - 1; ++j) {
-                BinaryMMapInfo[j] = BinaryMMapInfo[j + 1];
-            }
-            BinaryMMapInfoSize--;
-            return;  // 找到并移除后直接返回
+// 插入一个还不存在的PID，返回新的项
+ProcessInfo* insertProcess(int pid) {
+    if ((Processes.Used + 1) * 2 > Processes.Capacity) {
+        size_t capacity = Processes.Capacity ? Processes.Capacity : INITIAL_PROCESS_TABLE_SIZE;
+        if ((Processes.Size + 1) * 4 > capacity) {
+            capacity *= 2;
         }
+        if (!rehashProcessTable(capacity)) return NULL;
+    }
+    size_t index = hashPID(pid, Processes.Capacity);
+    while (Processes.Slots[index].PID >= 0) {
+        index = (index + 1) & (Processes.Capacity - 1);
+    }
+    if (Processes.Slots[index].PID == EMPTY_PID) {
+        ++Processes.Used;
     }
+    ++Processes.Size;
+    ProcessInfo *process = &Processes.Slots[index];
+    memset(process, 0, sizeof(*process));
+    process->PID = pid;
+    process->Seq = Processes.NextSeq++;
+    return process;
+}
+
+void releaseMMapSet(MMapSet *maps) {
+    if (maps && --maps->RefCount == 0) {
+        free(maps->Entries);
+        free(maps->Index);
+        free(maps);
+    }
+}
+
+// 返回进程自己独占的映射集合，与其他进程共享时先复制一份
+MMapSet* getWritableMMapSet(ProcessInfo *process) {
+    MMapSet *maps = process->Maps;
+    if (maps && maps->RefCount == 1) {
+        return maps;
+    }
+    MMapSet *copy = (MMapSet *)calloc(1, sizeof(MMapSet));
+    if (!copy) return NULL;
+    copy->RefCount = 1;
+    if (maps && maps->Size > 0) {
+        copy->Entries = (MMapInfo *)malloc(maps->Size * sizeof(MMapInfo));
+        copy->Index = (uint32_t *)malloc(maps->IndexCapacity * sizeof(uint32_t));
+        if (!copy->Entries || !copy->Index) {
+            free(copy->Entries);
+            free(copy->Index);
+            free(copy);
+            return NULL;
+        }
+        memcpy(copy->Entries, maps->Entries, maps->Size * sizeof(MMapInfo));
+        memcpy(copy->Index, maps->Index, maps->IndexCapacity * sizeof(uint32_t));
+        copy->Size = copy->Capacity = maps->Size;
+        copy->IndexCapacity = maps->IndexCapacity;
+    }
+    releaseMMapSet(maps);
+    process->Maps = copy;
+    return copy;
+}
+
+// PID被新进程复用：丢弃已经退出的进程的映射，作为新进程重新开始，创建顺序也重新分配
+void resetExitedProcess(ProcessInfo *process) {
+    releaseMMapSet(process->Maps);
+    process->Maps = NULL;
+    process->forked = 0;
+    process->Exited = false;
+    process->Seq = Processes.NextSeq++;
+}
+
+// 从进程表中移除PID，只留下墓碑，O(1)
+void removeProcess(int pid) {
+    ProcessInfo *process = findProcess(pid);
+    if (!process) return;
+    releaseMMapSet(process->Maps);
+    process->Maps = NULL;
+    process->PID = DELETED_PID;
+    --Processes.Size;
 }
 
 // 解析 "PERF_RECORD_COMM exec" 行中的 PID
@@ -340,12 +1062,584 @@ int parseTaskEvents(FILE *file) {
         int pid;
         if (parseCommExecEvent(buffer, &pid) == 0) {
             printf("Parsed PID: %d\n", pid);
+            handleCommExecEvent(pid);
+            continue;
+        }
 
-            MMapInfo *info = findMMapInfo(pid);
-            if (info && info->forked) {  // 如果找到了info并且它是forked
-                removeMMapInfo(pid);
-            }
+        // PERF_RECORD_FORK(child:tid):(parent:ptid)
+        const char *fork = strstr(buffer, "PERF_RECORD_FORK(");
+        int childPID, parentPID;
+        if (fork && sscanf(fork, "PERF_RECORD_FORK(%d:%*d):(%d:%*d)", &childPID, &parentPID) == 2) {
+            handleForkEvent(parentPID, childPID);
+            continue;
+        }
+
+        // PERF_RECORD_EXIT(pid:tid):(ppid:ptid)
+        const char *exit = strstr(buffer, "PERF_RECORD_EXIT(");
+        int exitPID, exitTID;
+        if (exit && sscanf(exit, "PERF_RECORD_EXIT(%d:%d)", &exitPID, &exitTID) == 2 && exitPID == exitTID) {
+            handleExitEvent(exitPID);
+        }
+    }
+    return 0;
+}
+
+// exec之后子进程不再共享父进程的映射，删除forked的mmap信息
+void handleCommExecEvent(int pid) {
+    ProcessInfo *process = findProcess(pid);
+    if (process && process->Exited) {
+        resetExitedProcess(process);
+    }
+    if (process && process->forked) {  // 如果找到了进程并且它是forked
+        removeProcess(pid);
+    }
+}
+
+// fork出来的子进程继承父进程的全部mmap信息，与父进程共享同一个集合
+void handleForkEvent(int parentPID, int childPID) {
+    if (parentPID == childPID) return;
+
+    ProcessInfo *parent = findProcess(parentPID);
+    if (!parent || !parent->Maps) return;
+    MMapSet *maps = parent->Maps;  // 插入可能扩容，parent指针随之失效
+
+    ProcessInfo *child = findProcess(childPID);
+    if (child && !child->Exited) return;
+    if (child) {
+        // prefork的服务中PID会被大量复用，复用已退出进程的PID时换成父进程的映射
+        ++maps->RefCount;
+        resetExitedProcess(child);
+    } else {
+        child = insertProcess(childPID);
+        if (!child) {
+            fprintf(stderr, "Error allocating memory for process table\n");
+            return;
+        }
+        ++maps->RefCount;
+    }
+    child->Maps = maps;
+    child->forked = 1;
+}
+
+// 进程退出后仍然保留它的映射，之后解析它的sample时还要用到，只做标记；PID被复用时由resetExitedProcess重新开始
+void handleExitEvent(int pid) {
+    ProcessInfo *process = findProcess(pid);
+    if (process) {
+        process->Exited = true;
+    }
+}
+
+
+// 映射perf.data文件并读取文件头和attr信息
+bool openPerfDataFile(const char *filename, PerfDataFile *perf) {
+    memset(perf, 0, sizeof(*perf));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        perror("open perf.data");
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PerfFileHeader)) {
+        fprintf(stderr, "perf.data is too small: %s\n", filename);
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap perf.data");
+        return false;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    perf->Data = (const uint8_t *)data;
+    perf->Size = st.st_size;
+    memcpy(&perf->Header, perf->Data, sizeof(PerfFileHeader));
+
+    // 只支持普通文件模式的PERFILE2，pipe模式的文件头只有16字节
+    PerfFileHeader *header = &perf->Header;
+    if (header->magic != PERF_MAGIC2 || header->size < sizeof(PerfFileHeader)) {
+        fprintf(stderr, "Unsupported perf.data format (pipe mode or wrong endian): %s\n", filename);
+        closePerfDataFile(perf);
+        return false;
+    }
+    if (header->data.offset + header->data.size > perf->Size ||
+        header->attrs.offset + header->attrs.size > perf->Size ||
+        header->attr_size < 16) {
+        fprintf(stderr, "Truncated perf.data: %s\n", filename);
+        closePerfDataFile(perf);
+        return false;
+    }
+
+    // 每个perf_file_attr由perf_event_attr和ids段组成，ids段位于末尾16字节
+    perf->NumAttrs = header->attrs.size / header->attr_size;
+    perf->Attrs = (PerfAttrInfo *)calloc(perf->NumAttrs ? perf->NumAttrs : 1, sizeof(PerfAttrInfo));
+    if (!perf->Attrs) {
+        perror("calloc");
+        closePerfDataFile(perf);
+        return false;
+    }
+    for (size_t i = 0; i < perf->NumAttrs; ++i) {
+        const uint8_t *attr = perf->Data + header->attrs.offset + i * header->attr_size;
+        PerfAttrInfo *info = &perf->Attrs[i];
+        uint32_t attrSize;
+        uint64_t flags;
+        memcpy(&attrSize, attr + 4, sizeof(attrSize));
+        memcpy(&info->SampleType, attr + 24, sizeof(uint64_t));
+        memcpy(&info->ReadFormat, attr + 32, sizeof(uint64_t));
+        memcpy(&flags, attr + 40, sizeof(uint64_t));
+        info->SampleIdAll = (flags & PERF_ATTR_SAMPLE_ID_ALL) != 0;
+        if (attrSize >= 80) {
+            memcpy(&info->BranchSampleType, attr + 72, sizeof(uint64_t));
+        }
+
+        PerfFileSection ids;
+        memcpy(&ids, attr + header->attr_size - sizeof(ids), sizeof(ids));
+        if (ids.offset + ids.size <= perf->Size) {
+            info->IDs = (const uint64_t *)(perf->Data + ids.offset);
+            info->NumIDs = ids.size / sizeof(uint64_t);
+        }
+        snprintf(info->Name, sizeof(info->Name), "event%zu", i);
+    }
+    readPerfEventDesc(perf);
+    return true;
+}
+
+void closePerfDataFile(PerfDataFile *perf) {
+    if (perf->Data) {
+        munmap((void *)perf->Data, perf->Size);
+    }
+    free(perf->Attrs);
+    memset(perf, 0, sizeof(*perf));
+}
+
+// 从HEADER_EVENT_DESC特性段中读取事件名，perf script -F event输出的就是这个名字
+void readPerfEventDesc(PerfDataFile *perf) {
+    const PerfFileHeader *header = &perf->Header;
+    if (!(header->adds_features[HEADER_EVENT_DESC / 64] & (1ULL << (HEADER_EVENT_DESC % 64)))) {
+        return;
+    }
+
+    // 特性段表紧跟在数据段之后，按照特性位从小到大排列
+    size_t index = 0;
+    for (int feat = 0; feat < HEADER_EVENT_DESC; ++feat) {
+        if (header->adds_features[feat / 64] & (1ULL << (feat % 64))) {
+            ++index;
+        }
+    }
+    uint64_t tableOffset = header->data.offset + header->data.size + index * sizeof(PerfFileSection);
+    if (tableOffset + sizeof(PerfFileSection) > perf->Size) return;
+    PerfFileSection section;
+    memcpy(&section, perf->Data + tableOffset, sizeof(section));
+    if (section.offset + section.size > perf->Size || section.size < 8) return;
+
+    const uint8_t *ptr = perf->Data + section.offset;
+    const uint8_t *end = ptr + section.size;
+    uint32_t nr, attrSize;
+    memcpy(&nr, ptr, 4);
+    memcpy(&attrSize, ptr + 4, 4);
+    ptr += 8;
+    for (uint32_t i = 0; i < nr && i < perf->NumAttrs; ++i) {
+        uint32_t nrIds, len;
+        if (ptr + attrSize + 8 > end) return;
+        ptr += attrSize;
+        memcpy(&nrIds, ptr, 4);
+        memcpy(&len, ptr + 4, 4);
+        ptr += 8;
+        if (ptr + len + (uint64_t)nrIds * 8 > end) return;
+        snprintf(perf->Attrs[i].Name, sizeof(perf->Attrs[i].Name), "%.*s", (int)strnlen((const char *)ptr, len), ptr);
+        ptr += len + (uint64_t)nrIds * 8;
+    }
+}
+
+// 根据sample中的id找到对应的attr，只有一个attr时直接返回
+const PerfAttrInfo* findPerfAttr(const PerfDataFile *perf, const uint8_t *body, size_t size) {
+    if (perf->NumAttrs == 0) return NULL;
+    if (perf->NumAttrs == 1) return &perf->Attrs[0];
+
+    uint64_t sampleType = perf->Attrs[0].SampleType;
+    size_t pos = 0;
+    if (!(sampleType & PERF_SAMPLE_IDENTIFIER)) {
+        if (!(sampleType & PERF_SAMPLE_ID)) return &perf->Attrs[0];
+        // 没有IDENTIFIER时，ID位于IP、TID、TIME、ADDR之后
+        if (sampleType & PERF_SAMPLE_IP) pos += 8;
+        if (sampleType & PERF_SAMPLE_TID) pos += 8;
+        if (sampleType & PERF_SAMPLE_TIME) pos += 8;
+        if (sampleType & PERF_SAMPLE_ADDR) pos += 8;
+    }
+    if (pos + 8 > size) return NULL;
+
+    uint64_t id;
+    memcpy(&id, body + pos, sizeof(id));
+    for (size_t i = 0; i < perf->NumAttrs; ++i) {
+        for (size_t j = 0; j < perf->Attrs[i].NumIDs; ++j) {
+            if (perf->Attrs[i].IDs[j] == id) return &perf->Attrs[i];
         }
     }
+    return NULL;
+}
+
+// 按照sample_type的顺序解析PERF_RECORD_SAMPLE，只解析到BRANCH_STACK为止
+bool parsePerfSample(const PerfDataFile *perf, const uint8_t *body, size_t size, PerfSampleRecord *sample) {
+    memset(sample, 0, sizeof(*sample));
+    sample->Attr = findPerfAttr(perf, body, size);
+    if (!sample->Attr) return false;
+
+    uint64_t sampleType = sample->Attr->SampleType;
+    const uint8_t *ptr = body;
+    const uint8_t *end = body + size;
+    uint64_t value;
+
+#define READ_U64(dst) do { if (ptr + 8 > end) return false; memcpy(&(dst), ptr, 8); ptr += 8; } while (0)
+#define SKIP_BYTES(n) do { if ((uint64_t)(end - ptr) < (uint64_t)(n)) return false; ptr += (n); } while (0)
+
+    if (sampleType & PERF_SAMPLE_IDENTIFIER) SKIP_BYTES(8);
+    if (sampleType & PERF_SAMPLE_IP) READ_U64(sample->IP);
+    if (sampleType & PERF_SAMPLE_TID) {
+        uint32_t pid;
+        if (ptr + 8 > end) return false;
+        memcpy(&pid, ptr, 4);
+        sample->PID = (int)pid;
+        ptr += 8;
+    }
+    if (sampleType & PERF_SAMPLE_TIME) READ_U64(sample->Time);
+    if (sampleType & PERF_SAMPLE_ADDR) READ_U64(sample->Addr);
+    if (sampleType & PERF_SAMPLE_ID) SKIP_BYTES(8);
+    if (sampleType & PERF_SAMPLE_STREAM_ID) SKIP_BYTES(8);
+    if (sampleType & PERF_SAMPLE_CPU) SKIP_BYTES(8);
+    if (sampleType & PERF_SAMPLE_PERIOD) SKIP_BYTES(8);
+    if (sampleType & PERF_SAMPLE_READ) {
+        uint64_t readFormat = sample->Attr->ReadFormat;
+        size_t valueSize = 8;
+        if (readFormat & PERF_FORMAT_ID) valueSize += 8;
+        if (readFormat & PERF_FORMAT_LOST) valueSize += 8;
+        size_t times = ((readFormat & PERF_FORMAT_TOTAL_TIME_ENABLED) ? 8 : 0) +
+                       ((readFormat & PERF_FORMAT_TOTAL_TIME_RUNNING) ? 8 : 0);
+        if (readFormat & PERF_FORMAT_GROUP) {
+            READ_U64(value);
+            SKIP_BYTES(times);
+            if (value > size) return false;
+            SKIP_BYTES(value * valueSize);
+        } else {
+            SKIP_BYTES(valueSize + times);
+        }
+    }
+    if (sampleType & PERF_SAMPLE_CALLCHAIN) {
+        READ_U64(value);
+        if (value > size) return false;
+        SKIP_BYTES(value * 8);
+    }
+    if (sampleType & PERF_SAMPLE_RAW) {
+        uint32_t rawSize;
+        if (ptr + 4 > end) return false;
+        memcpy(&rawSize, ptr, 4);
+        SKIP_BYTES(4 + (uint64_t)rawSize);
+    }
+    if (sampleType & PERF_SAMPLE_BRANCH_STACK) {
+        READ_U64(sample->NumBranches);
+        if (sample->Attr->BranchSampleType & PERF_SAMPLE_BRANCH_HW_INDEX) SKIP_BYTES(8);
+        if (sample->NumBranches > size) return false;
+        sample->Branches = ptr;
+        SKIP_BYTES(sample->NumBranches * PERF_BRANCH_ENTRY_SIZE);
+    }
+
+#undef READ_U64
+#undef SKIP_BYTES
+    return true;
+}
+
+// 非SAMPLE记录在sample_id_all打开时末尾带有sample_id，从中取出时间戳
+uint64_t parseSampleIdTime(const PerfDataFile *perf, const uint8_t *body, size_t size) {
+    if (perf->NumAttrs == 0 || !perf->Attrs[0].SampleIdAll) return 0;
+    uint64_t sampleType = perf->Attrs[0].SampleType;
+    if (!(sampleType & PERF_SAMPLE_TIME)) return 0;
+
+    // sample_id的顺序为TID、TIME、ID、STREAM_ID、CPU、IDENTIFIER，TIME之后的字段各占8字节
+    size_t tail = 8;
+    if (sampleType & PERF_SAMPLE_ID) tail += 8;
+    if (sampleType & PERF_SAMPLE_STREAM_ID) tail += 8;
+    if (sampleType & PERF_SAMPLE_CPU) tail += 8;
+    if (sampleType & PERF_SAMPLE_IDENTIFIER) tail += 8;
+    if (tail > size) return 0;
+
+    uint64_t time;
+    memcpy(&time, body + size - tail, sizeof(time));
+    return time;
+}
+
+// 把记录中的perf_branch_entry数组转换成PerfBranchSample
+bool fillBranchSample(const PerfSampleRecord *record, PerfBranchSample *sample) {
+    if (record->NumBranches > sample->LBRCapacity) {
+        size_t capacity = sample->LBRCapacity ? sample->LBRCapacity : INITIAL_LBR_CAPACITY;
+        while (capacity < record->NumBranches) capacity *= 2;
+        LBREntry *newLBR = (LBREntry *)realloc(sample->LBR, capacity * sizeof(LBREntry));
+        if (!newLBR) {
+            fprintf(stderr, "Error reallocating memory for LBR entries\n");
+            return false;
+        }
+        sample->LBR = newLBR;
+        sample->LBRCapacity = capacity;
+    }
+
+    sample->PID = record->PID;
+    sample->PC = record->IP;
+    sample->LBRCount = record->NumBranches;
+    for (size_t i = 0; i < record->NumBranches; ++i) {
+        const uint8_t *entry = record->Branches + i * PERF_BRANCH_ENTRY_SIZE;
+        memcpy(&sample->LBR[i].from, entry, 8);
+        memcpy(&sample->LBR[i].to, entry + 8, 8);
+        memcpy(&sample->LBR[i].flags, entry + 16, 8);
+        sample->LBR[i].mispred = sample->LBR[i].flags & 1;
+    }
+    return true;
+}
+
+// 按照perf script -F pid,ip,brstack的格式输出，branch1.c和shell脚本都可以直接读取
+void writeBranchSample(FILE *file, const PerfBranchSample *sample) {
+    fprintf(file, "%7" PRIu64 " %16" PRIx64, sample->PID, sample->PC);
+    for (size_t i = 0; i < sample->LBRCount; ++i) {
+        const LBREntry *entry = &sample->LBR[i];
+        uint64_t flags = entry->flags;
+        fprintf(file, " 0x%" PRIx64 "/0x%" PRIx64 "/%c/%c/%c/%u",
+                entry->from, entry->to,
+                entry->mispred ? 'M' : ((flags & 2) ? 'P' : '-'),
+                (flags & 4) ? 'X' : '-',
+                (flags & 8) ? 'A' : '-',
+                (unsigned)((flags >> 4) & 0xffff));
+    }
+    fputc('\n', file);
+}
+
+// 获取记录的时间戳，SAMPLE中TIME位于IDENTIFIER、IP、TID之后，其他记录从sample_id中获取
+uint64_t getPerfRecordTime(const PerfDataFile *perf, const uint8_t *record) {
+    PerfEventHeader header;
+    memcpy(&header, record, sizeof(header));
+    const uint8_t *body = record + sizeof(PerfEventHeader);
+    size_t size = header.size - sizeof(PerfEventHeader);
+
+    if (header.type != PERF_RECORD_SAMPLE) {
+        return parseSampleIdTime(perf, body, size);
+    }
+    const PerfAttrInfo *attr = findPerfAttr(perf, body, size);
+    if (!attr || !(attr->SampleType & PERF_SAMPLE_TIME)) return 0;
+    size_t pos = 0;
+    if (attr->SampleType & PERF_SAMPLE_IDENTIFIER) pos += 8;
+    if (attr->SampleType & PERF_SAMPLE_IP) pos += 8;
+    if (attr->SampleType & PERF_SAMPLE_TID) pos += 8;
+    if (pos + 8 > size) return 0;
+
+    uint64_t time;
+    memcpy(&time, body + pos, sizeof(time));
+    return time;
+}
+
+bool queuePerfEvent(PerfEventDispatcher *dispatcher, const uint8_t *record, uint64_t seq) {
+    if (dispatcher->QueueSize == dispatcher->QueueCapacity) {
+        size_t capacity = dispatcher->QueueCapacity ? dispatcher->QueueCapacity * 2 : 4096;
+        PerfQueuedEvent *newQueue = (PerfQueuedEvent *)realloc(dispatcher->Queue, capacity * sizeof(PerfQueuedEvent));
+        if (!newQueue) {
+            fprintf(stderr, "Error reallocating memory for event queue\n");
+            return false;
+        }
+        dispatcher->Queue = newQueue;
+        dispatcher->QueueCapacity = capacity;
+    }
+    PerfQueuedEvent *event = &dispatcher->Queue[dispatcher->QueueSize++];
+    event->Time = getPerfRecordTime(dispatcher->Perf, record);
+    event->Seq = seq;
+    event->Record = record;
+    return true;
+}
+
+int comparePerfQueuedEvent(const void *a, const void *b) {
+    const PerfQueuedEvent *lhs = (const PerfQueuedEvent *)a;
+    const PerfQueuedEvent *rhs = (const PerfQueuedEvent *)b;
+    if (lhs->Time != rhs->Time) return lhs->Time < rhs->Time ? -1 : 1;
+    return lhs->Seq < rhs->Seq ? -1 : (lhs->Seq > rhs->Seq);
+}
+
+// 按时间戳排序后分发所有不晚于limit的事件，剩余的事件留到下一轮
+void flushPerfEvents(PerfEventDispatcher *dispatcher, uint64_t limit) {
+    if (dispatcher->QueueSize == 0) return;
+    qsort(dispatcher->Queue, dispatcher->QueueSize, sizeof(PerfQueuedEvent), comparePerfQueuedEvent);
+
+    size_t i = 0;
+    while (i < dispatcher->QueueSize && dispatcher->Queue[i].Time <= limit) {
+        dispatchPerfEvent(dispatcher, dispatcher->Queue[i].Record);
+        ++i;
+    }
+    memmove(dispatcher->Queue, dispatcher->Queue + i, (dispatcher->QueueSize - i) * sizeof(PerfQueuedEvent));
+    dispatcher->QueueSize -= i;
+}
+
+// 事件分发器：把每条记录交给对应的mmap、task、branch、mem处理函数
+void dispatchPerfEvent(PerfEventDispatcher *dispatcher, const uint8_t *record) {
+    PerfEventHeader header;
+    memcpy(&header, record, sizeof(header));
+    const uint8_t *body = record + sizeof(PerfEventHeader);
+    size_t size = header.size - sizeof(PerfEventHeader);
+
+    switch (header.type) {
+        case PERF_RECORD_MMAP:
+        case PERF_RECORD_MMAP2:
+            handleMMapRecord(dispatcher, &header, body, size);
+            break;
+        case PERF_RECORD_COMM:
+        case PERF_RECORD_FORK:
+        case PERF_RECORD_EXIT:
+            handleTaskRecord(dispatcher, &header, body, size);
+            break;
+        case PERF_RECORD_SAMPLE:
+            handleSampleRecord(dispatcher, body, size);
+            break;
+        default:
+            break;
+    }
+}
+
+// 处理MMAP/MMAP2记录
+void handleMMapRecord(PerfEventDispatcher *dispatcher, const PerfEventHeader *header, const uint8_t *body, size_t size) {
+    size_t nameOffset = header->type == PERF_RECORD_MMAP2 ? 64 : 32;
+    if (size <= nameOffset) return;
+
+    MMapInfo info;
+    memset(&info, 0, sizeof(info));
+    uint32_t pid;
+    memcpy(&pid, body, 4);
+    info.PID = (int)pid;
+    memcpy(&info.MMapAddress, body + 8, 8);
+    memcpy(&info.Size, body + 16, 8);
+    memcpy(&info.Offset, body + 24, 8);
+    info.Time = parseSampleIdTime(dispatcher->Perf, body, size);
+    if (!isValidPID(info.PID)) return;
+
+    // 与文本解析保持一致，文件名从第一个'/'开始，[vdso]等匿名映射的文件名为空
+    const char *name = (const char *)body + nameOffset;
+    size_t nameLen = strnlen(name, size - nameOffset);
+    const char *slash = memchr(name, '/', nameLen);
+    if (slash) {
+        info.FileId = internString(&FileNames, slash, nameLen - (slash - name));
+    } else {
+        info.FileId = internString(&FileNames, "", 0);
+    }
+    if (info.FileId == INVALID_STRING_ID) return;
+    addMMapInfo(&info);
+    ++dispatcher->NumMMapEvents;
+}
+
+// 处理COMM exec和FORK记录
+void handleTaskRecord(PerfEventDispatcher *dispatcher, const PerfEventHeader *header, const uint8_t *body, size_t size) {
+    uint32_t pid, ppid;
+    if (size < 8) return;
+    memcpy(&pid, body, 4);
+    if (header->type == PERF_RECORD_COMM) {
+        if (!(header->misc & PERF_RECORD_MISC_COMM_EXEC)) return;
+        handleCommExecEvent((int)pid);
+    } else if (header->type == PERF_RECORD_EXIT) {
+        uint32_t tid;
+        if (size < 16) return;
+        memcpy(&tid, body + 8, 4);
+        if (tid != pid) return;  // 只关心整个进程的退出，线程退出不影响映射
+        handleExitEvent((int)pid);
+    } else {
+        memcpy(&ppid, body + 4, 4);
+        handleForkEvent((int)ppid, (int)pid);
+    }
+    ++dispatcher->NumTaskEvents;
+}
+
+// 处理SAMPLE记录，带BRANCH_STACK的交给branch，带ADDR的交给mem
+void handleSampleRecord(PerfEventDispatcher *dispatcher, const uint8_t *body, size_t size) {
+    PerfSampleRecord record;
+    if (!parsePerfSample(dispatcher->Perf, body, size, &record)) return;
+
+    uint64_t sampleType = record.Attr->SampleType;
+    if (sampleType & PERF_SAMPLE_BRANCH_STACK) {
+        if (fillBranchSample(&record, &dispatcher->BranchSample)) {
+            writeBranchSample(dispatcher->BranchFile, &dispatcher->BranchSample);
+            ++dispatcher->NumBranchSamples;
+        }
+    }
+    if (sampleType & PERF_SAMPLE_ADDR) {
+        fprintf(dispatcher->MemFile, "%7d %s: %16" PRIx64 " %16" PRIx64 "\n",
+                record.PID, record.Attr->Name, record.Addr, record.IP);
+        ++dispatcher->NumMemSamples;
+    }
+}
+
+// 只遍历一次perf.data，按时间戳顺序把记录分发给各个处理函数
+// 排序方式与perf的ordered_events一致：遇到FINISHED_ROUND时，上一轮之前出现的最大时间戳之前的事件都已经到齐
+int processPerfData(const char *filename) {
+    PerfDataFile perf;
+    if (!openPerfDataFile(filename, &perf)) {
+        return 1;
+    }
+
+    PerfEventDispatcher dispatcher;
+    memset(&dispatcher, 0, sizeof(dispatcher));
+    dispatcher.Perf = &perf;
+    dispatcher.BranchFile = fopen(TEMP_BRANCH_FILE, "w");
+    dispatcher.MemFile = fopen(TEMP_MEM_FILE, "w");
+    if (!dispatcher.BranchFile || !dispatcher.MemFile) {
+        perror("fopen");
+        if (dispatcher.BranchFile) fclose(dispatcher.BranchFile);
+        if (dispatcher.MemFile) fclose(dispatcher.MemFile);
+        closePerfDataFile(&perf);
+        return 1;
+    }
+    printf("Processing perf.data natively in a single pass: %s\n", filename);
+
+    bool ordered = perf.NumAttrs > 0 && (perf.Attrs[0].SampleType & PERF_SAMPLE_TIME);
+    uint64_t numRecords = 0;
+    uint64_t maxTime = 0;
+    uint64_t lastRoundMaxTime = 0;
+    const uint8_t *ptr = perf.Data + perf.Header.data.offset;
+    const uint8_t *end = ptr + perf.Header.data.size;
+    while (ptr + sizeof(PerfEventHeader) <= end) {
+        PerfEventHeader header;
+        memcpy(&header, ptr, sizeof(header));
+        if (header.size < sizeof(PerfEventHeader) || ptr + header.size > end) {
+            fprintf(stderr, "Corrupted perf.data record at offset 0x%lx\n", (unsigned long)(ptr - perf.Data));
+            break;
+        }
+        const uint8_t *record = ptr;
+        ptr += header.size;
+        ++numRecords;
+
+        if (!ordered) {
+            dispatchPerfEvent(&dispatcher, record);
+            continue;
+        }
+        if (header.type == PERF_RECORD_FINISHED_ROUND) {
+            flushPerfEvents(&dispatcher, lastRoundMaxTime);
+            lastRoundMaxTime = maxTime;
+            continue;
+        }
+        if (!queuePerfEvent(&dispatcher, record, numRecords)) {
+            break;
+        }
+        uint64_t time = dispatcher.Queue[dispatcher.QueueSize - 1].Time;
+        if (time > maxTime) maxTime = time;
+    }
+    flushPerfEvents(&dispatcher, UINT64_MAX);
+
+    FILE *final_output_file = fopen(TEMP_MMAP_FILE, "w");
+    if (final_output_file) {
+        printMMapInfo(final_output_file);
+        fclose(final_output_file);
+        printf("Processed mmap events saved to: %s\n", TEMP_MMAP_FILE);
+    } else {
+        perror("fopen final_output_path");
+    }
+    fclose(dispatcher.BranchFile);
+    fclose(dispatcher.MemFile);
+    printf("Output saved to: %s, %s\n", TEMP_BRANCH_FILE, TEMP_MEM_FILE);
+    printf("Processed %" PRIu64 " records: %" PRIu64 " mmap, %" PRIu64 " task, %" PRIu64 " branch, %" PRIu64 " mem\n",
+           numRecords, dispatcher.NumMMapEvents, dispatcher.NumTaskEvents,
+           dispatcher.NumBranchSamples, dispatcher.NumMemSamples);
+
+    free(dispatcher.Queue);
+    free(dispatcher.BranchSample.LBR);
+    closePerfDataFile(&perf);
     return 0;
 }